@@ -0,0 +1,450 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if _OPENMP
+#include <omp.h>
+#endif
+#include "bt_interface.h"
+#include "bt_twister.h"
+
+#define NUM_QUERIES (1 << 22)
+
+static uint64_t *loaded_hashes_64;
+static uint128_t *loaded_hashes_128;
+static uint192_t *loaded_hashes_192;
+static unsigned int num_loaded_hashes;
+
+static uint64_t *query_64;
+static uint128_t *query_128;
+static uint192_t *query_192;
+static uint64_t *hit_bitmap;
+
+static uint64_t random64(void)
+{
+	uint64_t r;
+	do {
+		r = ((uint64_t)randomMT() << 32) | (uint64_t)randomMT();
+	} while (!r);
+	return r;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void generate_hashes(unsigned int hash_type)
+{
+	unsigned int i;
+
+	if (hash_type == 64) {
+		loaded_hashes_64 = (uint64_t *) malloc(num_loaded_hashes * sizeof(uint64_t));
+		for (i = 0; i < num_loaded_hashes; i++)
+			loaded_hashes_64[i] = random64();
+	}
+	else if (hash_type == 128) {
+		loaded_hashes_128 = (uint128_t *) malloc(num_loaded_hashes * sizeof(uint128_t));
+		for (i = 0; i < num_loaded_hashes; i++) {
+			loaded_hashes_128[i].LO64 = random64();
+			loaded_hashes_128[i].HI64 = random64();
+		}
+	}
+	else {
+		loaded_hashes_192 = (uint192_t *) malloc(num_loaded_hashes * sizeof(uint192_t));
+		for (i = 0; i < num_loaded_hashes; i++) {
+			loaded_hashes_192[i].LO = random64();
+			loaded_hashes_192[i].MI = random64();
+			loaded_hashes_192[i].HI = random64() & 0xffffffff;
+		}
+	}
+}
+
+/* Hits are drawn from the loaded hashes, misses are fresh random hashes. */
+static void generate_queries(unsigned int hash_type, unsigned int hit_percent)
+{
+	unsigned int i;
+
+	for (i = 0; i < NUM_QUERIES; i++) {
+		int hit = randomMT() % 100 < hit_percent;
+		unsigned int k = randomMT() % num_loaded_hashes;
+
+		if (hash_type == 64)
+			query_64[i] = hit ? loaded_hashes_64[k] : random64();
+		else if (hash_type == 128) {
+			if (hit)
+				query_128[i] = loaded_hashes_128[k];
+			else {
+				query_128[i].LO64 = random64();
+				query_128[i].HI64 = random64();
+			}
+		}
+		else {
+			if (hit)
+				query_192[i] = loaded_hashes_192[k];
+			else {
+				query_192[i].LO = random64();
+				query_192[i].MI = random64();
+				query_192[i].HI = random64() & 0xffffffff;
+			}
+		}
+	}
+}
+
+static double time_batch(const bt_table *table, unsigned int *hits)
+{
+	double start = now_ns();
+
+	if (table -> hash_type == 64)
+		*hits = bt_lookup_batch_64(table, query_64, NUM_QUERIES, hit_bitmap);
+	else if (table -> hash_type == 128)
+		*hits = bt_lookup_batch_128(table, query_128, NUM_QUERIES, hit_bitmap);
+	else
+		*hits = bt_lookup_batch_192(table, query_192, NUM_QUERIES, hit_bitmap);
+
+	return (now_ns() - start) / NUM_QUERIES;
+}
+
+static void count_hit(void *user_data, unsigned int result)
+{
+	if (result != BT_NOT_FOUND)
+		(*(unsigned int *)user_data)++;
+}
+
+static double time_single(const bt_table *table, unsigned int *hits)
+{
+	double start = now_ns();
+	unsigned int i;
+
+	*hits = 0;
+	for (i = 0; i < NUM_QUERIES; i++) {
+		unsigned int result;
+		if (table -> hash_type == 64)
+			result = bt_lookup_64(table, query_64[i]);
+		else if (table -> hash_type == 128)
+			result = bt_lookup_128(table, query_128[i]);
+		else
+			result = bt_lookup_192(table, query_192[i]);
+		*hits += (result != BT_NOT_FOUND);
+	}
+
+	return (now_ns() - start) / NUM_QUERIES;
+}
+
+static double time_sched(const bt_table *table, unsigned int num_slots, unsigned int *hits)
+{
+	bt_lookup_sched sched;
+	double start;
+	unsigned int i;
+
+	*hits = 0;
+	bt_sched_init(&sched, table, num_slots);
+	start = now_ns();
+	for (i = 0; i < NUM_QUERIES; i++) {
+		if (table -> hash_type == 64)
+			bt_sched_submit_64(&sched, query_64[i], count_hit, hits);
+		else if (table -> hash_type == 128)
+			bt_sched_submit_128(&sched, query_128[i], count_hit, hits);
+		else
+			bt_sched_submit_192(&sched, query_192[i], count_hit, hits);
+	}
+	bt_sched_drain(&sched);
+	start = (now_ns() - start) / NUM_QUERIES;
+	bt_sched_free(&sched);
+
+	return start;
+}
+
+#define NUM_PROBE_TABLES 20
+#define NUM_PROBE_QUERIES (1 << 18)
+
+/*
+ * Splits the loaded hashes across NUM_PROBE_TABLES tables and compares probing
+ * every table in turn against bt_probe_tables_*(), using the current queries.
+ */
+static void bench_multi_table(unsigned int hash_type)
+{
+	bt_table tables[NUM_PROBE_TABLES];
+	const bt_table *table_ptrs[NUM_PROBE_TABLES];
+	unsigned int binary_size = hash_type / 8, slice = num_loaded_hashes / NUM_PROBE_TABLES;
+	unsigned int i, j, hits_seq = 0, hits_multi = 0, hits_batch = 0;
+	uint64_t *masks;
+	double start, t_seq, t_multi, t_batch;
+	char *src = hash_type == 64 ? (char *)loaded_hashes_64 :
+		    hash_type == 128 ? (char *)loaded_hashes_128 : (char *)loaded_hashes_192;
+
+	if (!slice) {
+		fprintf(stdout, "\nToo few hashes for the multi-table probe.\n");
+		return;
+	}
+
+	for (j = 0; j < NUM_PROBE_TABLES; j++) {
+		OFFSET_TABLE_WORD *offset_table;
+		unsigned int offset_table_size, hash_table_size, num;
+		void *slice_hashes = malloc((size_t)slice * binary_size);
+
+		memcpy(slice_hashes, src + (size_t)j * slice * binary_size, (size_t)slice * binary_size);
+		num = create_perfect_hash_table(hash_type, slice_hashes, slice, &offset_table,
+						&offset_table_size, &hash_table_size, 0);
+		if (!num) {
+			fprintf(stderr, "Failed to build tables.\n");
+			exit(0);
+		}
+		bt_table_init(&tables[j], hash_type,
+			      hash_type == 64 ? hash_table_64 : hash_type == 128 ? hash_table_128 : hash_table_192,
+			      offset_table, offset_table_size, hash_table_size);
+		table_ptrs[j] = &tables[j];
+		free(slice_hashes);
+	}
+
+	masks = (uint64_t *) malloc(NUM_PROBE_QUERIES * sizeof(uint64_t));
+
+	start = now_ns();
+	for (i = 0; i < NUM_PROBE_QUERIES; i++)
+		for (j = 0; j < NUM_PROBE_TABLES; j++) {
+			if (hash_type == 64)
+				hits_seq += bt_lookup_64(&tables[j], query_64[i]) != BT_NOT_FOUND;
+			else if (hash_type == 128)
+				hits_seq += bt_lookup_128(&tables[j], query_128[i]) != BT_NOT_FOUND;
+			else
+				hits_seq += bt_lookup_192(&tables[j], query_192[i]) != BT_NOT_FOUND;
+		}
+	t_seq = (now_ns() - start) / NUM_PROBE_QUERIES;
+
+	start = now_ns();
+	for (i = 0; i < NUM_PROBE_QUERIES; i++) {
+		uint64_t mask;
+		if (hash_type == 64)
+			mask = bt_probe_tables_64(table_ptrs, NUM_PROBE_TABLES, query_64[i]);
+		else if (hash_type == 128)
+			mask = bt_probe_tables_128(table_ptrs, NUM_PROBE_TABLES, query_128[i]);
+		else
+			mask = bt_probe_tables_192(table_ptrs, NUM_PROBE_TABLES, query_192[i]);
+		hits_multi += __builtin_popcountll(mask);
+	}
+	t_multi = (now_ns() - start) / NUM_PROBE_QUERIES;
+
+	start = now_ns();
+	if (hash_type == 64)
+		bt_probe_tables_batch_64(table_ptrs, NUM_PROBE_TABLES, query_64, NUM_PROBE_QUERIES, masks);
+	else if (hash_type == 128)
+		bt_probe_tables_batch_128(table_ptrs, NUM_PROBE_TABLES, query_128, NUM_PROBE_QUERIES, masks);
+	else
+		bt_probe_tables_batch_192(table_ptrs, NUM_PROBE_TABLES, query_192, NUM_PROBE_QUERIES, masks);
+	t_batch = (now_ns() - start) / NUM_PROBE_QUERIES;
+	for (i = 0; i < NUM_PROBE_QUERIES; i++)
+		hits_batch += __builtin_popcountll(masks[i]);
+
+	if (hits_seq != hits_multi || hits_seq != hits_batch)
+		fprintf(stderr, "Hit count mismatch: %u vs %u vs %u.\n", hits_seq, hits_multi, hits_batch);
+
+	fprintf(stdout, "\nProbing %d tables of %u hashes, ns per query\n", NUM_PROBE_TABLES, slice);
+	fprintf(stdout, "%16s %16.2f\n", "sequential", t_seq);
+	fprintf(stdout, "%16s %16.2f\n", "multi-table", t_multi);
+	fprintf(stdout, "%16s %16.2f\n", "multi batch", t_batch);
+
+	for (j = 0; j < NUM_PROBE_TABLES; j++) {
+		free(tables[j].hash_table);
+		free(tables[j].offset_table);
+	}
+	free(masks);
+}
+
+/*
+ * Runs bt_probe_array_*() with match output for growing thread counts and
+ * reports the thread count beyond which adding threads gains less than 10%,
+ * i.e. where memory bandwidth (or the core count) is saturated.
+ */
+static void bench_probe_array(const bt_table *table)
+{
+	unsigned int *matches = (unsigned int *) malloc(NUM_QUERIES * sizeof(unsigned int));
+	unsigned int threads = 1, prev_threads = 1, max_threads = 1, saturated = 0, hits;
+	double prev_rate = 0;
+
+#if _OPENMP
+	max_threads = omp_get_max_threads();
+#endif
+	fprintf(stdout, "\nBulk probe, 50%% hits\n");
+	fprintf(stdout, "%8s %16s %16s\n", "threads", "Mprobes/s", "input GB/s");
+
+	while (1) {
+		double start, secs, rate;
+#if _OPENMP
+		omp_set_num_threads(threads);
+#endif
+		start = now_ns();
+		if (table -> hash_type == 64)
+			hits = bt_probe_array_64(table, query_64, NUM_QUERIES, NULL, matches);
+		else if (table -> hash_type == 128)
+			hits = bt_probe_array_128(table, query_128, NUM_QUERIES, NULL, matches);
+		else
+			hits = bt_probe_array_192(table, query_192, NUM_QUERIES, NULL, matches);
+		secs = (now_ns() - start) / 1e9;
+		rate = NUM_QUERIES / secs;
+
+		fprintf(stdout, "%8u %16.2f %16.2f\n", threads, rate / 1e6,
+			(double)NUM_QUERIES * (table -> hash_type / 8) / secs / 1e9);
+		if (!saturated && threads > 1 && rate < prev_rate * 1.1)
+			saturated = prev_threads;
+		prev_rate = rate;
+		prev_threads = threads;
+
+		if (threads == max_threads)
+			break;
+		threads = threads * 2 < max_threads ? threads * 2 : max_threads;
+	}
+#if _OPENMP
+	omp_set_num_threads(max_threads);
+#endif
+
+	if (saturated)
+		fprintf(stdout, "Throughput stops scaling beyond %u threads (%u hits).\n", saturated, hits);
+	else
+		fprintf(stdout, "Throughput still scaling at %u threads (%u hits).\n", max_threads, hits);
+
+	free(matches);
+}
+
+int main(int argc, char *argv[])
+{
+	OFFSET_TABLE_WORD *offset_table = NULL;
+	unsigned int offset_table_size, hash_table_size, hash_type, bits_per_key, hit_percent;
+	int payoff = -1;
+	unsigned int *hash_table;
+	bt_bloom_filter *bloom_filter = NULL;
+	bt_build_options opts = {0};
+	bt_table plain, filtered;
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s num_hashes hash_type [bloom_bits_per_key]\n", argv[0]);
+		return 0;
+	}
+
+	num_loaded_hashes = (unsigned int) strtol(argv[1], NULL, 10);
+	hash_type = (unsigned int) strtol(argv[2], NULL, 10);
+	bits_per_key = argc > 3 ? (unsigned int) strtol(argv[3], NULL, 10) : 10;
+
+	if ((hash_type != 64 && hash_type != 128 && hash_type != 192) || !num_loaded_hashes) {
+		fprintf(stderr, "Unsupported hash type or number of hashes.\n");
+		return 0;
+	}
+
+	seedMT(1);
+	generate_hashes(hash_type);
+
+	opts.bloom_bits_per_key = bits_per_key;
+	opts.bloom_filter_ptr = &bloom_filter;
+
+	num_loaded_hashes = create_perfect_hash_table_opt(hash_type,
+			hash_type == 64 ? (void *)loaded_hashes_64 :
+			hash_type == 128 ? (void *)loaded_hashes_128 : (void *)loaded_hashes_192,
+			num_loaded_hashes, &offset_table, &offset_table_size,
+			&hash_table_size, &opts, 1);
+	if (!num_loaded_hashes) {
+		fprintf(stderr, "Failed to build tables.\n");
+		return 0;
+	}
+
+	hash_table = hash_type == 64 ? hash_table_64 : hash_type == 128 ? hash_table_128 : hash_table_192;
+	bt_table_init(&plain, hash_type, hash_table, offset_table, offset_table_size, hash_table_size);
+	filtered = plain;
+	filtered.bloom_filter = bloom_filter;
+
+	query_64 = (uint64_t *) malloc(NUM_QUERIES * sizeof(uint64_t));
+	query_128 = (uint128_t *) malloc(NUM_QUERIES * sizeof(uint128_t));
+	query_192 = (uint192_t *) malloc(NUM_QUERIES * sizeof(uint192_t));
+	hit_bitmap = (uint64_t *) malloc((NUM_QUERIES / 64) * sizeof(uint64_t));
+
+	fprintf(stdout, "\nBloom filter: %u bits/key, %u blocks\n", bits_per_key, bloom_filter -> num_blocks);
+	fprintf(stdout, "%8s %16s %16s\n", "hit %", "plain ns/op", "bloom ns/op");
+
+	for (hit_percent = 0; hit_percent <= 100; hit_percent += 10) {
+		double t_plain, t_filtered;
+		unsigned int hits_plain, hits_filtered;
+
+		generate_queries(hash_type, hit_percent);
+		t_plain = time_batch(&plain, &hits_plain);
+		t_filtered = time_batch(&filtered, &hits_filtered);
+
+		if (hits_plain != hits_filtered)
+			fprintf(stderr, "Hit count mismatch: %u vs %u.\n", hits_plain, hits_filtered);
+
+		fprintf(stdout, "%8u %16.2f %16.2f\n", hit_percent, t_plain, t_filtered);
+		if (t_filtered < t_plain)
+			payoff = hit_percent;
+	}
+
+	if (payoff >= 0)
+		fprintf(stdout, "Bloom filter pays off up to %d%% hits.\n", payoff);
+	else
+		fprintf(stdout, "Bloom filter does not pay off at this table size.\n");
+
+	{
+		unsigned int num_slots, hits_single, hits;
+		double t_single, t_batch;
+
+		generate_queries(hash_type, 50);
+		t_single = time_single(&plain, &hits_single);
+		t_batch = time_batch(&plain, &hits);
+
+		fprintf(stdout, "\nInterleaved lookups, 50%% hits\n");
+		fprintf(stdout, "%16s %16.2f ns/op\n", "single", t_single);
+		fprintf(stdout, "%16s %16.2f ns/op\n", "batch", t_batch);
+		for (num_slots = 4; num_slots <= 32; num_slots *= 2) {
+			char label[32];
+			double t_sched = time_sched(&plain, num_slots, &hits);
+
+			if (hits != hits_single)
+				fprintf(stderr, "Hit count mismatch: %u vs %u.\n", hits_single, hits);
+			snprintf(label, sizeof(label), "sched(%u)", num_slots);
+			fprintf(stdout, "%16s %16.2f ns/op\n", label, t_sched);
+		}
+	}
+
+	generate_queries(hash_type, 50);
+	bench_probe_array(&plain);
+	bench_multi_table(hash_type);
+
+	if (hash_type == 64) {
+		fprintf(stdout, "\nSIMD kernel: %s\n", bt_lookup_simd_kernel());
+		fprintf(stdout, "%8s %16s %16s\n", "hit %", "batch ns/op", "simd ns/op");
+
+		for (hit_percent = 0; hit_percent <= 100; hit_percent += 50) {
+			double t_batch, t_simd, start;
+			unsigned int hits_batch, hits_simd;
+
+			generate_queries(hash_type, hit_percent);
+			t_batch = time_batch(&plain, &hits_batch);
+
+			start = now_ns();
+			hits_simd = bt_lookup_simd_64(&plain, query_64, NUM_QUERIES, hit_bitmap);
+			t_simd = (now_ns() - start) / NUM_QUERIES;
+
+			if (hits_batch != hits_simd)
+				fprintf(stderr, "Hit count mismatch: %u vs %u.\n", hits_batch, hits_simd);
+
+			fprintf(stdout, "%8u %16.2f %16.2f\n", hit_percent, t_batch, t_simd);
+		}
+	}
+
+	bt_bloom_free(&bloom_filter);
+	free(hash_table);
+	free(offset_table);
+	free(loaded_hashes_64);
+	free(loaded_hashes_128);
+	free(loaded_hashes_192);
+	free(query_64);
+	free(query_128);
+	free(query_192);
+	free(hit_bitmap);
+
+	return 0;
+}
@@ -0,0 +1,342 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+/*
+ * Build scalability benchmark. For every combination of key count, hash type
+ * and thread count it builds the tables from a synthetic key set and writes
+ * one CSV line with the phase times, the number of attempts and the peak
+ * memory to stdout.
+ *
+ * Every build runs in a child process: the builder keeps its state in
+ * globals, a failed allocation exits, and the peak resident set of a child
+ * is that of its build alone. The parent never enters an
+ * OpenMP region, so the children fork from a single threaded process.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#if _OPENMP
+#include <omp.h>
+#endif
+#include "bt_interface.h"
+
+#define MAX_LIST 16
+
+typedef struct {
+	bt_build_stats stats;
+	unsigned int num_unique;
+	long peak_rss_kb;
+	double perf[BT_PERF_NUM_COUNTERS]; // Per inserted key, negative if unavailable.
+} result;
+
+static uint64_t seed = 1;
+static int use_perf;
+static bt_tune_target tune_target = BT_TUNE_FASTEST;
+static unsigned long long memory_budget;
+static double time_limit;
+
+/* Value number i of the stream selected by seed, as in bench_lookup.c. */
+static uint64_t splitmix64(uint64_t seed, uint64_t i)
+{
+	uint64_t z = seed + (i + 1) * 0x9e3779b97f4a7c15ULL;
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static size_t key_size(int hash_type)
+{
+	return hash_type == 64 ? sizeof(uint64_t) : (hash_type == 128 ? sizeof(uint128_t) : sizeof(uint192_t));
+}
+
+/* Same key set as bench_lookup.out for the same seed. */
+static void generate_keys(int hash_type, void *keys, unsigned int num_keys)
+{
+	long long i;
+
+#if _OPENMP
+#pragma omp parallel for
+#endif
+	for (i = 0; i < num_keys; i++) {
+		void *key = (char *)keys + i * key_size(hash_type);
+		uint64_t w0 = splitmix64(seed, 3 * i), w1 = splitmix64(seed, 3 * i + 1), w2 = splitmix64(seed, 3 * i + 2);
+
+		if (hash_type == 64)
+			*(uint64_t *)key = w0 ? w0 : 1;
+		else if (hash_type == 128) {
+			((uint128_t *)key) -> LO64 = w0;
+			((uint128_t *)key) -> HI64 = w1;
+		}
+		else {
+			((uint192_t *)key) -> LO = w0;
+			((uint192_t *)key) -> MI = w1;
+			((uint192_t *)key) -> HI = w2;
+		}
+	}
+}
+
+/* Child side: builds once and writes a result to fd. */
+static void build_child(int fd, int hash_type, unsigned int num_keys, int threads)
+{
+	OFFSET_TABLE_WORD *offset_table = NULL;
+	unsigned int offset_table_size, hash_table_size;
+	bt_build_options opts = {0};
+	bt_perf_counters perf;
+	struct rusage usage;
+	result r;
+	void *keys;
+	int i;
+
+	// Before the first OpenMP region, so that the counters follow the pool threads.
+	for (i = 0; i < BT_PERF_NUM_COUNTERS; i++)
+		perf.fd[i] = -1;
+	if (use_perf)
+		bt_perf_open(&perf);
+#if _OPENMP
+	omp_set_num_threads(threads);
+#endif
+	keys = malloc((size_t)num_keys * key_size(hash_type));
+	if (!keys) {
+		fprintf(stderr, "Failed to allocate memory: keys.\n");
+		_exit(1);
+	}
+	generate_keys(hash_type, keys, num_keys);
+
+	memset(&r, 0, sizeof(r));
+	opts.stats = &r.stats;
+	opts.tune_target = tune_target;
+	opts.memory_budget_in_bytes = memory_budget;
+	opts.deadline = time_limit > 0 ? bt_monotonic_seconds() + time_limit : 0;
+
+	if (use_perf)
+		bt_perf_start(&perf);
+	r.num_unique = create_perfect_hash_table_opt(hash_type, keys, num_keys, &offset_table,
+						     &offset_table_size, &hash_table_size, &opts, 0);
+	if (use_perf)
+		bt_perf_stop(&perf);
+	getrusage(RUSAGE_SELF, &usage);
+	r.peak_rss_kb = usage.ru_maxrss;
+	for (i = 0; i < BT_PERF_NUM_COUNTERS; i++)
+		r.perf[i] = perf.fd[i] < 0 ? -1 : (double)perf.value[i] / num_keys;
+
+	if (write(fd, &r, sizeof(r)) != sizeof(r))
+		_exit(1);
+	_exit(0);
+}
+
+/* Returns 0 with *r filled in if the child reported a result. */
+static int run_build(int hash_type, unsigned int num_keys, int threads, result *r)
+{
+	int fds[2], status;
+	ssize_t n = 0, got;
+	pid_t pid;
+
+	if (pipe(fds)) {
+		perror("pipe");
+		return 1;
+	}
+	fflush(NULL);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		close(fds[0]);
+		close(fds[1]);
+		return 1;
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		build_child(fds[1], hash_type, num_keys, threads);
+	}
+
+	close(fds[1]);
+	while (n < (ssize_t)sizeof(*r) && (got = read(fds[0], (char *)r + n, sizeof(*r) - n)) > 0)
+		n += got;
+	close(fds[0]);
+	waitpid(pid, &status, 0);
+
+	if (WIFSIGNALED(status))
+		fprintf(stderr, "Build of %u %d bit keys with %d threads killed by signal %d.\n",
+			num_keys, hash_type, threads, WTERMSIG(status));
+	return n != sizeof(*r);
+}
+
+/*
+ * One CSV line, r is NULL for a failed child. sizes_tried lists the Offset
+ * and Hash Table sizes of each attempt as ot:ht separated by ';' and
+ * bucket_histogram the number of Offset Table slots holding 0, 1, 2, ...
+ * hashes.
+ */
+static void print_result(FILE *out_fp, unsigned int num_keys, int hash_type, int threads, const result *r)
+{
+	const bt_build_stats *st = r ? &r -> stats : NULL;
+	unsigned int i, n;
+
+	if (!r) {
+		fprintf(out_fp, "%u,%d,%d,0,,,,,,,,,,,,0,,,,,,,,,,,,", num_keys, hash_type, threads);
+		for (i = 0; use_perf && i < BT_PERF_NUM_COUNTERS; i++)
+			fprintf(out_fp, ",");
+		fprintf(out_fp, "\n");
+		fflush(out_fp);
+		return;
+	}
+
+	fprintf(out_fp, "%u,%d,%d,%u,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%u,%u,%.1f,%.1f,%d,%u,%llu,%u,%.4f,%.4f,"
+		"%.4f,%.4f,%.0f,%.4f,%.1f,",
+		num_keys, hash_type, threads, r -> num_unique, st -> total_time, st -> dedupe_time,
+		st -> init_time, st -> sort_time, st -> placement_time, st -> singleton_time,
+		st -> test_time, st -> attempts, st -> attempts ? st -> attempts - 1 : 0,
+		st -> peak_memory_in_bytes / 1048576.0, r -> peak_rss_kb / 1024.0, r -> num_unique != 0,
+		st -> max_collisions, st -> heavy_offsets_tried, st -> max_offsets_tried,
+		st -> hash_table_load, st -> offset_table_load, st -> tuning.multiplier_ot, st -> tuning.multiplier_ht,
+		st -> tuning.offsets_tried, st -> tuning.seconds, st -> tuning.table_bytes / 1048576.0);
+
+	n = st -> attempts < BT_BUILD_MAX_ATTEMPTS ? st -> attempts : BT_BUILD_MAX_ATTEMPTS;
+	for (i = 0; i < n; i++)
+		fprintf(out_fp, "%s%u:%u", i ? ";" : "", st -> offset_table_sizes[i], st -> hash_table_sizes[i]);
+	fprintf(out_fp, ",");
+
+	for (n = BT_BUILD_HISTOGRAM_SIZE; n > 1 && !st -> bucket_histogram[n - 1]; n--)
+		;
+	for (i = 0; i < n; i++)
+		fprintf(out_fp, "%s%u", i ? ";" : "", st -> bucket_histogram[i]);
+
+	for (i = 0; use_perf && i < BT_PERF_NUM_COUNTERS; i++) {
+		if (r -> perf[i] < 0)
+			fprintf(out_fp, ",");
+		else
+			fprintf(out_fp, ",%.2f", r -> perf[i]);
+	}
+	fprintf(out_fp, "\n");
+	fflush(out_fp);
+}
+
+/* Parses a comma separated list of numbers, 1e6 style allowed. */
+static int parse_list(const char *arg, double *values)
+{
+	int n = 0;
+	char *end;
+
+	while (*arg && n < MAX_LIST) {
+		values[n++] = strtod(arg, &end);
+		if (*end != ',' && *end)
+			return -1;
+		arg = *end ? end + 1 : end;
+	}
+	return n;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: bench_build.out [-n key_counts] [-w hash_types] [-t thread_counts] [-S seed] [-p]\n"
+			"                       [-T fastest|smallest] [-M budget_mb] [-D seconds] [-o output_file]\n"
+			"Lists are comma separated, e.g. -n 1e4,1e6,1e8 -w 64,128 -t 1,2,4.\n"
+			"Thread counts default to powers of two up to OMP_NUM_THREADS or the number of cores.\n"
+			"-p adds hardware counters per inserted key, where perf_event_open permits.\n"
+			"-T and -M set the table size target and the budget for Offset and Hash Table.\n"
+			"-D stops a build after the given time, the build is then reported with ok 0.\n"
+			"Results go to output_file (default stdout) as CSV.\n");
+	exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	double sizes[MAX_LIST] = {1e4, 1e5, 1e6, 1e7}, widths[MAX_LIST] = {64, 128, 192}, thread_list[MAX_LIST];
+	int num_sizes = 4, num_widths = 3, num_threads = 0, max_threads = 1;
+	const char *out_file = NULL;
+	FILE *out_fp;
+	int opt, i, j, k;
+
+	while ((opt = getopt(argc, argv, "n:w:t:S:pT:M:D:o:")) != -1) {
+		switch (opt) {
+		case 'n': num_sizes = parse_list(optarg, sizes); break;
+		case 'w': num_widths = parse_list(optarg, widths); break;
+		case 't': num_threads = parse_list(optarg, thread_list); break;
+		case 'S': seed = strtoull(optarg, NULL, 10); break;
+		case 'p': use_perf = 1; break;
+		case 'T':
+			if (!strcmp(optarg, "fastest"))
+				tune_target = BT_TUNE_FASTEST;
+			else if (!strcmp(optarg, "smallest"))
+				tune_target = BT_TUNE_SMALLEST;
+			else
+				usage();
+			break;
+		case 'M': memory_budget = (unsigned long long)(strtod(optarg, NULL) * 1048576); break;
+		case 'D': time_limit = strtod(optarg, NULL); break;
+		case 'o': out_file = optarg; break;
+		default: usage();
+		}
+	}
+	if (num_sizes <= 0 || num_widths <= 0 || num_threads < 0)
+		usage();
+	if (!num_threads) {
+#if _OPENMP
+		max_threads = omp_get_max_threads();
+#endif
+		for (i = 1; i < max_threads && num_threads < MAX_LIST - 1; i *= 2)
+			thread_list[num_threads++] = i;
+		thread_list[num_threads++] = max_threads;
+	}
+
+	if (use_perf) {
+		bt_perf_counters perf;
+
+		if (bt_perf_open(&perf) < BT_PERF_NUM_COUNTERS)
+			for (i = 0; i < BT_PERF_NUM_COUNTERS; i++)
+				if (perf.fd[i] < 0)
+					fprintf(stderr, "Counter %s unavailable, reported empty.\n", bt_perf_names[i]);
+		bt_perf_close(&perf);
+	}
+
+	out_fp = out_file ? fopen(out_file, "w") : stdout;
+	if (out_fp == NULL) {
+		fprintf(stderr, "Error opening output file.\n");
+		return 0;
+	}
+	fprintf(out_fp, "keys,hash_type,threads,unique_keys,total_s,dedupe_s,init_s,sort_s,placement_s,singleton_s,"
+			"test_s,attempts,retries,peak_table_mb,peak_rss_mb,ok,max_collisions,heavy_offsets_tried,"
+			"max_offsets_tried,hash_table_load,offset_table_load,tuned_multiplier_ot,tuned_multiplier_ht,"
+			"predicted_offsets_tried,predicted_s,predicted_table_mb,sizes_tried,bucket_histogram");
+	for (i = 0; use_perf && i < BT_PERF_NUM_COUNTERS; i++)
+		fprintf(out_fp, ",%s_per_key", bt_perf_names[i]);
+	fprintf(out_fp, "\n");
+
+	for (i = 0; i < num_widths; i++) {
+		int hash_type = (int)widths[i];
+		if (hash_type != 64 && hash_type != 128 && hash_type != 192) {
+			fprintf(stderr, "Unsupported hash type %d.\n", hash_type);
+			continue;
+		}
+		for (j = 0; j < num_sizes; j++) {
+			if (sizes[j] < 1 || sizes[j] > 0xffffffff) {
+				fprintf(stderr, "Unsupported number of keys %.0f.\n", sizes[j]);
+				continue;
+			}
+			for (k = 0; k < num_threads; k++) {
+				unsigned int num_keys = (unsigned int)sizes[j];
+				int threads = (int)thread_list[k];
+				result r;
+
+				if (threads < 1) {
+					fprintf(stderr, "Unsupported number of threads %d.\n", threads);
+					continue;
+				}
+				print_result(out_fp, num_keys, hash_type, threads,
+					     run_build(hash_type, num_keys, threads, &r) ? NULL : &r);
+			}
+		}
+	}
+
+	if (out_fp != stdout)
+		fclose(out_fp);
+
+	return 0;
+}
@@ -0,0 +1,572 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+/*
+ * Lookup benchmark suite. For every combination of key count, hash type,
+ * query distribution and hit rate it builds the tables from a synthetic key
+ * set and times single, batched and multithreaded lookups, writing one CSV
+ * line or JSON object per measurement to stdout.
+ *
+ * Keys and queries are derived from their index with splitmix64, so a given
+ * seed produces the same sets whatever the number of threads, and runs of
+ * different versions can be compared line by line.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#if _OPENMP
+#include <omp.h>
+#endif
+#include "bt_interface.h"
+
+#define MAX_LIST 16
+
+typedef struct {
+	unsigned int num_keys;
+	int hash_type;
+	const char *distribution;
+	unsigned int hit_percent;
+	const char *method;
+	int threads;
+	unsigned int num_queries;
+	double ns_per_op;
+	unsigned int hits;
+	unsigned int expected_hits;
+	double perf[BT_PERF_NUM_COUNTERS]; // Per lookup, negative if unavailable.
+	double telemetry_overhead; // Percent, with -T.
+} result;
+
+static uint64_t seed = 1;
+static unsigned int num_queries = 1 << 22;
+static unsigned int repetitions = 3;
+static double zipf_exponent = 0.99;
+static unsigned int bloom_bits;
+static int json, num_results, use_perf, use_telemetry;
+static unsigned int telemetry_period = 1024;
+static bt_perf_counters perf;
+static FILE *out_fp;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* Value number i of the stream selected by seed. */
+static uint64_t splitmix64(uint64_t seed, uint64_t i)
+{
+	uint64_t z = seed + (i + 1) * 0x9e3779b97f4a7c15ULL;
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static size_t key_size(int hash_type)
+{
+	return hash_type == 64 ? sizeof(uint64_t) : (hash_type == 128 ? sizeof(uint128_t) : sizeof(uint192_t));
+}
+
+/* Key number i; keys past the key set serve as misses. */
+static void make_key(int hash_type, uint64_t i, void *key)
+{
+	uint64_t w0 = splitmix64(seed, 3 * i), w1 = splitmix64(seed, 3 * i + 1), w2 = splitmix64(seed, 3 * i + 2);
+
+	if (hash_type == 64)
+		*(uint64_t *)key = w0 ? w0 : 1;
+	else if (hash_type == 128) {
+		((uint128_t *)key) -> LO64 = w0;
+		((uint128_t *)key) -> HI64 = w1;
+	}
+	else {
+		((uint192_t *)key) -> LO = w0;
+		((uint192_t *)key) -> MI = w1;
+		((uint192_t *)key) -> HI = w2;
+	}
+}
+
+/*
+ * Zipf distributed ranks in [1, n] by rejection-inversion (Hoermann and
+ * Derflinger), constant time per sample with no table of n entries.
+ */
+typedef struct {
+	double s, h_x1, h_n, sd;
+	uint64_t n;
+} zipf_sampler;
+
+static double helper1(double x)
+{
+	return fabs(x) > 1e-8 ? log1p(x) / x : 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+}
+
+static double helper2(double x)
+{
+	return fabs(x) > 1e-8 ? expm1(x) / x : 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
+}
+
+static double zipf_h(const zipf_sampler *z, double x)
+{
+	return exp(-z -> s * log(x));
+}
+
+static double zipf_h_integral(const zipf_sampler *z, double x)
+{
+	double log_x = log(x);
+	return helper2((1 - z -> s) * log_x) * log_x;
+}
+
+static double zipf_h_integral_inverse(const zipf_sampler *z, double x)
+{
+	double t = x * (1 - z -> s);
+	if (t < -1)
+		t = -1;
+	return exp(helper1(t) * x);
+}
+
+static void zipf_init(zipf_sampler *z, uint64_t n, double s)
+{
+	z -> n = n;
+	z -> s = s;
+	z -> h_x1 = zipf_h_integral(z, 1.5) - 1;
+	z -> h_n = zipf_h_integral(z, n + 0.5);
+	z -> sd = 2 - zipf_h_integral_inverse(z, zipf_h_integral(z, 2.5) - zipf_h(z, 2));
+}
+
+static uint64_t zipf_sample(const zipf_sampler *z, uint64_t *state)
+{
+	while (1) {
+		double u01 = (splitmix64(*state, 0) >> 11) * (1.0 / 9007199254740992.0);
+		double u = z -> h_n + u01 * (z -> h_x1 - z -> h_n);
+		double x = zipf_h_integral_inverse(z, u);
+		uint64_t k = (uint64_t)(x + 0.5);
+
+		(*state)++;
+		if (k < 1)
+			k = 1;
+		else if (k > z -> n)
+			k = z -> n;
+		if (k - x <= z -> sd || u >= zipf_h_integral(z, k + 0.5) - zipf_h(z, k))
+			return k;
+	}
+}
+
+static void generate_keys(int hash_type, void *keys, unsigned int num_keys)
+{
+	long long i;
+
+#if _OPENMP
+#pragma omp parallel for
+#endif
+	for (i = 0; i < num_keys; i++)
+		make_key(hash_type, i, (char *)keys + i * key_size(hash_type));
+}
+
+/*
+ * Query i is a hit with probability hit_percent, drawn uniformly or by Zipf
+ * rank from the key set, and otherwise a key from past the key set. Returns
+ * the number of hits.
+ */
+static unsigned int generate_queries(int hash_type, const void *keys, unsigned int num_keys, void *queries,
+				     unsigned int hit_percent, int zipf)
+{
+	zipf_sampler z;
+	unsigned int hits = 0;
+	long long i;
+
+	zipf_init(&z, num_keys, zipf_exponent);
+
+#if _OPENMP
+#pragma omp parallel for reduction(+:hits)
+#endif
+	for (i = 0; i < num_queries; i++) {
+		uint64_t state = splitmix64(seed ^ 0x5157, i), k;
+		size_t sz = key_size(hash_type);
+
+		if (splitmix64(state, 0) % 100 < hit_percent) {
+			state++;
+			k = zipf ? zipf_sample(&z, &state) - 1 : splitmix64(state, 1) % num_keys;
+			memcpy((char *)queries + i * sz, (const char *)keys + k * sz, sz);
+			hits++;
+		}
+		else
+			make_key(hash_type, (uint64_t)num_keys + i, (char *)queries + i * sz);
+	}
+
+	return hits;
+}
+
+static unsigned int lookup_single(const bt_table *table, const void *queries, unsigned int first, unsigned int last)
+{
+	unsigned int i, hits = 0;
+
+	for (i = first; i < last; i++) {
+		unsigned int r;
+		if (table -> hash_type == 64)
+			r = bt_lookup_64(table, ((const uint64_t *)queries)[i]);
+		else if (table -> hash_type == 128)
+			r = bt_lookup_128(table, ((const uint128_t *)queries)[i]);
+		else
+			r = bt_lookup_192(table, ((const uint192_t *)queries)[i]);
+		hits += r != BT_NOT_FOUND;
+	}
+	return hits;
+}
+
+enum { SINGLE, BATCH, SIMD, MT_SINGLE, MT_BATCH, NUM_METHODS };
+static const char *method_names[NUM_METHODS] = { "single", "batch", "simd", "mt_single", "mt_batch" };
+
+static unsigned int run_method(int method, const bt_table *table, const void *queries, uint64_t *bitmap)
+{
+	unsigned int hits = 0;
+
+	switch (method) {
+	case SINGLE:
+		return lookup_single(table, queries, 0, num_queries);
+	case BATCH:
+		if (table -> hash_type == 64)
+			return bt_lookup_batch_64(table, queries, num_queries, bitmap);
+		else if (table -> hash_type == 128)
+			return bt_lookup_batch_128(table, queries, num_queries, bitmap);
+		return bt_lookup_batch_192(table, queries, num_queries, bitmap);
+	case SIMD:
+		return bt_lookup_simd_64(table, queries, num_queries, bitmap);
+	case MT_SINGLE:
+#if _OPENMP
+#pragma omp parallel reduction(+:hits)
+#endif
+		{
+			unsigned int tid = 0, nt = 1;
+#if _OPENMP
+			tid = omp_get_thread_num();
+			nt = omp_get_num_threads();
+#endif
+			hits = lookup_single(table, queries, (uint64_t)num_queries * tid / nt,
+					     (uint64_t)num_queries * (tid + 1) / nt);
+		}
+		return hits;
+	default:
+		if (table -> hash_type == 64)
+			return bt_probe_array_64(table, queries, num_queries, bitmap, NULL);
+		else if (table -> hash_type == 128)
+			return bt_probe_array_128(table, queries, num_queries, bitmap, NULL);
+		return bt_probe_array_192(table, queries, num_queries, bitmap, NULL);
+	}
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static void print_result(const result *r)
+{
+	double mops = 1e3 / r -> ns_per_op;
+	int i;
+
+	if (json)
+		fprintf(out_fp, "%s\n  {\"keys\": %u, \"hash_type\": %d, \"distribution\": \"%s\", \"hit_percent\": %u, "
+			"\"method\": \"%s\", \"threads\": %d, \"queries\": %u, \"ns_per_op\": %.3f, \"mops\": %.3f, "
+			"\"hits\": %u, \"expected_hits\": %u", num_results ? "," : "",
+			r -> num_keys, r -> hash_type, r -> distribution, r -> hit_percent, r -> method, r -> threads,
+			r -> num_queries, r -> ns_per_op, mops, r -> hits, r -> expected_hits);
+	else
+		fprintf(out_fp, "%u,%d,%s,%u,%s,%d,%u,%.3f,%.3f,%u,%u",
+			r -> num_keys, r -> hash_type, r -> distribution, r -> hit_percent, r -> method, r -> threads,
+			r -> num_queries, r -> ns_per_op, mops, r -> hits, r -> expected_hits);
+
+	for (i = 0; use_perf && i < BT_PERF_NUM_COUNTERS; i++) {
+		if (json && r -> perf[i] < 0)
+			fprintf(out_fp, ", \"%s_per_op\": null", bt_perf_names[i]);
+		else if (json)
+			fprintf(out_fp, ", \"%s_per_op\": %.4f", bt_perf_names[i], r -> perf[i]);
+		else if (r -> perf[i] < 0)
+			fprintf(out_fp, ",");
+		else
+			fprintf(out_fp, ",%.4f", r -> perf[i]);
+	}
+	if (use_telemetry)
+		fprintf(out_fp, json ? ", \"telemetry_overhead_pct\": %.2f" : ",%.2f", r -> telemetry_overhead);
+	fprintf(out_fp, json ? "}" : "\n");
+	fflush(out_fp);
+	num_results++;
+}
+
+static void bench_table(const bt_table *table, unsigned int num_keys, const void *keys, const unsigned int *hit_percents,
+			int num_hit_percents, const int *dists, int num_dists)
+{
+	void *queries = malloc((size_t)num_queries * key_size(table -> hash_type));
+	uint64_t *bitmap = (uint64_t *) malloc(((num_queries + 63) / 64) * sizeof(uint64_t));
+	double times[64], times_telemetry[64];
+	int d, h, m, threads = 1;
+	unsigned int rep;
+
+#if _OPENMP
+	threads = omp_get_max_threads();
+#endif
+	if (!queries || !bitmap) {
+		fprintf(stderr, "Failed to allocate memory: queries.\n");
+		exit(0);
+	}
+
+	for (d = 0; d < num_dists; d++)
+	for (h = 0; h < num_hit_percents; h++) {
+		unsigned int expected = generate_queries(table -> hash_type, keys, num_keys, queries, hit_percents[h], dists[d]);
+
+		for (m = 0; m < NUM_METHODS; m++) {
+			double counts[BT_PERF_NUM_COUNTERS] = {0};
+			int c;
+			result r = {0};
+
+			if (m == SIMD && table -> hash_type != 64)
+				continue;
+
+			for (rep = 0; rep < repetitions; rep++) {
+				double start;
+
+				if (use_telemetry)
+					bt_telemetry_configure(0, telemetry_period);
+				if (use_perf)
+					bt_perf_start(&perf);
+				start = now_ns();
+				r.hits = run_method(m, table, queries, bitmap);
+				times[rep] = (now_ns() - start) / num_queries;
+				if (use_perf) {
+					bt_perf_stop(&perf);
+					for (c = 0; c < BT_PERF_NUM_COUNTERS; c++)
+						counts[c] += perf.value[c];
+				}
+
+				// Interleaved with the runs above, so that drift affects both alike.
+				if (use_telemetry) {
+					bt_telemetry_configure(1, telemetry_period);
+					start = now_ns();
+					run_method(m, table, queries, bitmap);
+					times_telemetry[rep] = (now_ns() - start) / num_queries;
+				}
+			}
+			qsort(times, repetitions, sizeof(double), compare_double);
+			r.telemetry_overhead = 0;
+			if (use_telemetry) {
+				qsort(times_telemetry, repetitions, sizeof(double), compare_double);
+				r.telemetry_overhead = (times_telemetry[repetitions / 2] / times[repetitions / 2] - 1) * 100;
+			}
+			for (c = 0; c < BT_PERF_NUM_COUNTERS; c++)
+				r.perf[c] = perf.fd[c] < 0 ? -1 : counts[c] / ((double)repetitions * num_queries);
+
+			r.num_keys = num_keys;
+			r.hash_type = table -> hash_type;
+			r.distribution = dists[d] ? "zipf" : "uniform";
+			r.hit_percent = hit_percents[h];
+			r.method = method_names[m];
+			r.threads = m >= MT_SINGLE ? threads : 1;
+			r.num_queries = num_queries;
+			r.ns_per_op = times[repetitions / 2];
+			r.expected_hits = expected;
+			print_result(&r);
+
+			if (r.hits != expected)
+				fprintf(stderr, "Hit count mismatch for %s: %u vs %u expected.\n", r.method, r.hits, expected);
+			if (r.telemetry_overhead > 2)
+				fprintf(stderr, "Telemetry overhead of %s above 2%%: %.2f%%.\n", r.method, r.telemetry_overhead);
+		}
+	}
+
+	free(queries);
+	free(bitmap);
+}
+
+static void bench_size(int hash_type, unsigned int num_keys, const unsigned int *hit_percents, int num_hit_percents,
+		       const int *dists, int num_dists)
+{
+	OFFSET_TABLE_WORD *offset_table = NULL;
+	unsigned int offset_table_size, hash_table_size, num_unique;
+	bt_bloom_filter *filter = NULL;
+	bt_build_options opts = {0};
+	bt_table table;
+	void *keys;
+	double start;
+
+	keys = malloc((size_t)num_keys * key_size(hash_type));
+	if (!keys) {
+		fprintf(stderr, "Failed to allocate memory: keys.\n");
+		exit(0);
+	}
+	generate_keys(hash_type, keys, num_keys);
+
+	opts.bloom_bits_per_key = bloom_bits;
+	opts.bloom_filter_ptr = &filter;
+	opts.tune_target = BT_TUNE_FASTEST;
+
+	start = now_ns();
+	num_unique = create_perfect_hash_table_opt(hash_type, keys, num_keys, &offset_table,
+						   &offset_table_size, &hash_table_size, &opts, 0);
+	if (!num_unique) {
+		fprintf(stderr, "Failed to build tables for %u %d bit keys.\n", num_keys, hash_type);
+		free(keys);
+		return;
+	}
+	fprintf(stderr, "Built tables for %u %d bit keys in %.2f s.\n", num_unique, hash_type, (now_ns() - start) / 1e9);
+
+	bt_table_init(&table, hash_type, hash_type == 64 ? hash_table_64 : (hash_type == 128 ? hash_table_128 : hash_table_192),
+		      offset_table, offset_table_size, hash_table_size);
+	table.bloom_filter = filter;
+	table.premix = opts.premix;
+
+	bench_table(&table, num_unique, keys, hit_percents, num_hit_percents, dists, num_dists);
+
+	bt_table_free(&table);
+	free(keys);
+}
+
+/* Totals of the runs with telemetry active. */
+static void print_telemetry(void)
+{
+	bt_telemetry t;
+
+	bt_telemetry_snapshot(&t);
+	fprintf(stderr, "Telemetry from %u threads: %" PRIu64 " lookups, %.2f%% hits, %" PRIu64 " batched lookups in %"
+		PRIu64 " calls, %.2f%% hits.\n", t.threads, t.lookups, t.lookups ? 100.0 * t.hits / t.lookups : 0,
+		t.batch_lookups, t.batch_calls, t.batch_lookups ? 100.0 * t.batch_hits / t.batch_lookups : 0);
+	fprintf(stderr, "Single lookup ticks from %" PRIu64 " samples: p50 < %" PRIu64 ", p99 < %" PRIu64 ", p99.9 < %" PRIu64 ".\n",
+		t.samples, bt_telemetry_percentile(t.latency, 50), bt_telemetry_percentile(t.latency, 99),
+		bt_telemetry_percentile(t.latency, 99.9));
+	fprintf(stderr, "Batched ticks per key from %" PRIu64 " samples: p50 < %" PRIu64 ", p99 < %" PRIu64 ".\n",
+		t.batch_samples, bt_telemetry_percentile(t.batch_latency, 50), bt_telemetry_percentile(t.batch_latency, 99));
+}
+
+/* Parses a comma separated list of numbers, 1e6 style allowed. */
+static int parse_list(const char *arg, double *values)
+{
+	int n = 0;
+	char *end;
+
+	while (*arg && n < MAX_LIST) {
+		values[n++] = strtod(arg, &end);
+		if (*end != ',' && *end)
+			return -1;
+		arg = *end ? end + 1 : end;
+	}
+	return n;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: bench_lookup.out [-n key_counts] [-w hash_types] [-H hit_percents] [-d uniform,zipf]\n"
+			"                        [-z zipf_exponent] [-q queries] [-r repetitions] [-b bloom_bits]\n"
+			"                        [-S seed] [-p] [-T sample_period] [-j] [-o output_file]\n"
+			"Lists are comma separated, e.g. -n 1e3,1e6,1e9 -w 64,128 -H 0,50,100.\n"
+			"-p adds hardware counters per lookup, where perf_event_open permits.\n"
+			"-T measures the overhead of lookup telemetry sampling 1 in sample_period (a power of 2) lookups,\n"
+			"   the library must be built with -DBT_TELEMETRY.\n"
+			"Results go to output_file (default stdout) as CSV, or JSON with -j.\n");
+	exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	double sizes[MAX_LIST] = {1e3, 1e6}, widths[MAX_LIST] = {64, 128, 192}, hits[MAX_LIST] = {0, 50, 100};
+	int num_sizes = 2, num_widths = 3, num_hits = 3, dists[2] = {0, 1}, num_dists = 2;
+	unsigned int hit_percents[MAX_LIST];
+	const char *out_file = NULL;
+	int opt, i, j;
+
+	while ((opt = getopt(argc, argv, "n:w:H:d:z:q:r:b:S:pT:jo:")) != -1) {
+		switch (opt) {
+		case 'n': num_sizes = parse_list(optarg, sizes); break;
+		case 'w': num_widths = parse_list(optarg, widths); break;
+		case 'H': num_hits = parse_list(optarg, hits); break;
+		case 'd':
+			num_dists = 0;
+			if (strstr(optarg, "uniform"))
+				dists[num_dists++] = 0;
+			if (strstr(optarg, "zipf"))
+				dists[num_dists++] = 1;
+			break;
+		case 'z': zipf_exponent = strtod(optarg, NULL); break;
+		case 'q': num_queries = (unsigned int) strtod(optarg, NULL); break;
+		case 'r': repetitions = (unsigned int) strtol(optarg, NULL, 10); break;
+		case 'b': bloom_bits = (unsigned int) strtol(optarg, NULL, 10); break;
+		case 'S': seed = strtoull(optarg, NULL, 10); break;
+		case 'p': use_perf = 1; break;
+		case 'T':
+			use_telemetry = 1;
+			telemetry_period = (unsigned int) strtol(optarg, NULL, 10);
+			break;
+		case 'j': json = 1; break;
+		case 'o': out_file = optarg; break;
+		default: usage();
+		}
+	}
+	if (num_sizes <= 0 || num_widths <= 0 || num_hits <= 0 || !num_dists || !num_queries ||
+	    !repetitions || repetitions > 64 || zipf_exponent <= 0)
+		usage();
+	for (i = 0; i < num_hits; i++) {
+		if (hits[i] < 0 || hits[i] > 100)
+			usage();
+		hit_percents[i] = (unsigned int)hits[i];
+	}
+
+	// Before any OpenMP region, so that the counters follow the pool threads.
+	for (i = 0; i < BT_PERF_NUM_COUNTERS; i++)
+		perf.fd[i] = -1;
+	if (use_perf && bt_perf_open(&perf) < BT_PERF_NUM_COUNTERS)
+		for (i = 0; i < BT_PERF_NUM_COUNTERS; i++)
+			if (perf.fd[i] < 0)
+				fprintf(stderr, "Counter %s unavailable, reported empty.\n", bt_perf_names[i]);
+
+	if (use_telemetry && bt_telemetry_configure(1, telemetry_period)) {
+		fprintf(stderr, "Library built without BT_TELEMETRY, -T ignored.\n");
+		use_telemetry = 0;
+	}
+
+	out_fp = out_file ? fopen(out_file, "w") : stdout;
+	if (out_fp == NULL) {
+		fprintf(stderr, "Error opening output file.\n");
+		return 0;
+	}
+	if (json)
+		fprintf(out_fp, "[");
+	else {
+		fprintf(out_fp, "keys,hash_type,distribution,hit_percent,method,threads,queries,ns_per_op,mops,hits,expected_hits");
+		for (i = 0; use_perf && i < BT_PERF_NUM_COUNTERS; i++)
+			fprintf(out_fp, ",%s_per_op", bt_perf_names[i]);
+		if (use_telemetry)
+			fprintf(out_fp, ",telemetry_overhead_pct");
+		fprintf(out_fp, "\n");
+	}
+
+	for (i = 0; i < num_widths; i++) {
+		int hash_type = (int)widths[i];
+		if (hash_type != 64 && hash_type != 128 && hash_type != 192) {
+			fprintf(stderr, "Unsupported hash type %d.\n", hash_type);
+			continue;
+		}
+		for (j = 0; j < num_sizes; j++) {
+			if (sizes[j] < 1 || sizes[j] > 0x7fffffff) {
+				fprintf(stderr, "Unsupported number of keys %.0f.\n", sizes[j]);
+				continue;
+			}
+			bench_size(hash_type, (unsigned int)sizes[j], hit_percents, num_hits, dists, num_dists);
+		}
+	}
+
+	if (json)
+		fprintf(out_fp, "\n]\n");
+	if (out_fp != stdout)
+		fclose(out_fp);
+	if (use_perf)
+		bt_perf_close(&perf);
+	if (use_telemetry)
+		print_telemetry();
+
+	return 0;
+}
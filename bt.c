@@ -10,11 +10,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
-#include <signal.h>
-#include <unistd.h>
+#include <time.h>
 
 #include "bt_twister.h"
 #include "bt_hash_types.h"
+#include "bt_trace.h"
 
 #if _OPENMP > 201107
 #define MAYBE_PARALLEL_FOR _Pragma("omp for")
@@ -58,14 +58,69 @@ static auxilliary_offset_data *offset_data = NULL;
 
 unsigned long long total_memory_in_bytes = 0;
 
-static volatile sig_atomic_t signal_stop = 0;
-
 static unsigned int verbosity;
 
-static void alarm_handler(int sig)
+static bt_build_stats build_stats;
+
+/* Deadline, cancellation and progress from bt_build_options. */
+static double build_deadline;
+static const int *build_cancel;
+static void (*build_progress)(void *, bt_build_phase, unsigned int, double);
+static void *build_progress_arg;
+static unsigned int build_abort;
+
+pthread_mutex_t bt_build_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Set with bt_build_options.hash_table_slack, see the singleton loop of create_tables(). */
+static int spread_singletons;
+
+/* Set with bt_build_options.stash_buckets, positions in offset_data of the stashed buckets. */
+static unsigned int stash_limit, num_stashed;
+static unsigned int *stashed_buckets;
+
+/*
+ * Set with bt_build_options.hot_keys. A bucket is hot when hot_key[] of the
+ * first key on its list is set, see mark_hot_keys().
+ */
+static const void *hot_keys;
+static unsigned int num_hot_keys, premix_hot_keys, hot_slots, hot_cursor;
+static unsigned char *hot_key;
+
+/*
+ * An attempt is abandoned as too slow once a single bucket has been scanned for
+ * longer than the attempt took up to that bucket, when retrying with larger
+ * tables is the quicker way forward, and for at least this many seconds.
+ */
+#define SLOW_BUCKET_SECONDS 0.05
+
+static double seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+double bt_monotonic_seconds(void)
+{
+	return seconds();
+}
+
+/* Returns the reason the build has to stop, 0 to carry on. */
+static unsigned int check_abort(void)
 {
-	if (sig == SIGALRM)
-		signal_stop = 1;
+	if (!build_abort) {
+		if (build_cancel && __atomic_load_n(build_cancel, __ATOMIC_RELAXED))
+			build_abort = BT_BUILD_CANCELLED;
+		else if (build_deadline > 0 && seconds() >= build_deadline)
+			build_abort = BT_BUILD_DEADLINE;
+	}
+	return build_abort;
+}
+
+static void report_progress(bt_build_phase phase, double percent)
+{
+	if (build_progress)
+		build_progress(build_progress_arg, phase, build_stats.attempts, percent);
 }
 
 static unsigned int coprime_check(unsigned int m,unsigned int n)
@@ -137,8 +192,71 @@ static unsigned int modulo_op(void * hash, unsigned int N, uint64_t shift64, uin
 	else if (hash_type == 192)
 		return  modulo192_31b(*(uint192_t *)hash, N, shift64, shift128);
 	else
-		fprintf(stderr, "modulo op error\n");
-	return 0;
+		return  modulo_n_31b((unsigned int *)hash, hash_words, N);
+}
+
+/*
+ * Flags the loaded keys that are hot in hot_key[] and moves each to the head
+ * of its bucket's list. Only one key of a bucket can be steered by its offset,
+ * the one at the head.
+ */
+static void mark_hot_keys(void)
+{
+	uint64_t key[BT_MAX_HASH_BITS / 64];
+	unsigned int i, j, loc;
+
+	if (bt_calloc((void **)&hot_key, num_loaded_hashes, sizeof(unsigned char)))
+		bt_error("Failed to allocate memory: hot_key.");
+	build_stats.hot_keys = 0;
+
+	for (i = 0; i < num_hot_keys; i++) {
+		auxilliary_offset_data *ptr;
+
+		memcpy(key, (const unsigned char *)hot_keys + (size_t)i * binary_size_actual, binary_size_actual);
+		if (premix_hot_keys)
+			bt_premix_keys(hash_type, key, 1);
+		ptr = &offset_data[modulo_op(key, offset_table_size, shift64_ot_sz, shift128_ot_sz)];
+
+		for (j = 0; j < ptr -> collisions; j++)
+			if (!memcmp(loaded_hashes + (size_t)ptr -> hash_location_list[j] * binary_size_actual, key, binary_size_actual))
+				break;
+		if (j == ptr -> collisions || hot_key[ptr -> hash_location_list[j]])
+			continue;
+
+		loc = ptr -> hash_location_list[j];
+		ptr -> hash_location_list[j] = ptr -> hash_location_list[0];
+		ptr -> hash_location_list[0] = loc;
+		hot_key[loc] = 1;
+		build_stats.hot_keys++;
+	}
+}
+
+static unsigned int is_hot(unsigned int i)
+{
+	return hot_key && offset_data[i].collisions && hot_key[offset_data[i].hash_location_list[0]];
+}
+
+/* Moves the hot buckets in [start, end) of offset_data ahead of the others, keeping the order of both. */
+static void hot_buckets_first(unsigned int start, unsigned int end)
+{
+	auxilliary_offset_data *hot;
+	unsigned int i, j, num_hot = 0;
+
+	for (i = start; i < end; i++)
+		num_hot += is_hot(i);
+	if (!num_hot)
+		return;
+
+	if (bt_malloc((void **)&hot, num_hot * sizeof(auxilliary_offset_data)))
+		bt_error("Failed to allocate memory: hot.");
+	for (i = start, j = 0; i < end; i++)
+		if (is_hot(i))
+			hot[j++] = offset_data[i];
+	for (i = end, j = end; i-- > start;)
+		if (!is_hot(i))
+			offset_data[--j] = offset_data[i];
+	memcpy(offset_data + start, hot, num_hot * sizeof(auxilliary_offset_data));
+	bt_free((void **)&hot);
 }
 
 /* Exploits the fact that sorting with a bucket is not essential. */
@@ -148,6 +266,9 @@ static void in_place_bucket_sort(unsigned int num_buckets)
 	unsigned int *histogram_empty;
 	unsigned int *prefix_sum;
 	unsigned int i;
+	double start = seconds();
+
+	BT_TRACE2(sort_start, num_buckets, offset_table_size);
 
 	if (bt_calloc((void **)&histogram, num_buckets + 1, sizeof(unsigned int)))
 		bt_error("Failed to allocate memory: histogram.");
@@ -163,6 +284,10 @@ static void in_place_bucket_sort(unsigned int num_buckets)
 	for (i = 1; i <= num_buckets; i++)
 		prefix_sum[i] = prefix_sum[i - 1] + histogram[i - 1];
 
+	memset(build_stats.bucket_histogram, 0, sizeof(build_stats.bucket_histogram));
+	for (i = 0; i <= num_buckets; i++)
+		build_stats.bucket_histogram[i < BT_BUILD_HISTOGRAM_SIZE ? i : BT_BUILD_HISTOGRAM_SIZE - 1] += histogram[num_buckets - i];
+
 	i = 0;
 	while (i < prefix_sum[num_buckets]) {
 		unsigned int histogram_index = num_buckets - offset_data[i].collisions;
@@ -185,6 +310,9 @@ static void in_place_bucket_sort(unsigned int num_buckets)
 	bt_free((void **)&histogram);
 	bt_free((void **)&histogram_empty);
 	bt_free((void **)&prefix_sum);
+
+	build_stats.sort_time += seconds() - start;
+	BT_TRACE2(sort_done, num_buckets, offset_table_size);
 }
 
 static void init_tables(unsigned int approx_offset_table_sz, unsigned int approx_hash_table_sz)
@@ -192,6 +320,8 @@ static void init_tables(unsigned int approx_offset_table_sz, unsigned int approx
 	unsigned int i, max_collisions, offset_data_idx;
 	uint64_t shift128;
 
+	BT_TRACE3(init_start, build_stats.attempts, approx_offset_table_sz, approx_hash_table_sz);
+
 	if (verbosity > 1)
 		fprintf(stdout, "\nInitialing Tables...");
 
@@ -251,7 +381,7 @@ static void init_tables(unsigned int approx_offset_table_sz, unsigned int approx
 #pragma omp for
 #endif
 	for (i = 0; i < num_loaded_hashes; i++) {
-		offset_data_idx = modulo_op(loaded_hashes + i * binary_size_actual, offset_table_size, shift64_ot_sz, shift128_ot_sz);
+		offset_data_idx = modulo_op(loaded_hashes + (size_t)i * binary_size_actual, offset_table_size, shift64_ot_sz, shift128_ot_sz);
 #if _OPENMP
 #pragma omp atomic
 #endif
@@ -274,7 +404,7 @@ MAYBE_PARALLEL_FOR
 #endif
 	for (i = 0; i < num_loaded_hashes; i++) {
 		unsigned int iter;
-		offset_data_idx = modulo_op(loaded_hashes + i * binary_size_actual, offset_table_size, shift64_ot_sz, shift128_ot_sz);
+		offset_data_idx = modulo_op(loaded_hashes + (size_t)i * binary_size_actual, offset_table_size, shift64_ot_sz, shift128_ot_sz);
 #if _OPENMP
 MAYBE_ATOMIC_WRITE
 #endif
@@ -290,15 +420,37 @@ MAYBE_ATOMIC_CAPTURE
 #endif
 }
 	total_memory_in_bytes += num_loaded_hashes * sizeof(unsigned int);
+	build_stats.max_collisions = max_collisions;
+
+	if (num_hot_keys)
+		mark_hot_keys();
 
 	//qsort((void *)offset_data, offset_table_size, sizeof(auxilliary_offset_data), qsort_compare);
 	in_place_bucket_sort(max_collisions);
 
+	/*
+	 * Hot buckets go first among the buckets of their size only, placing the
+	 * small ones ahead of larger cold ones leaves too few offsets for those.
+	 */
+	if (hot_key) {
+		unsigned int start, end;
+
+		for (start = 0; start < offset_table_size && offset_data[start].collisions; start = end) {
+			for (end = start; end < offset_table_size && offset_data[end].collisions == offset_data[start].collisions; end++);
+			hot_buckets_first(start, end);
+		}
+		hot_slots = (uint64_t)build_stats.hot_keys * BT_HOT_SLOTS_PER_KEY < hash_table_size ?
+			build_stats.hot_keys * BT_HOT_SLOTS_PER_KEY : hash_table_size;
+		build_stats.hot_slots = hot_slots;
+	}
+
 	if (verbosity > 1)
 		fprintf(stdout, "Done\n");
 
 	allocate_ht(num_loaded_hashes, verbosity);
 
+	BT_TRACE4(init_done, build_stats.attempts, offset_table_size, hash_table_size, max_collisions);
+
 	if (verbosity > 2) {
 		fprintf(stdout, "Offset Table Size %Lf %% of Number of Loaded Hashes.\n", ((long double)offset_table_size / (long double)num_loaded_hashes) * 100.00);
 		fprintf(stdout, "Offset Table Size(in GBs):%Lf\n", ((long double)offset_table_size * sizeof(OFFSET_TABLE_WORD)) / ((long double)1024 * 1024 * 1024));
@@ -343,12 +495,48 @@ static unsigned int check_n_insert_into_hash_table(unsigned int offset, auxillia
 static void calc_hash_mdoulo_table_size(unsigned int *store, auxilliary_offset_data * ptr) {
 	unsigned int i = 0;
 	while (i < ptr -> collisions) {
-		store[i] =  modulo_op(loaded_hashes + (ptr -> hash_location_list[i]) * binary_size_actual, hash_table_size, shift64_ht_sz, shift128_ht_sz);
+		store[i] =  modulo_op(loaded_hashes + (size_t)ptr -> hash_location_list[i] * binary_size_actual, hash_table_size, shift64_ht_sz, shift128_ht_sz);
 		i++;
 	}
 }
 
-static unsigned int create_tables()
+/* Two hashes of a bucket on the same Hash Table slot. */
+static unsigned int slot_clash(unsigned int *store, unsigned int collisions)
+{
+	unsigned int i, j;
+
+	for (i = 1; i < collisions; i++)
+		for (j = 0; j < i; j++)
+			if (store[i] == store[j])
+				return 1;
+	return 0;
+}
+
+/*
+ * Tries the offsets that put the first key of a hot bucket on a free slot
+ * below hot_slots. Returns 1 with the bucket placed under *offset_ptr.
+ * Hot keys are kept BT_HOT_SLOTS_PER_KEY slots apart: a run of full slots
+ * stalls the offset scans of the buckets that follow for its whole length.
+ */
+static unsigned int place_hot(auxilliary_offset_data *ptr, unsigned int *hash_table_idxs,
+			      unsigned int *store_hash_modulo_table_sz, OFFSET_TABLE_WORD *offset_ptr)
+{
+	unsigned int target, offset, z = store_hash_modulo_table_sz[0];
+
+	for (target = hot_cursor; target < hot_slots; target++) {
+		if (zero_check_ht(target))
+			continue;
+		offset = target >= z ? target - z : target + hash_table_size - z;
+		if (check_n_insert_into_hash_table(offset, ptr, hash_table_idxs, store_hash_modulo_table_sz)) {
+			hot_cursor = target + BT_HOT_SLOTS_PER_KEY;
+			*offset_ptr = offset;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static unsigned int create_tables(double attempt_start)
 {
  	unsigned int i;
 
@@ -363,29 +551,37 @@ static unsigned int create_tables()
 	OFFSET_TABLE_WORD last_offset;
 	unsigned int backtracking = 0;
 #endif
-	unsigned int trigger;
+	unsigned int trigger, failed = 0, too_slow = 0;
 	long double done = 0;
 	struct timeval t;
+	double start = seconds();
 
-	if (bt_malloc((void **)&store_hash_modulo_table_sz, offset_data[0].collisions * sizeof(unsigned int)))
+	if (bt_malloc((void **)&store_hash_modulo_table_sz, build_stats.max_collisions * sizeof(unsigned int)))
 		bt_error("Failed to allocate memory: store_hash_modulo_table_sz.");
-	if (bt_malloc((void **)&hash_table_idxs, offset_data[0].collisions * sizeof(unsigned int)))
+	if (bt_malloc((void **)&hash_table_idxs, build_stats.max_collisions * sizeof(unsigned int)))
 		bt_error("Failed to allocate memory: hash_table_idxs.");
 
+	BT_TRACE4(create_start, build_stats.attempts, offset_table_size, hash_table_size, build_stats.max_collisions);
+
 	gettimeofday(&t, NULL);
 
 	seedMT(t.tv_sec + t.tv_usec);
 
 	i = 0;
 	trigger = 0;
+	num_stashed = 0;
+	hot_cursor = 0;
+	build_stats.hot_keys_placed = 0;
 
-	while (offset_data[i].collisions > 1) {
+	while (i < offset_table_size && offset_data[i].collisions > 1) {
 		OFFSET_TABLE_WORD offset;
-		unsigned int num_iter;
+		unsigned int num_iter, clash, tried, bucket_limit, stashed = 0, hot;
+		double scan_start = 0;
 
 		done += offset_data[i].collisions;
 
 		calc_hash_mdoulo_table_size(store_hash_modulo_table_sz, &offset_data[i]);
+		clash = slot_clash(store_hash_modulo_table_sz, offset_data[i].collisions);
 
 		offset = (OFFSET_TABLE_WORD)(randomMT() & bitmap) % hash_table_size;
 
@@ -395,38 +591,69 @@ static unsigned int create_tables()
 			backtracking = 0;
 		}
 #endif
-		alarm(3);
 
-		num_iter = 0;
-		while (!check_n_insert_into_hash_table((unsigned int)offset, &offset_data[i], hash_table_idxs, store_hash_modulo_table_sz) && num_iter < limit) {
+		/*
+		 * Such a bucket fits no offset, fail without scanning them. While the
+		 * stash has room, a bucket goes there after BT_STASH_TRIES offsets.
+		 */
+		bucket_limit = num_stashed < stash_limit && limit > BT_STASH_TRIES ? BT_STASH_TRIES : limit;
+		num_iter = clash ? bucket_limit : 0;
+		hot = !clash && is_hot(i) &&
+		      place_hot(&offset_data[i], hash_table_idxs, store_hash_modulo_table_sz, &offset);
+		build_stats.hot_keys_placed += hot;
+		while (!hot && num_iter < bucket_limit && !check_n_insert_into_hash_table((unsigned int)offset, &offset_data[i], hash_table_idxs, store_hash_modulo_table_sz)) {
 			offset++;
 			if (offset >= hash_table_size) offset = 0;
 			num_iter++;
+			if (!(num_iter & 0xffff)) {
+				double now = seconds();
+
+				if (num_iter == 0x10000)
+					scan_start = now;
+				else if (now - scan_start > SLOW_BUCKET_SECONDS && now - scan_start > scan_start - attempt_start) {
+					too_slow = 1;
+					break;
+				}
+				if (check_abort())
+					break;
+			}
 		}
 
+		if (num_iter == bucket_limit && num_stashed < stash_limit) {
+			stashed_buckets[num_stashed++] = i;
+			offset = BT_STASH_OFFSET;
+			stashed = 1;
+		}
 		offset_table[offset_data[i].offset_table_idx] = offset;
 
+		tried = clash ? 0 : num_iter + 1;
+		build_stats.heavy_offsets_tried += tried;
+		if (tried > build_stats.max_offsets_tried)
+			build_stats.max_offsets_tried = tried;
+		BT_TRACE3(place_bucket, i, offset_data[i].collisions, tried);
+
 		if ((trigger & 0xffff) == 0) {
 			trigger = 0;
 			if (verbosity > 0) {
 				fprintf(stdout, "\rProgress:%Lf %%, Number of collisions:%u", done / (long double)num_loaded_hashes * 100.00, offset_data[i].collisions);
 				fflush(stdout);
 			}
-			alarm(0);
+			report_progress(BT_PHASE_PLACEMENT, (double)(done / num_loaded_hashes * 100.0));
+			check_abort();
 		}
 
-		if (signal_stop) {
-			alarm(0);
-			signal_stop = 0;
+		if (build_abort)
+			break;
+
+		if (too_slow) {
 			fprintf(stderr, "\nProgress is too slow!! trying next table size.\n");
-			bt_free((void **)&hash_table_idxs);
-			bt_free((void **)&store_hash_modulo_table_sz);
-			return 0;
+			build_stats.slow_attempts++;
+			break;
 		}
 
 		trigger++;
 
-		if (num_iter == limit) {
+		if (num_iter == bucket_limit && !stashed) {
 #ifdef ENABLE_BACKTRACKING
 			if (num_loaded_hashes > 1000000) {
 				unsigned int j, backtrack_steps, iter;
@@ -455,34 +682,58 @@ static unsigned int create_tables()
 				continue;
 			}
 #endif
-			bt_free((void **)&hash_table_idxs);
-			bt_free((void **)&store_hash_modulo_table_sz);
-			return 0;
+			failed = 1;
+			break;
 		}
 
 		i++;
 	}
 
-	alarm(0);
+	build_stats.placement_time += seconds() - start;
+
+	if (failed || too_slow || build_abort) {
+		bt_free((void **)&hash_table_idxs);
+		bt_free((void **)&store_hash_modulo_table_sz);
+		BT_TRACE3(create_fail, build_stats.attempts, i, too_slow);
+		return 0;
+	}
+
+	start = seconds();
 
+	/*
+	 * Singletons fill the Hash Table from the start, leaving the free slots in
+	 * one run at the end. A bucket placed again by bt_insert_*() needs free slots
+	 * at the distances between its keys, so with slack every singleton probes
+	 * from its own slot instead and the free slots stay scattered.
+	 */
 	hash_table_idx = 0;
-	while (offset_data[i].collisions > 0) {
+	while (i < offset_table_size && offset_data[i].collisions > 0) {
+		unsigned int hot = is_hot(i);
+
 		done++;
 
+		/* Hot singletons come first and take the lowest free slots. */
+		if (spread_singletons && !hot)
+			hash_table_idx = calc_ht_idx(offset_data[i].hash_location_list[0], 0);
 		while (hash_table_idx < hash_table_size) {
 			if (!zero_check_ht(hash_table_idx)) {
 				assign_ht(hash_table_idx, offset_data[i].hash_location_list[0]);
 				break;
 			}
-			hash_table_idx++;
+			if (++hash_table_idx == hash_table_size && spread_singletons)
+				hash_table_idx = 0;
 		}
 		offset_table[offset_data[i].offset_table_idx] = get_offset(hash_table_idx, offset_data[i].hash_location_list[0]);
+		build_stats.hot_keys_placed += hot && hash_table_idx < hot_slots;
 		if ((trigger & 0xffff) == 0) {
 			trigger = 0;
 			if (verbosity > 0) {
 				fprintf(stdout, "\rProgress:%Lf %%, Number of collisions:%u", done / (long double)num_loaded_hashes * 100.00, offset_data[i].collisions);
 				fflush(stdout);
 			}
+			report_progress(BT_PHASE_PLACEMENT, (double)(done / num_loaded_hashes * 100.0));
+			if (check_abort())
+				break;
 		}
 		trigger++;
 		i++;
@@ -491,9 +742,52 @@ static unsigned int create_tables()
 	bt_free((void **)&hash_table_idxs);
 	bt_free((void **)&store_hash_modulo_table_sz);
 
+	build_stats.singleton_time += seconds() - start;
+	if (build_abort) {
+		BT_TRACE3(create_fail, build_stats.attempts, i, 0);
+		return 0;
+	}
+	BT_TRACE2(create_done, build_stats.attempts, i);
+
 	return 1;
 }
 
+/*
+ * Moves the keys of the stashed buckets behind the others in loaded_hashes,
+ * where test_tables() does not look for them. Returns their number.
+ */
+static unsigned int move_stashed_keys(void)
+{
+	unsigned char *stashed, *keys = loaded_hashes, *stash_keys;
+	unsigned int i, j, num_keys = 0, num_stash_keys = 0;
+
+	if (bt_calloc((void **)&stashed, num_loaded_hashes, sizeof(unsigned char)))
+		bt_error("Failed to allocate memory: stashed.");
+	for (i = 0; i < num_stashed; i++) {
+		auxilliary_offset_data *ptr = &offset_data[stashed_buckets[i]];
+
+		for (j = 0; j < ptr -> collisions; j++)
+			stashed[ptr -> hash_location_list[j]] = 1;
+		num_stash_keys += ptr -> collisions;
+	}
+
+	if (bt_malloc((void **)&stash_keys, (size_t)num_stash_keys * binary_size_actual))
+		bt_error("Failed to allocate memory: stash_keys.");
+	for (i = 0, j = 0; i < num_loaded_hashes; i++) {
+		unsigned char *key = keys + (size_t)i * binary_size_actual;
+
+		if (stashed[i])
+			memcpy(stash_keys + (size_t)j++ * binary_size_actual, key, binary_size_actual);
+		else if (num_keys++ != i)
+			memcpy(keys + (size_t)(num_keys - 1) * binary_size_actual, key, binary_size_actual);
+	}
+	memcpy(keys + (size_t)num_keys * binary_size_actual, stash_keys, (size_t)num_stash_keys * binary_size_actual);
+
+	bt_free((void **)&stash_keys);
+	bt_free((void **)&stashed);
+	return num_stash_keys;
+}
+
 static unsigned int next_prime(unsigned int num)
 {
 	if (num == 1)
@@ -557,13 +851,41 @@ unsigned int create_perfect_hash_table(int htype, void *loaded_hashes_ptr,
 			       unsigned int *offset_table_sz_ptr,
 			       unsigned int *hash_table_sz_ptr,
 			       unsigned int verb)
+{
+	return create_perfect_hash_table_opt(htype, loaded_hashes_ptr, num_ld_hashes,
+					     offset_table_ptr, offset_table_sz_ptr,
+					     hash_table_sz_ptr, NULL, verb);
+}
+
+static unsigned int build_tables(int htype, void *loaded_hashes_ptr,
+			       unsigned int num_ld_hashes,
+			       OFFSET_TABLE_WORD **offset_table_ptr,
+			       unsigned int *offset_table_sz_ptr,
+			       unsigned int *hash_table_sz_ptr,
+			       const bt_build_options *opts,
+			       unsigned int verb)
 {
 	long double multiplier_ht, multiplier_ot, inc_ht, inc_ot;
 	unsigned int approx_hash_table_sz, approx_offset_table_sz, i, dupe_remove_ht_sz;
-	struct sigaction new_action, old_action;
-	struct itimerval old_it;
+	double build_start = seconds(), start;
 
 	total_memory_in_bytes = 0;
+	memset(&build_stats, 0, sizeof(build_stats));
+
+	build_deadline = opts ? opts -> deadline : 0;
+	build_cancel = opts ? opts -> cancel : NULL;
+	build_progress = opts ? opts -> progress : NULL;
+	build_progress_arg = opts ? opts -> progress_arg : NULL;
+	build_abort = 0;
+	spread_singletons = opts && opts -> hash_table_slack > 0;
+	stash_limit = opts && opts -> stash_ptr ? opts -> stash_buckets : 0;
+	hot_keys = opts ? opts -> hot_keys : NULL;
+	num_hot_keys = hot_keys ? opts -> num_hot_keys : 0;
+	premix_hot_keys = opts && opts -> premix;
+	if (opts && opts -> bloom_filter_ptr)
+		*opts -> bloom_filter_ptr = NULL;
+	if (opts && opts -> stash_ptr)
+		*opts -> stash_ptr = NULL;
 
 	hash_type = htype;
 	loaded_hashes = loaded_hashes_ptr;
@@ -614,86 +936,80 @@ unsigned int create_perfect_hash_table(int htype, void *loaded_hashes_ptr,
 			fprintf(stdout, "Using Hash type 192.\n");
 	}
 
-	new_action.sa_handler = alarm_handler;
-	sigemptyset(&new_action.sa_mask);
-	new_action.sa_flags = 0;
-
-	if (sigaction(SIGALRM, NULL, &old_action) < 0)
-		bt_error("Error retriving signal info.");
+	else if (BT_VALID_HASH_TYPE(hash_type)) {
+		zero_check_ht = zero_check_ht_n;
+		assign_ht = assign_ht_n;
+		assign0_ht = assign0_ht_n;
+		calc_ht_idx = calc_ht_idx_n;
+		get_offset = get_offset_n;
+		allocate_ht = allocate_ht_n;
+		test_tables = test_tables_n;
+		remove_duplicates = remove_duplicates_n;
+		loaded_hashes_n = (unsigned int *)loaded_hashes;
+		hash_words = BT_HASH_WORDS(hash_type);
+		binary_size_actual = hash_words * sizeof(unsigned int);
+		if (verbosity > 1)
+			fprintf(stdout, "Using packed Hash type %u.\n", hash_type);
+	}
 
-	if (sigaction(SIGALRM, &new_action, NULL) < 0)
-		bt_error("Error setting new signal handler.");
+	else {
+		fprintf(stderr, "Unsupported hash type %d.\n", htype);
+		return 0;
+	}
 
-	if (setitimer(ITIMER_REAL, NULL, &old_it) < 0)
-		bt_error("Error retriving timer info.");
+	if (bt_tune_parameters(hash_type, loaded_hashes, num_ld_hashes, opts ? opts -> tune_target : BT_TUNE_FASTEST,
+			       opts ? opts -> memory_budget_in_bytes : 0, &build_stats.tuning))
+		fprintf(stderr, "No table fits the memory budget, trying the smallest.\n");
 
-	inc_ht = 0.005;
-	inc_ot = 0.05;
+	multiplier_ot = build_stats.tuning.multiplier_ot;
+	multiplier_ht = build_stats.tuning.multiplier_ht + (opts ? opts -> hash_table_slack : 0);
+	inc_ot = build_stats.tuning.inc_ot;
+	inc_ht = build_stats.tuning.inc_ht;
+	dupe_remove_ht_sz = build_stats.tuning.dupe_remove_ht_sz;
 
-	if (num_ld_hashes <= 100) {
-		multiplier_ot = 1.501375173;
-		inc_ht = 0.05;
-		inc_ot = 0.5;
-		dupe_remove_ht_sz = 128;
-	}
-	else if (num_ld_hashes <= 1000) {
-		multiplier_ot = 1.101375173;
-		dupe_remove_ht_sz = 1024;
-	}
-	else if (num_ld_hashes <= 10000) {
-		multiplier_ot = 1.151375173;
-		dupe_remove_ht_sz = 16384;
-	}
-	else if (num_ld_hashes <= 100000) {
-		multiplier_ot = 1.20375173;
-		dupe_remove_ht_sz = 131072;
-	}
-	else if (num_ld_hashes <= 1000000) {
-		multiplier_ot = 1.25375173;
-		dupe_remove_ht_sz = 1048576;
-	}
-	else if (num_ld_hashes <= 10000000) {
-		multiplier_ot = 1.31375173;
-		dupe_remove_ht_sz = 16777216;
-	}
-	else if (num_ld_hashes <= 20000000) {
-		multiplier_ot = 1.35375173;
-		dupe_remove_ht_sz = 33554432;
-	}
-	else if (num_ld_hashes <= 50000000) {
-		multiplier_ot = 1.41375173;
-		dupe_remove_ht_sz = 67108864;
-	}
-	else if (num_ld_hashes <= 110000000) {
-		multiplier_ot = 1.51375173;
-		dupe_remove_ht_sz = 134217728;
-	}
-	else if (num_ld_hashes <= 200000000) {
-		multiplier_ot = 1.61375173;
-		dupe_remove_ht_sz = 134217728 * 2;
-	}
-	else {
-		fprintf(stderr, "This many number of hashes have never been tested before and might not succeed!!\n");
-		multiplier_ot = 3.01375173;
-		dupe_remove_ht_sz = 134217728 * 4;
-	}
+	if (verbosity > 1)
+		fprintf(stdout, "Offset Table multiplier %f, Hash Table multiplier %f, expected %.0f offsets tried, %.3f %% failure.\n",
+			(double)multiplier_ot, (double)multiplier_ht, build_stats.tuning.offsets_tried, build_stats.tuning.failure_probability * 100.0);
 
+	start = seconds();
+	report_progress(BT_PHASE_DEDUPE, 0);
+	BT_TRACE3(dedupe_start, hash_type, num_ld_hashes, dupe_remove_ht_sz);
 	num_loaded_hashes = remove_duplicates(num_ld_hashes, dupe_remove_ht_sz, verbosity);
 	if (!num_loaded_hashes)
 		bt_error("Failed to remove duplicates.");
-
-	multiplier_ht = 1.001097317;
+	BT_TRACE2(dedupe_done, hash_type, num_loaded_hashes);
+	build_stats.dedupe_time = seconds() - start;
+	build_stats.unique_keys = num_loaded_hashes;
+	report_progress(BT_PHASE_DEDUPE, 100);
 
 	approx_offset_table_sz = (((long double)num_loaded_hashes / 4.0) * multiplier_ot + 10.00);
 	approx_hash_table_sz = ((long double)num_loaded_hashes * multiplier_ht);
 
+	if (stash_limit && bt_malloc((void **)&stashed_buckets, stash_limit * sizeof(unsigned int)))
+		bt_error("Failed to allocate memory: stashed_buckets.");
+
 	i = 0;
 	do {
 		unsigned int temp;
+		double sort_time = build_stats.sort_time, attempt_start;
 
+		if (check_abort())
+			break;
+
+		build_stats.attempts++;
+		start = attempt_start = seconds();
+		report_progress(BT_PHASE_INIT, 0);
 		init_tables(approx_offset_table_sz, approx_hash_table_sz);
+		build_stats.init_time += seconds() - start - (build_stats.sort_time - sort_time);
+		report_progress(BT_PHASE_INIT, 100);
+		if (build_stats.attempts <= BT_BUILD_MAX_ATTEMPTS) {
+			build_stats.offset_table_sizes[build_stats.attempts - 1] = offset_table_size;
+			build_stats.hash_table_sizes[build_stats.attempts - 1] = hash_table_size;
+		}
+		if (total_memory_in_bytes > build_stats.peak_memory_in_bytes)
+			build_stats.peak_memory_in_bytes = total_memory_in_bytes;
 
-		if (create_tables()) {
+		if (create_tables(attempt_start)) {
 			if (verbosity > 0)
 				fprintf(stdout, "\n");
 			break;
@@ -702,6 +1018,7 @@ unsigned int create_perfect_hash_table(int htype, void *loaded_hashes_ptr,
 			fprintf(stdout, "\n");
 		release_all_lists();
 		bt_free((void **)&offset_data);
+		bt_free((void **)&hot_key);
 		bt_free((void **)&offset_table);
 		if (hash_type == 64)
 			bt_free((void **)&hash_table_64);
@@ -709,6 +1026,11 @@ unsigned int create_perfect_hash_table(int htype, void *loaded_hashes_ptr,
 			bt_free((void **)&hash_table_128);
 		else if (hash_type == 192)
 			bt_free((void **)&hash_table_192);
+		else
+			bt_free((void **)&hash_table_n);
+
+		if (build_abort)
+			break;
 
 		temp = next_prime(approx_offset_table_sz % 10);
 		approx_offset_table_sz /= 10;
@@ -723,28 +1045,152 @@ unsigned int create_perfect_hash_table(int htype, void *loaded_hashes_ptr,
 			approx_offset_table_sz = (((long double)num_loaded_hashes / 4.0) * multiplier_ot + 10.00);
 			approx_hash_table_sz = ((long double)num_loaded_hashes * multiplier_ht);
 		}
+		BT_TRACE3(retry, build_stats.attempts, approx_offset_table_sz, approx_hash_table_sz);
 
 	} while(1);
 
+	if (build_abort) {
+		if (verbosity > 0)
+			fprintf(stderr, "Build %s.\n", build_abort == BT_BUILD_CANCELLED ? "cancelled" : "past its deadline");
+		BT_TRACE2(abort, build_stats.attempts, build_abort);
+		build_stats.abort_reason = build_abort;
+		build_stats.total_time = seconds() - build_start;
+		*offset_table_ptr = NULL;
+		*hash_table_sz_ptr = *offset_table_sz_ptr = 0;
+		bt_free((void **)&stashed_buckets);
+		if (opts && opts -> stats)
+			*opts -> stats = build_stats;
+		return 0;
+	}
+
+	build_stats.stashed_buckets = num_stashed;
+	if (num_stashed)
+		build_stats.stashed_keys = move_stashed_keys();
+	bt_free((void **)&stashed_buckets);
+
 	release_all_lists();
 	bt_free((void **)&offset_data);
+	bt_free((void **)&hot_key);
+
+	build_stats.hash_table_load = (double)(num_loaded_hashes - build_stats.stashed_keys) / hash_table_size;
+	build_stats.offset_table_load = (double)(offset_table_size - build_stats.bucket_histogram[0]) / offset_table_size;
 
 	*offset_table_ptr = offset_table;
 	*hash_table_sz_ptr = hash_table_size;
 	*offset_table_sz_ptr = offset_table_size;
 
-	if (sigaction(SIGALRM, &old_action, NULL) < 0)
-		bt_error("Error restoring previous signal handler.");
+	start = seconds();
+	report_progress(BT_PHASE_TEST, 0);
+	if (!test_tables(num_loaded_hashes - build_stats.stashed_keys, offset_table, offset_table_size, shift64_ot_sz, shift128_ot_sz, verbosity)) {
+		build_stats.test_time = seconds() - start;
+		build_stats.total_time = seconds() - build_start;
+		if (opts && opts -> stats)
+			*opts -> stats = build_stats;
+		return 0;
+	}
+	build_stats.test_time = seconds() - start;
+	report_progress(BT_PHASE_TEST, 100);
+
+	if (build_stats.stashed_keys) {
+		unsigned int num_keys = num_loaded_hashes - build_stats.stashed_keys;
 
-	if (setitimer(ITIMER_REAL, &old_it, NULL) < 0)
-		bt_error("Error restoring previous timer.");
+		*opts -> stash_ptr = bt_stash_build((unsigned char *)loaded_hashes + (size_t)num_keys * binary_size_actual,
+						    build_stats.stashed_keys, binary_size_actual);
+		total_memory_in_bytes += (unsigned long long)build_stats.stashed_keys * binary_size_actual;
+		if (verbosity > 1)
+			fprintf(stdout, "Stashed %u keys of %u buckets.\n", build_stats.stashed_keys, build_stats.stashed_buckets);
+	}
 
-	if (!test_tables(num_loaded_hashes, offset_table, offset_table_size, shift64_ot_sz, shift128_ot_sz, verbosity))
-		return 0;
+	if (opts && opts -> bloom_filter_ptr) {
+		if (opts -> bloom_bits_per_key) {
+			start = seconds();
+			report_progress(BT_PHASE_BLOOM, 0);
+			*opts -> bloom_filter_ptr = bt_bloom_build(hash_type, loaded_hashes, num_loaded_hashes, opts -> bloom_bits_per_key, verbosity);
+			build_stats.bloom_time = seconds() - start;
+			report_progress(BT_PHASE_BLOOM, 100);
+			if (total_memory_in_bytes > build_stats.peak_memory_in_bytes)
+				build_stats.peak_memory_in_bytes = total_memory_in_bytes;
+		}
+	}
+
+	build_stats.total_time = seconds() - build_start;
+	if (opts && opts -> stats)
+		*opts -> stats = build_stats;
 
 	return num_loaded_hashes;
 }
 
+/*
+ * With opts -> premix the tables are built from the mixed keys, whose buckets
+ * are as even as those of random keys, and the Hash Table keeps them mixed.
+ * The keys are mixed back afterwards, left deduplicated as without premix.
+ */
+unsigned int create_perfect_hash_table_opt(int htype, void *loaded_hashes_ptr,
+			       unsigned int num_ld_hashes,
+			       OFFSET_TABLE_WORD **offset_table_ptr,
+			       unsigned int *offset_table_sz_ptr,
+			       unsigned int *hash_table_sz_ptr,
+			       const bt_build_options *opts,
+			       unsigned int verb)
+{
+	unsigned int ret;
+
+	if (!opts || !opts -> premix)
+		return build_tables(htype, loaded_hashes_ptr, num_ld_hashes, offset_table_ptr,
+				    offset_table_sz_ptr, hash_table_sz_ptr, opts, verb);
+
+	bt_premix_keys(htype, loaded_hashes_ptr, num_ld_hashes);
+	ret = build_tables(htype, loaded_hashes_ptr, num_ld_hashes, offset_table_ptr,
+			   offset_table_sz_ptr, hash_table_sz_ptr, opts, verb);
+	bt_unmix_keys(htype, loaded_hashes_ptr, num_ld_hashes);
+	return ret;
+}
+
+/*
+ * Builds a bt_table owning its tables, for builders running in the background.
+ * The globals are only touched under bt_build_lock, which also covers reading
+ * the Hash Table back. opts -> bloom_filter_ptr is replaced, as is
+ * opts -> stash_ptr when opts -> stash_buckets is set. Returns NULL if the
+ * build failed or was aborted.
+ */
+bt_table *bt_build_table(int htype, void *keys, unsigned int num_keys, bt_build_options *opts)
+{
+	OFFSET_TABLE_WORD *ot = NULL;
+	unsigned int ot_size, ht_size, *ht = NULL, **ht_ptr;
+	bt_bloom_filter *bloom_filter = NULL;
+	bt_stash *stash = NULL;
+	bt_build_options local = *opts;
+	bt_table *table;
+
+	/* The caller's options may be kept and reused, they get no pointers to locals. */
+	local.bloom_filter_ptr = &bloom_filter;
+	local.stash_ptr = opts -> stash_buckets ? &stash : NULL;
+	ht_ptr = htype == 64 ? &hash_table_64 : (htype == 128 ? &hash_table_128 :
+		 (htype == 192 ? &hash_table_192 : &hash_table_n));
+
+	pthread_mutex_lock(&bt_build_lock);
+	if (create_perfect_hash_table_opt(htype, keys, num_keys, &ot, &ot_size, &ht_size, &local, 0))
+		ht = *ht_ptr;
+	else if (ot) {
+		/* Failed the final test, the tables were left allocated. */
+		bt_free((void **)&ot);
+		bt_free((void **)ht_ptr);
+	}
+	*ht_ptr = NULL;
+	pthread_mutex_unlock(&bt_build_lock);
+
+	if (!ht)
+		return NULL;
+
+	if (bt_malloc((void **)&table, sizeof(bt_table)))
+		bt_error("Failed to allocate memory: table.");
+	bt_table_init(table, htype, ht, ot, ot_size, ht_size);
+	table -> bloom_filter = bloom_filter;
+	table -> stash = stash;
+	table -> premix = opts -> premix;
+	return table;
+}
+
 /*static int qsort_compare(const void *p1, const void *p2)
 {
 	auxilliary_offset_data *a = (auxilliary_offset_data *)p1;
@@ -0,0 +1,90 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include "bt_hash_types.h"
+#include "bt_bloom.h"
+
+void bt_bloom_insert(bt_bloom_filter *filter, uint64_t digest)
+{
+	unsigned int *block = (unsigned int *)bloom_block(filter, digest);
+	unsigned int h = (unsigned int)digest, i;
+
+	for (i = 0; i < BLOOM_BLOCK_WORDS; i++) {
+		unsigned int bit = 1U << ((h * bloom_salt[i]) >> 27);
+#if _OPENMP
+#pragma omp atomic
+#endif
+		block[i] |= bit;
+	}
+}
+
+bt_bloom_filter *bt_bloom_build(int htype, void *loaded_hashes, unsigned int num_loaded_hashes, unsigned int bits_per_key, unsigned int verbosity)
+{
+	bt_bloom_filter *filter;
+	unsigned long long num_bits;
+	unsigned int i;
+
+	if (verbosity > 1)
+		fprintf(stdout, "Building Bloom filter...");
+
+	if (bt_malloc((void **)&filter, sizeof(bt_bloom_filter)))
+		bt_error("Failed to allocate memory: filter.");
+
+	num_bits = (unsigned long long)num_loaded_hashes * bits_per_key;
+	filter -> num_blocks = (num_bits + 32 * BLOOM_BLOCK_WORDS - 1) / (32 * BLOOM_BLOCK_WORDS);
+	if (!filter -> num_blocks)
+		filter -> num_blocks = 1;
+
+	if (bt_memalign_alloc((void **)&filter -> blocks, 64, (size_t)filter -> num_blocks * BLOOM_BLOCK_WORDS * sizeof(unsigned int)))
+		bt_error("Couldn't allocate Bloom filter.");
+
+#if _OPENMP
+#pragma omp parallel private(i)
+#endif
+	{
+#if _OPENMP
+#pragma omp for
+#endif
+	for (i = 0; i < filter -> num_blocks * BLOOM_BLOCK_WORDS; i++)
+		filter -> blocks[i] = 0;
+
+#if _OPENMP
+#pragma omp for
+#endif
+	for (i = 0; i < num_loaded_hashes; i++) {
+		uint64_t digest;
+		if (htype == 64)
+			digest = bloom_digest_64(((uint64_t *)loaded_hashes)[i]);
+		else if (htype == 128)
+			digest = bloom_digest_128(((uint128_t *)loaded_hashes)[i]);
+		else if (htype == 192)
+			digest = bloom_digest_192(((uint192_t *)loaded_hashes)[i]);
+		else
+			digest = bloom_digest_words((unsigned int *)loaded_hashes + (size_t)i * BT_HASH_WORDS(htype), BT_HASH_WORDS(htype));
+		bt_bloom_insert(filter, digest);
+	}
+	}
+
+	total_memory_in_bytes += (unsigned long long)filter -> num_blocks * BLOOM_BLOCK_WORDS * sizeof(unsigned int);
+
+	if (verbosity > 1)
+		fprintf(stdout, "Done\n");
+
+	if (verbosity > 2)
+		fprintf(stdout, "Bloom Filter Size(in GBs):%Lf\n", ((long double)filter -> num_blocks * BLOOM_BLOCK_WORDS * sizeof(unsigned int)) / ((long double)1024 * 1024 * 1024));
+
+	return filter;
+}
+
+void bt_bloom_free(bt_bloom_filter **filter_ptr)
+{
+	if (!*filter_ptr)
+		return;
+	bt_free((void **)&(*filter_ptr) -> blocks);
+	bt_free((void **)filter_ptr);
+}
@@ -0,0 +1,90 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+/*
+ * Bloom filter probing, kept inline so that the lookup loops pay no call
+ * overhead for it.
+ */
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#define BLOOM_BLOCK_WORDS 8
+
+/* One odd multiplier per word of a block, each picks a bit within its word. */
+static const unsigned int bloom_salt[BLOOM_BLOCK_WORDS] __attribute__((aligned(32))) = {
+	0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+	0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+/*
+ * The digest must not correlate with hash % offset_table_size, hence keys are
+ * run through murmur3's finalizer rather than used directly.
+ */
+static inline uint64_t bloom_fmix64(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+static inline uint64_t bloom_digest_64(uint64_t hash)
+{
+	return bloom_fmix64(hash);
+}
+
+static inline uint64_t bloom_digest_128(uint128_t hash)
+{
+	return bloom_fmix64(hash.LO64 ^ (hash.HI64 * 0x9e3779b97f4a7c15ULL));
+}
+
+static inline uint64_t bloom_digest_192(uint192_t hash)
+{
+	return bloom_fmix64(hash.LO ^ (hash.MI * 0x9e3779b97f4a7c15ULL) ^ (hash.HI * 0xc2b2ae3d27d4eb4fULL));
+}
+
+static inline uint64_t bloom_digest_words(const unsigned int *hash, unsigned int words)
+{
+	uint64_t x = 0;
+
+	while (words--)
+		x = (x * 0x9e3779b97f4a7c15ULL) ^ hash[words];
+	return bloom_fmix64(x);
+}
+
+static inline const unsigned int *bloom_block(const bt_bloom_filter *filter, uint64_t digest)
+{
+	uint64_t block_idx = ((digest >> 32) * filter -> num_blocks) >> 32;
+	return filter -> blocks + block_idx * BLOOM_BLOCK_WORDS;
+}
+
+#if defined(__AVX2__)
+static inline int bloom_query(const bt_bloom_filter *filter, uint64_t digest)
+{
+	__m256i block = _mm256_load_si256((const __m256i *)bloom_block(filter, digest));
+	__m256i bit_pos = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32((unsigned int)digest),
+					    _mm256_load_si256((const __m256i *)bloom_salt)), 27);
+	__m256i mask = _mm256_sllv_epi32(_mm256_set1_epi32(1), bit_pos);
+
+	return _mm256_testc_si256(block, mask);
+}
+#else
+static inline int bloom_query(const bt_bloom_filter *filter, uint64_t digest)
+{
+	const unsigned int *block = bloom_block(filter, digest);
+	unsigned int h = (unsigned int)digest, i, miss = 0;
+
+	/* No early exit, keeps the loop branch free and vectorizable. */
+	for (i = 0; i < BLOOM_BLOCK_WORDS; i++)
+		miss |= ~block[i] & (1U << ((h * bloom_salt[i]) >> 27));
+
+	return !miss;
+}
+#endif
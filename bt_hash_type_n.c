@@ -0,0 +1,216 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+/*
+ * Packed hash types, hash_words 32 bit words per key, least significant first.
+ * Offsets are added to the key's remainder instead of the key, which gives the
+ * same slots as adding them to the key as long as that does not overflow.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "bt_hash_types.h"
+
+unsigned int *loaded_hashes_n = NULL;
+unsigned int *hash_table_n = NULL;
+unsigned int hash_words = 0;
+
+#define KEY(i) (loaded_hashes_n + (size_t)(i) * hash_words)
+
+/* Assuming N < 0x7fffffff, one word at a time from the most significant. */
+inline unsigned int modulo_n_31b(const unsigned int *a, unsigned int words, unsigned int N)
+{
+	uint64_t p = 0;
+
+	while (words--)
+		p = ((p << 32) | a[words]) % N;
+	return (unsigned int)p;
+}
+
+void allocate_ht_n(unsigned int num_loaded_hashes, unsigned int verbosity)
+{
+	size_t bytes = (size_t)hash_words * hash_table_size * sizeof(unsigned int);
+
+	if (bt_memalign_alloc((void **)&hash_table_n, 32, bytes))
+		bt_error("Couldn't allocate hash_table_n.");
+
+	memset(hash_table_n, 0, bytes);
+
+	total_memory_in_bytes += bytes;
+
+	if (verbosity > 2) {
+		fprintf(stdout, "Hash Table Size %Lf %% of Number of Loaded Hashes.\n", ((long double)hash_table_size / (long double)num_loaded_hashes) * 100.00);
+		fprintf(stdout, "Hash Table Size(in GBs):%Lf\n", ((long double)bytes) / ((long double)1024 * 1024 * 1024));
+	}
+}
+
+inline unsigned int calc_ht_idx_n(unsigned int hash_location, unsigned int offset)
+{
+	return (unsigned int)(((uint64_t)modulo_n_31b(KEY(hash_location), hash_words, hash_table_size) + offset) % hash_table_size);
+}
+
+inline unsigned int zero_check_ht_n(unsigned int hash_table_idx)
+{
+	unsigned int i;
+
+	for (i = 0; i < hash_words; i++)
+		if (hash_table_n[hash_table_idx + (size_t)i * hash_table_size])
+			return 1;
+	return 0;
+}
+
+inline void assign_ht_n(unsigned int hash_table_idx, unsigned int hash_location)
+{
+	const unsigned int *hash = KEY(hash_location);
+	unsigned int i;
+
+	for (i = 0; i < hash_words; i++)
+		hash_table_n[hash_table_idx + (size_t)i * hash_table_size] = hash[i];
+}
+
+inline void assign0_ht_n(unsigned int hash_table_idx)
+{
+	unsigned int i;
+
+	for (i = 0; i < hash_words; i++)
+		hash_table_n[hash_table_idx + (size_t)i * hash_table_size] = 0;
+}
+
+unsigned int get_offset_n(unsigned int hash_table_idx, unsigned int hash_location)
+{
+	unsigned int z = modulo_n_31b(KEY(hash_location), hash_words, hash_table_size);
+	return (hash_table_size - z + hash_table_idx);
+}
+
+int test_tables_n(unsigned int num_loaded_hashes, OFFSET_TABLE_WORD *offset_table, unsigned int offset_table_size, unsigned int shift64_ot_sz, unsigned int shift128_ot_sz, unsigned int verbosity)
+{
+	unsigned char *hash_table_collisions;
+	unsigned int i, j, hash_table_idx, error = 1, count = 0;
+	const unsigned int *hash;
+
+	if (verbosity > 1)
+		fprintf(stdout, "\nTesting Tables...");
+
+	if (bt_calloc((void **)&hash_table_collisions, hash_table_size, sizeof(unsigned char)))
+		bt_error("Failed to allocate memory: hash_table_collisions.");
+
+#if _OPENMP
+#pragma omp parallel private(i, j, hash_table_idx, hash)
+#endif
+	{
+#if _OPENMP
+#pragma omp for
+#endif
+		for (i = 0; i < num_loaded_hashes; i++) {
+			hash = KEY(i);
+			hash_table_idx =
+				calc_ht_idx_n(i,
+					(unsigned int)offset_table[
+					modulo_n_31b(hash, hash_words, offset_table_size)]);
+#if _OPENMP
+#pragma omp atomic
+#endif
+			hash_table_collisions[hash_table_idx]++;
+
+			for (j = 0; j < hash_words; j++)
+				if (hash_table_n[hash_table_idx + (size_t)j * hash_table_size] != hash[j])
+					break;
+			if (error && (j < hash_words || hash_table_collisions[hash_table_idx] > 1)) {
+				fprintf(stderr, "Error building tables: Loaded hash Idx:%u, No. of Collosions:%u\n", i, hash_table_collisions[hash_table_idx]);
+				error = 0;
+			}
+
+		}
+#if _OPENMP
+#pragma omp single
+#endif
+		for (hash_table_idx = 0; hash_table_idx < hash_table_size; hash_table_idx++)
+			if (zero_check_ht_n(hash_table_idx))
+				count++;
+#if _OPENMP
+#pragma omp barrier
+#endif
+	}
+
+/* Suppress unused variable warning. */
+#define UNUSED(x) (void)(x)
+	UNUSED(shift128_ot_sz);
+	UNUSED(shift64_ot_sz);
+
+	if (count != num_loaded_hashes) {
+		error = 0;
+		fprintf(stderr, "Error!! Tables contains extra or less entries.\n");
+		return 0;
+	}
+
+	bt_free((void **)&hash_table_collisions);
+
+	if (error && verbosity > 1)
+		fprintf(stdout, "OK\n");
+
+	return 1;
+}
+
+static unsigned int dedupe_slot(const unsigned int *hash, uint64_t mask)
+{
+	uint64_t lo = hash[0];
+
+	if (hash_words > 1)
+		lo |= (uint64_t)hash[1] << 32;
+	return (unsigned int)(((lo * 0x9e3779b97f4a7c15ULL) >> 32) & mask);
+}
+
+/*
+ * Open addressing over the positions of the unique keys, which are moved down
+ * over the duplicates and all zero keys as they are found. The table has at
+ * least hash_table_size slots and never gets more than half full.
+ */
+unsigned int remove_duplicates_n(unsigned int num_loaded_hashes, unsigned int hash_table_size, unsigned int verbosity)
+{
+	uint64_t size = hash_table_size, slot;
+	size_t key_bytes = (size_t)hash_words * sizeof(unsigned int);
+	unsigned int i, num_unique_hashes = 0, *slots;
+
+	if (verbosity > 1)
+		fprintf(stdout, "Removing duplicate hashes...");
+
+	if (hash_table_size & (hash_table_size - 1)) {
+		fprintf(stderr, "Duplicate removal hash table size must power of 2.\n");
+		return 0;
+	}
+
+	while (size < 2 * (uint64_t)num_loaded_hashes)
+		size <<= 1;
+	if (bt_calloc((void **)&slots, size, sizeof(unsigned int)))
+		bt_error("Failed to allocate memory: slots.");
+
+	for (i = 0; i < num_loaded_hashes; i++) {
+		const unsigned int *hash = KEY(i);
+		unsigned int j;
+
+		for (j = 0; j < hash_words && !hash[j]; j++);
+		if (j == hash_words)
+			continue;
+
+		for (slot = dedupe_slot(hash, size - 1); slots[slot]; slot = (slot + 1) & (size - 1))
+			if (!memcmp(KEY(slots[slot] - 1), hash, key_bytes))
+				break;
+		if (slots[slot])
+			continue;
+
+		if (num_unique_hashes != i)
+			memcpy(KEY(num_unique_hashes), hash, key_bytes);
+		slots[slot] = ++num_unique_hashes;
+	}
+
+	bt_free((void **)&slots);
+
+	if (verbosity > 1)
+		fprintf(stdout, "Done\n");
+
+	return num_unique_hashes;
+}
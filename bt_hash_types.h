@@ -12,6 +12,8 @@
 extern uint64_t *loaded_hashes_64;
 extern uint128_t *loaded_hashes_128;
 extern uint192_t *loaded_hashes_192;
+extern unsigned int *loaded_hashes_n;
+extern unsigned int hash_words; // Of the packed hash type being built.
 
 extern unsigned int hash_table_size;
 extern unsigned int shift64_ht_sz, shift128_ht_sz;
@@ -24,6 +26,10 @@ extern void bt_free(void **ptr);
 extern void bt_error_fn(const char *str, char *file, int line);
 extern void bt_warn_fn(const char *str, char *file, int line);
 
+/* Serializes builds, the builder keeps its state in globals. */
+extern pthread_mutex_t bt_build_lock;
+extern bt_table *bt_build_table(int htype, void *keys, unsigned int num_keys, bt_build_options *opts);
+
 extern unsigned int modulo64_31b(uint64_t, unsigned int);
 extern void allocate_ht_64(unsigned int, unsigned int);
 extern unsigned int calc_ht_idx_64(unsigned int, unsigned int);
@@ -52,4 +58,22 @@ extern void assign_ht_192(unsigned int, unsigned int);
 extern void assign0_ht_192(unsigned int);
 extern unsigned int get_offset_192(unsigned int, unsigned int);
 extern int test_tables_192(unsigned int, OFFSET_TABLE_WORD *, unsigned int, unsigned int, unsigned int, unsigned int);
-extern unsigned int remove_duplicates_192(unsigned int, unsigned int, unsigned int);
\ No newline at end of file
+extern unsigned int remove_duplicates_192(unsigned int, unsigned int, unsigned int);
+
+extern unsigned int modulo_n_31b(const unsigned int *, unsigned int, unsigned int);
+extern void allocate_ht_n(unsigned int, unsigned int);
+extern unsigned int calc_ht_idx_n(unsigned int, unsigned int);
+extern unsigned int zero_check_ht_n(unsigned int);
+extern void assign_ht_n(unsigned int, unsigned int);
+extern void assign0_ht_n(unsigned int);
+extern unsigned int get_offset_n(unsigned int, unsigned int);
+extern int test_tables_n(unsigned int, OFFSET_TABLE_WORD *, unsigned int, unsigned int, unsigned int, unsigned int);
+extern unsigned int remove_duplicates_n(unsigned int, unsigned int, unsigned int);
+
+extern bt_bloom_filter *bt_bloom_build(int htype, void *loaded_hashes, unsigned int num_loaded_hashes, unsigned int bits_per_key, unsigned int verbosity);
+extern void bt_bloom_insert(bt_bloom_filter *filter, uint64_t digest);
+
+extern bt_stash *bt_stash_build(const void *keys, unsigned int num_keys, unsigned int key_bytes);
+extern unsigned int bt_stash_find(const bt_stash *stash, const void *key, unsigned int key_bytes);
+extern int bt_stash_insert(bt_stash *stash, const void *key, unsigned int key_bytes);
+extern unsigned int bt_stash_remove(bt_stash *stash, const void *key, unsigned int key_bytes);
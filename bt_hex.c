@@ -0,0 +1,396 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if _OPENMP
+#include <omp.h>
+#endif
+#include "bt_hash_types.h"
+
+/* Value of each hex digit, -1 for every other character. */
+static const signed char hex_value[256] = {
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+static const char hex_digit[16] = "0123456789abcdef";
+
+/*
+ * The format is defined by the fscanf("%08s%08s...\n") loops demo.c used:
+ * the file is a stream of whitespace separated tokens, every token is cut into
+ * pieces of up to 8 characters, each piece is converted with strtol(piece,
+ * NULL, 16) into one 32 bit word, and every words_per_hash pieces make a hash,
+ * least significant word first. A trailing incomplete hash is dropped.
+ *
+ * Nearly every file has one hash per line, written as exactly 8 hex digits per
+ * word, so that is decoded in a single pass, each thread writing at the
+ * position given by the offset of its first line. Any other line makes the
+ * parse start over with a count of the pieces of every thread first.
+ */
+static unsigned int words_per_hash(int htype)
+{
+	return htype == 64 ? 2 : (htype == 128 ? 4 : (htype == 192 ? 5 : BT_HASH_WORDS(htype)));
+}
+
+static size_t hash_size(int htype)
+{
+	return htype / 8;
+}
+
+static int is_space(unsigned char c)
+{
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static unsigned int decode_word(const unsigned char *p)
+{
+	unsigned int v = 0, i;
+
+	for (i = 0; i < 8; i++)
+		v = (v << 4) | (unsigned int)hex_value[p[i]];
+	return v;
+}
+
+/* strtol(piece, NULL, 16) for a piece of n non whitespace characters. */
+static unsigned int piece_value(const unsigned char *p, unsigned int n)
+{
+	unsigned int i = 0, v = 0, neg = 0;
+
+	if (n && (p[0] == '+' || p[0] == '-')) {
+		neg = p[0] == '-';
+		i++;
+	}
+	if (i + 2 < n && p[i] == '0' && (p[i + 1] | 0x20) == 'x' && hex_value[p[i + 2]] >= 0)
+		i += 2;
+	while (i < n && hex_value[p[i]] >= 0)
+		v = (v << 4) | (unsigned int)hex_value[p[i++]];
+
+	return neg ? 0U - v : v;
+}
+
+static void store_hash(int htype, void *keys, size_t i, const unsigned int *w)
+{
+	if (htype == 64)
+		((uint64_t *)keys)[i] = ((uint64_t)w[1] << 32) | w[0];
+	else if (htype == 128) {
+		((uint128_t *)keys)[i].LO64 = ((uint64_t)w[1] << 32) | w[0];
+		((uint128_t *)keys)[i].HI64 = ((uint64_t)w[3] << 32) | w[2];
+	}
+	else if (htype == 192) {
+		((uint192_t *)keys)[i].LO = ((uint64_t)w[1] << 32) | w[0];
+		((uint192_t *)keys)[i].MI = ((uint64_t)w[3] << 32) | w[2];
+		((uint192_t *)keys)[i].HI = w[4];
+	}
+	else
+		memcpy((unsigned int *)keys + i * BT_HASH_WORDS(htype), w, BT_HASH_WORDS(htype) * sizeof(unsigned int));
+}
+
+/* Moves start forward to the beginning of a line. */
+static size_t line_start(const char *buf, size_t len, size_t start)
+{
+	const char *eol;
+
+	if (!start || buf[start - 1] == '\n')
+		return start;
+	eol = memchr(buf + start, '\n', len - start);
+	return eol ? (size_t)(eol - buf) + 1 : len;
+}
+
+/*
+ * Single pass over [start, stop) assuming every line is 8 * K hex digits and a
+ * newline (the last line of the buffer may lack it). Returns 0 at the first
+ * line that isn't.
+ */
+static int parse_fast(int htype, const unsigned char *buf, size_t len, size_t start, size_t stop, void *keys)
+{
+	unsigned int K = words_per_hash(htype), line = 8 * K + 1, w[BT_MAX_HASH_BITS / 32], i, j;
+	size_t idx = start / line;
+
+	if (start < stop && start % line)
+		return 0;
+
+	for (; start < stop; start += line, idx++) {
+		const unsigned char *p = buf + start;
+		if (start + line <= len ? p[line - 1] != '\n' : start + line - 1 != len)
+			return 0;
+		for (i = 0; i < 8 * K; i++)
+			if (hex_value[p[i]] < 0)
+				return 0;
+		for (j = 0; j < K; j++)
+			w[j] = decode_word(p + 8 * j);
+		store_hash(htype, keys, idx, w);
+	}
+	return 1;
+}
+
+/*
+ * Returns the next piece at or after p, as fscanf("%08s") reads it: leading
+ * whitespace is skipped, then up to 8 other characters are taken. *n is set
+ * to the length of the piece, 0 at the end of the range.
+ */
+static const unsigned char *next_piece(const unsigned char *p, const unsigned char *e, unsigned int *n)
+{
+	const unsigned char *t;
+
+	while (p < e && is_space(*p))
+		p++;
+	for (t = p; t < e && t - p < 8 && !is_space(*t); t++)
+		;
+	*n = t - p;
+	return p;
+}
+
+/*
+ * Hashes made of pieces of more than one thread are assembled afterwards:
+ * every thread keeps its pieces before its first whole hash in head and the
+ * pieces after its last one in tail.
+ */
+typedef struct {
+	uint64_t first_piece;
+	uint64_t num_pieces;
+	unsigned int head[BT_MAX_HASH_BITS / 32], num_head;
+	unsigned int tail[BT_MAX_HASH_BITS / 32], num_tail;
+} piece_range;
+
+static void parse_pieces(int htype, const unsigned char *buf, size_t start, size_t stop,
+			 piece_range *r, uint64_t num_keys, void *keys)
+{
+	unsigned int K = words_per_hash(htype), w[BT_MAX_HASH_BITS / 32], j = 0;
+	uint64_t piece = r -> first_piece, first_whole = (piece + K - 1) / K * K;
+
+	const unsigned char *p, *e = buf + stop;
+	unsigned int n;
+
+	r -> num_head = 0;
+	for (p = next_piece(buf + start, e, &n); n; p = next_piece(p + n, e, &n), piece++) {
+		unsigned int v = piece_value(p, n);
+		if (piece < first_whole)
+			r -> head[r -> num_head++] = v;
+		else if (piece / K < num_keys) {
+			w[j++] = v;
+			if (j == K) {
+				store_hash(htype, keys, piece / K, w);
+				j = 0;
+			}
+		}
+	}
+
+	for (r -> num_tail = 0; r -> num_tail < j; r -> num_tail++)
+		r -> tail[r -> num_tail] = w[r -> num_tail];
+}
+
+static void join_pieces(int htype, piece_range *ranges, int num_ranges, uint64_t num_keys, void *keys)
+{
+	unsigned int K = words_per_hash(htype), w[BT_MAX_HASH_BITS / 32], i, j = 0;
+	uint64_t piece = 0;
+	int t;
+
+	for (t = 0; t < num_ranges; t++) {
+		piece_range *r = &ranges[t];
+		for (i = 0; i < r -> num_head; i++) {
+			w[j++] = r -> head[i];
+			if (j == K) {
+				if (piece / K < num_keys)
+					store_hash(htype, keys, piece / K, w);
+				j = 0;
+			}
+			piece++;
+		}
+		if (r -> num_pieces > r -> num_head) {
+			piece = r -> first_piece + r -> num_pieces;
+			for (j = 0; j < r -> num_tail; j++)
+				w[j] = r -> tail[j];
+		}
+	}
+}
+
+unsigned int bt_hex_parse(int htype, const char *buf, size_t len, void **keys_ptr)
+{
+	unsigned int K = words_per_hash(htype);
+	uint64_t num_keys = (len + 8 * K) / (8 * K + 1);
+	piece_range *ranges = NULL;
+	int team_size = 1, fast = 1;
+
+	if (bt_malloc(keys_ptr, num_keys * hash_size(htype)))
+		bt_error("Failed to allocate memory: keys.");
+
+#if _OPENMP
+#pragma omp parallel
+#endif
+	{
+		const unsigned char *ubuf = (const unsigned char *)buf;
+		size_t start, stop;
+		int tid = 0, i;
+
+#if _OPENMP
+		tid = omp_get_thread_num();
+#pragma omp single
+#endif
+		{
+#if _OPENMP
+			team_size = omp_get_num_threads();
+#endif
+			if (bt_malloc((void **)&ranges, team_size * sizeof(piece_range)))
+				bt_error("Failed to allocate memory: hex parse ranges.");
+		}
+
+		start = line_start(buf, len, len * tid / team_size);
+		stop = line_start(buf, len, len * (tid + 1) / team_size);
+
+		if (!parse_fast(htype, ubuf, len, start, stop, *keys_ptr)) {
+#if _OPENMP
+#pragma omp atomic write
+#endif
+			fast = 0;
+		}
+#if _OPENMP
+#pragma omp barrier
+#endif
+		if (!fast) {
+			const unsigned char *p, *e = ubuf + stop;
+			uint64_t count = 0;
+			unsigned int n;
+
+			for (p = next_piece(ubuf + start, e, &n); n; p = next_piece(p + n, e, &n))
+				count++;
+			ranges[tid].num_pieces = count;
+#if _OPENMP
+#pragma omp barrier
+#pragma omp single
+#endif
+			{
+				uint64_t total = 0;
+				for (i = 0; i < team_size; i++) {
+					ranges[i].first_piece = total;
+					total += ranges[i].num_pieces;
+				}
+				num_keys = total / K;
+				bt_free(keys_ptr);
+				if (bt_malloc(keys_ptr, num_keys * hash_size(htype)))
+					bt_error("Failed to allocate memory: keys.");
+			}
+			parse_pieces(htype, ubuf, start, stop, &ranges[tid], num_keys, *keys_ptr);
+		}
+	}
+
+	if (!fast)
+		join_pieces(htype, ranges, team_size, num_keys, *keys_ptr);
+	bt_free((void **)&ranges);
+
+	if (num_keys > 0xffffffff)
+		bt_error("Too many hashes in hex list.");
+
+	return (unsigned int)num_keys;
+}
+
+static double seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+unsigned int bt_hex_load(int htype, const char *filename, void **keys_ptr, unsigned int verbosity)
+{
+	double t0, t1, t2;
+	struct stat st;
+	char *text = NULL;
+	unsigned int num_keys;
+	int fd;
+
+	if (verbosity > 1)
+		fprintf(stdout, "Loading Hashes...");
+
+	t0 = seconds();
+	fd = open(filename, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st))
+		bt_error("Error reading file.");
+	if (st.st_size) {
+		text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (text == MAP_FAILED)
+			bt_error("Couldn't map hash list.");
+		madvise(text, st.st_size, MADV_WILLNEED);
+	}
+	close(fd);
+
+	t1 = seconds();
+	num_keys = bt_hex_parse(htype, text, st.st_size, keys_ptr);
+	t2 = seconds();
+
+	if (text)
+		munmap(text, st.st_size);
+
+	if (verbosity > 1)
+		fprintf(stdout, "Done.\n");
+	if (verbosity > 2)
+		fprintf(stdout, "Hash list %Lf GBs, map %f s, parse %f s (%f GB/s).\n",
+			((long double)st.st_size) / ((long double)1024 * 1024 * 1024),
+			t1 - t0, t2 - t1, st.st_size / ((t2 - t1) * 1024 * 1024 * 1024));
+
+	return num_keys;
+}
+
+unsigned int bt_hex_format(int htype, const void *hash, char *out)
+{
+	unsigned int w[BT_MAX_HASH_BITS / 32], n, i, j;
+
+	if (htype == 64) {
+		uint64_t h = *(const uint64_t *)hash;
+		w[0] = (unsigned int)h;
+		w[1] = (unsigned int)(h >> 32);
+		n = 2;
+	}
+	else if (htype == 128) {
+		const uint128_t *h = hash;
+		w[0] = (unsigned int)h -> LO64;
+		w[1] = (unsigned int)(h -> LO64 >> 32);
+		w[2] = (unsigned int)h -> HI64;
+		w[3] = (unsigned int)(h -> HI64 >> 32);
+		n = 4;
+	}
+	else if (htype == 192) {
+		const uint192_t *h = hash;
+		w[0] = (unsigned int)h -> LO;
+		w[1] = (unsigned int)(h -> LO >> 32);
+		w[2] = (unsigned int)h -> MI;
+		w[3] = (unsigned int)(h -> MI >> 32);
+		w[4] = (unsigned int)h -> HI;
+		w[5] = (unsigned int)(h -> HI >> 32);
+		n = w[5] ? 6 : 5;
+	}
+	else {
+		n = BT_HASH_WORDS(htype);
+		memcpy(w, hash, n * sizeof(unsigned int));
+	}
+
+	for (i = 0; i < n; i++)
+		for (j = 0; j < 8; j++)
+			out[8 * i + j] = hex_digit[(w[i] >> (28 - 4 * j)) & 0xf];
+	out[8 * n] = '\n';
+
+	return 8 * n + 1;
+}
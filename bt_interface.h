@@ -4,7 +4,10 @@
  * Redistribution and use in source and binary forms, with or without modification, are permitted.
  */
 
+#include <stdio.h>
+#include <stddef.h>
 #include <inttypes.h>
+#include <pthread.h>
 #define OFFSET_TABLE_WORD unsigned int
 
 typedef struct {
@@ -21,17 +24,725 @@ typedef struct {
 extern unsigned int *hash_table_64; // Hash Table for 64 bit hashes.
 extern unsigned int *hash_table_128; // Hash Table for 128 bit hashes.
 extern unsigned int *hash_table_192; // Hash Table for 192 bit hashes.
+extern unsigned int *hash_table_n; // Hash Table for packed hashes.
+
+/*
+ * Packed hash types: any other multiple of 32 bits up to BT_MAX_HASH_BITS, e.g.
+ * 32, 96, 160 (SHA-1) or 256. A packed key is htype / 32 unsigned ints, least
+ * significant first, with no padding between keys, and the Hash Table stores
+ * exactly that many words per slot. On little endian machines the layout of
+ * uint64_t, uint128_t and uint192_t keys is the packed one, but 64, 128 and
+ * 192 bit hashes keep their own faster code.
+ */
+#define BT_MAX_HASH_BITS 256
+#define BT_HASH_WORDS(htype) ((unsigned int)(htype) / 32)
+#define BT_IS_PACKED(htype) ((htype) != 64 && (htype) != 128 && (htype) != 192)
+#define BT_VALID_HASH_TYPE(htype) ((htype) > 0 && (htype) <= BT_MAX_HASH_BITS && !((htype) % 32))
+
+/* Returned by lookups when a hash is not present in the tables. */
+#define BT_NOT_FOUND 0xffffffff
+
+/*
+ * Blocked Bloom filter consulted before the Offset Table. Every key maps to one
+ * 256 bit block (32 byte aligned, hence within a single cache line) and sets one
+ * bit in each of the block's eight 32 bit words.
+ */
+typedef struct {
+	unsigned int *blocks; // num_blocks * 8 words.
+	unsigned int num_blocks;
+} bt_bloom_filter;
+
+/*
+ * Stash of the keys of buckets that found no offset, sorted by memcmp() on
+ * their hash_type / 8 bytes. Their Offset Table entries are BT_STASH_OFFSET,
+ * which no placed bucket can have, and lookups of their keys search the
+ * stash instead of the Hash Table.
+ */
+#define BT_STASH_OFFSET 0xffffffff
+
+typedef struct {
+	void *keys;
+	unsigned int num_keys;
+} bt_stash;
+
+/*
+ * Table sizing. bt_tune_parameters() buckets a sample of the keys into a
+ * proportionally smaller Offset Table for a grid of Offset and Hash Table
+ * sizes, and uses the bucket size distribution to predict the offsets tried
+ * while placing buckets, the chance that an attempt fails and the build time.
+ * BT_TUNE_FASTEST picks the fastest predicted build, BT_TUNE_SMALLEST the
+ * smallest table that builds at most BT_TUNE_SMALLEST_SLOWDOWN times slower.
+ * Both only consider tables within the memory budget, 0 for none.
+ */
+#define BT_TUNE_SMALLEST_SLOWDOWN 4.0
+
+typedef enum {
+	BT_TUNE_FASTEST = 0,
+	BT_TUNE_SMALLEST
+} bt_tune_target;
+
+typedef struct {
+	double multiplier_ot; // Offset Table slots per four keys.
+	double multiplier_ht; // Hash Table slots per key.
+	double inc_ot, inc_ht; // Added to the multipliers every fifth failed attempt.
+	unsigned int dupe_remove_ht_sz; // Power of 2.
+	unsigned long long table_bytes; // Offset Table and Hash Table.
+	double offsets_tried; // Expected over buckets of more than one hash.
+	double failure_probability; // Per attempt.
+	double seconds; // Expected, over all attempts.
+} bt_tune_result;
+
+/*
+ * Statistics of a build. Phase times are wall clock seconds and offsets tried
+ * are summed over all attempts; every attempt after the first follows a
+ * failure to place a bucket or slow progress, and retries with larger tables.
+ * The bucket histogram, max_collisions and the load factors describe the last
+ * attempt.
+ */
+#define BT_BUILD_MAX_ATTEMPTS 64
+#define BT_BUILD_HISTOGRAM_SIZE 32
+
+typedef struct {
+	double total_time;
+	double dedupe_time; // remove_duplicates
+	double init_time; // init_tables, without the bucket sort
+	double sort_time; // in_place_bucket_sort
+	double placement_time; // buckets of more than one hash
+	double singleton_time; // buckets of a single hash
+	double test_time; // test_tables
+	double bloom_time;
+	unsigned int unique_keys;
+	unsigned int attempts;
+	// Table sizes of the first BT_BUILD_MAX_ATTEMPTS attempts.
+	unsigned int offset_table_sizes[BT_BUILD_MAX_ATTEMPTS];
+	unsigned int hash_table_sizes[BT_BUILD_MAX_ATTEMPTS];
+	// Offset Table slots by number of hashes, the last entry counts all larger buckets.
+	unsigned int bucket_histogram[BT_BUILD_HISTOGRAM_SIZE];
+	unsigned int max_collisions;
+	unsigned long long heavy_offsets_tried; // Offsets tested for buckets of more than one hash.
+	unsigned int max_offsets_tried; // Most offsets tested for a single bucket.
+	double hash_table_load; // unique_keys / hash_table_size
+	double offset_table_load; // Fraction of used Offset Table slots.
+	unsigned long long peak_memory_in_bytes; // Largest total_memory_in_bytes.
+	bt_tune_result tuning; // Parameters the first attempt started from.
+	unsigned int slow_attempts; // Attempts abandoned for slow progress.
+	unsigned int abort_reason; // BT_BUILD_CANCELLED, BT_BUILD_DEADLINE or 0.
+	unsigned int stashed_buckets, stashed_keys;
+	// Hot keys among the loaded ones, the slots they aim at, and those placed there.
+	unsigned int hot_keys, hot_slots, hot_keys_placed;
+} bt_build_stats;
+
+/* Build phases reported to bt_build_options.progress. */
+typedef enum {
+	BT_PHASE_DEDUPE = 0,
+	BT_PHASE_INIT, // Once per attempt.
+	BT_PHASE_PLACEMENT, // Percent of the keys placed by the current attempt.
+	BT_PHASE_TEST,
+	BT_PHASE_BLOOM
+} bt_build_phase;
+
+#define BT_BUILD_CANCELLED 1
+#define BT_BUILD_DEADLINE 2
+
+/*
+ * Optional build parameters, pass NULL for defaults. A build that is cancelled
+ * or runs past its deadline frees its tables and returns 0 with abort_reason
+ * set in the stats. Both are checked between phases and every 65536 buckets
+ * or offsets tried while placing, not inside duplicate removal or the
+ * initialization of an attempt.
+ */
+typedef struct {
+	unsigned int bloom_bits_per_key; // Bloom filter budget, 0 disables the filter.
+	bt_bloom_filter **bloom_filter_ptr; // Returns a pointer to the Bloom filter, NULL if disabled.
+	bt_build_stats *stats; // Filled in when not NULL.
+	bt_tune_target tune_target;
+	unsigned long long memory_budget_in_bytes; // Offset Table and Hash Table, 0 for no limit.
+	double deadline; // In bt_monotonic_seconds(), 0 for none.
+	const int *cancel; // The build stops once *cancel is set from another thread, may be NULL.
+	// Called from the building thread with the percentage of the phase done, may be NULL.
+	void (*progress)(void *arg, bt_build_phase phase, unsigned int attempt, double percent);
+	void *progress_arg;
+	double hash_table_slack; // Extra Hash Table slots per key left free for bt_insert_*(), 0 for none.
+	/*
+	 * Up to stash_buckets buckets go to a stash instead of failing the
+	 * attempt, once they clash or BT_STASH_TRIES offsets did not fit.
+	 * 0 disables the stash, as does a NULL stash_ptr.
+	 */
+	unsigned int stash_buckets;
+	bt_stash **stash_ptr; // Returns a pointer to the stash, NULL if nothing was stashed.
+	/*
+	 * Keys that are not uniformly random, such as sequential IDs or truncated
+	 * hashes, skew the buckets. With premix set, the keys are mixed with
+	 * bt_premix_keys() for the build and mixed back afterwards, and the Hash
+	 * Table holds them mixed. Set bt_table.premix for the lookups to match.
+	 */
+	int premix;
+	/*
+	 * Keys expected to take most lookups, num_hot_keys of them in the format
+	 * of the loaded keys. Their buckets are placed first among those of their
+	 * size, under offsets that put the hot key within the first
+	 * BT_HOT_SLOTS_PER_KEY slots per hot key of the Hash Table where one fits,
+	 * so that the Hash Table accesses of hot lookups stay within a small,
+	 * cache resident range. Leave both zero for none; bt_live and bt_lsm keep
+	 * the options for their later builds, so the keys must outlive those.
+	 */
+	const void *hot_keys;
+	unsigned int num_hot_keys;
+} bt_build_options;
+
+#define BT_STASH_TRIES 0x10000
+#define BT_HOT_SLOTS_PER_KEY 2
+
+/*
+ * Describes a built table for use with the lookup functions below. Modulo
+ * constants for both table sizes are precomputed by bt_table_init().
+ */
+typedef struct {
+	int hash_type;
+	unsigned int *hash_table;
+	OFFSET_TABLE_WORD *offset_table;
+	unsigned int offset_table_size;
+	unsigned int hash_table_size;
+	uint64_t shift64_ot_sz, shift128_ot_sz;
+	uint64_t shift64_ht_sz, shift128_ht_sz;
+	uint64_t fastmod_ot[2], fastmod_ht[2]; // 2^128 / size + 1, low word first.
+	bt_bloom_filter *bloom_filter; // Optional, NULL when absent.
+	bt_stash *stash; // Optional, NULL when absent.
+	int premix; // Lookups mix keys as bt_premix_keys() does, 0 by default.
+} bt_table;
 
 /*
  * Function to build a Perfect Hash Table from an array of hashes.
  * Warning: loaded_hashes_ptr must be of type 'uint64_t *' for hashes <= 64bit
  * 'uint128_t *' for hashes <= 128bit and
- * 'uint192_t *' for hashes <=192bit.
+ * 'uint192_t *' for hashes <=192bit, or packed keys of htype / 32 unsigned ints
+ * for any other multiple of 32 bits up to BT_MAX_HASH_BITS.
  */
-extern unsigned int create_perfect_hash_table(int htype, // Hash type, currenty supported upto 192 bit hashes.
+extern unsigned int create_perfect_hash_table(int htype, // Hash type, 64, 128, 192 or a packed hash type.
 			       void *loaded_hashes_ptr, // Pass a pointer to an array containing hashes of type uint128_t or uint192_t.
 			       unsigned int num_ld_hashes, // Pass number of hashes in stored in the array.
 			       OFFSET_TABLE_WORD **offset_table_ptr, // Returns a pointer to the Offset Table.
 			       unsigned int *offset_table_sz_ptr, // Returns the size of Offset Table.
 			       unsigned int *hash_table_sz_ptr, // Returns the size of Hash Table.
-			       unsigned int verb); // Set verbosity, 0, 1, 2, 3 or greater.
\ No newline at end of file
+			       unsigned int verb); // Set verbosity, 0, 1, 2, 3 or greater.
+
+/* Same as above, with optional build parameters. */
+extern unsigned int create_perfect_hash_table_opt(int htype,
+			       void *loaded_hashes_ptr,
+			       unsigned int num_ld_hashes,
+			       OFFSET_TABLE_WORD **offset_table_ptr,
+			       unsigned int *offset_table_sz_ptr,
+			       unsigned int *hash_table_sz_ptr,
+			       const bt_build_options *opts, // May be NULL.
+			       unsigned int verb);
+
+/* CLOCK_MONOTONIC in seconds, the clock of bt_build_options.deadline. */
+extern double bt_monotonic_seconds(void);
+
+/*
+ * Fills in *result with the parameters create_perfect_hash_table_opt() starts
+ * from. Returns 1 if no table fits the budget, *result then holds the smallest.
+ */
+extern int bt_tune_parameters(int htype, const void *hashes, unsigned int num_hashes,
+			      bt_tune_target target, unsigned long long memory_budget_in_bytes,
+			      bt_tune_result *result);
+
+extern void bt_table_init(bt_table *table, int htype, unsigned int *hash_table,
+			  OFFSET_TABLE_WORD *offset_table, unsigned int offset_table_size,
+			  unsigned int hash_table_size);
+
+/*
+ * Bijective mixing of num_keys keys in place, word by word: 64 bit words with
+ * the splitmix64 finalizer, a last odd 32 bit word of a packed key with the
+ * lowbias32 one. Both map 0 to 0, so an all zero key stays empty.
+ * bt_unmix_keys() inverts it, e.g. to read keys back from the Hash Table of a
+ * premixed table.
+ */
+extern void bt_premix_keys(int htype, void *keys, unsigned int num_keys);
+extern void bt_unmix_keys(int htype, void *keys, unsigned int num_keys);
+
+/*
+ * Single key lookups, return the Hash Table index of the hash or BT_NOT_FOUND;
+ * hash_table_size + i for the i-th key of the stash. An all zero hash marks an
+ * empty slot and is never found.
+ */
+extern unsigned int bt_lookup_64(const bt_table *table, uint64_t hash);
+extern unsigned int bt_lookup_128(const bt_table *table, uint128_t hash);
+extern unsigned int bt_lookup_192(const bt_table *table, uint192_t hash);
+extern unsigned int bt_lookup_n(const bt_table *table, const unsigned int *hash);
+
+/*
+ * Batched lookups with software prefetching. Bit i of hit_bitmap is set when
+ * hashes[i] is present, hit_bitmap must hold (num_hashes + 63) / 64 words.
+ * Returns the number of hits.
+ */
+extern unsigned int bt_lookup_batch_64(const bt_table *table, const uint64_t *hashes, unsigned int num_hashes, uint64_t *hit_bitmap);
+extern unsigned int bt_lookup_batch_128(const bt_table *table, const uint128_t *hashes, unsigned int num_hashes, uint64_t *hit_bitmap);
+extern unsigned int bt_lookup_batch_192(const bt_table *table, const uint192_t *hashes, unsigned int num_hashes, uint64_t *hit_bitmap);
+extern unsigned int bt_lookup_batch_n(const bt_table *table, const unsigned int *hashes, unsigned int num_hashes, uint64_t *hit_bitmap);
+
+/*
+ * Same as bt_lookup_batch_64(), using an AVX-512 or AVX2 gather kernel when the
+ * CPU supports one. Tables with a Bloom filter, a stash or premixed keys use the
+ * scalar batched path.
+ */
+extern unsigned int bt_lookup_simd_64(const bt_table *table, const uint64_t *hashes, unsigned int num_hashes, uint64_t *hit_bitmap);
+/* Returns the name of the kernel bt_lookup_simd_64() dispatches to. */
+extern const char *bt_lookup_simd_kernel(void);
+
+/*
+ * Bulk probe of a large array of hashes, split across OpenMP threads, each
+ * running the batched lookup over its share. Pass hit_bitmap ((num_hashes + 63)
+ * / 64 words) to receive a bit per hash, and/or matches to receive the positions
+ * of the hashes found, in increasing order; matches must have room for all hits.
+ * Either may be NULL. Returns the number of hits.
+ */
+extern unsigned int bt_probe_array_64(const bt_table *table, const uint64_t *hashes, unsigned int num_hashes, uint64_t *hit_bitmap, unsigned int *matches);
+extern unsigned int bt_probe_array_128(const bt_table *table, const uint128_t *hashes, unsigned int num_hashes, uint64_t *hit_bitmap, unsigned int *matches);
+extern unsigned int bt_probe_array_192(const bt_table *table, const uint192_t *hashes, unsigned int num_hashes, uint64_t *hit_bitmap, unsigned int *matches);
+
+/*
+ * Looks up a hash in up to 64 tables of the same hash type at once. All Offset
+ * Table entries are prefetched before any is read, then all Hash Table entries,
+ * so the latency is close to that of a single lookup. Bit j of the result is set
+ * when tables[j] contains the hash.
+ */
+#define BT_MAX_PROBE_TABLES 64
+
+extern uint64_t bt_probe_tables_64(const bt_table *const *tables, unsigned int num_tables, uint64_t hash);
+extern uint64_t bt_probe_tables_128(const bt_table *const *tables, unsigned int num_tables, uint128_t hash);
+extern uint64_t bt_probe_tables_192(const bt_table *const *tables, unsigned int num_tables, uint192_t hash);
+
+/* Batched version of the above, masks[i] receives the result for hashes[i]. */
+extern void bt_probe_tables_batch_64(const bt_table *const *tables, unsigned int num_tables, const uint64_t *hashes, unsigned int num_hashes, uint64_t *masks);
+extern void bt_probe_tables_batch_128(const bt_table *const *tables, unsigned int num_tables, const uint128_t *hashes, unsigned int num_hashes, uint64_t *masks);
+extern void bt_probe_tables_batch_192(const bt_table *const *tables, unsigned int num_tables, const uint192_t *hashes, unsigned int num_hashes, uint64_t *masks);
+
+/*
+ * Interleaved lookups for callers that produce one hash at a time. Up to
+ * num_slots lookups are kept in flight, each is suspended after prefetching its
+ * Bloom filter block, Offset Table entry and Hash Table entries, and resumed
+ * when the scheduler comes back around to its slot. Results are delivered to
+ * the callback as a Hash Table index or BT_NOT_FOUND, possibly during a later
+ * submit; call bt_sched_drain() to complete everything still in flight.
+ * Callbacks must not submit to the scheduler that invoked them.
+ */
+typedef void (*bt_lookup_callback)(void *user_data, unsigned int result);
+
+typedef struct {
+	union {
+		uint64_t h64;
+		uint128_t h128;
+		uint192_t h192;
+	} hash;
+	uint64_t digest;
+	unsigned int idx;
+	unsigned int stage;
+	bt_lookup_callback callback;
+	void *user_data;
+} bt_lookup_task;
+
+typedef struct {
+	const bt_table *table;
+	bt_lookup_task *tasks;
+	unsigned int num_slots;
+	unsigned int next;
+	unsigned int in_flight;
+} bt_lookup_sched;
+
+extern void bt_sched_init(bt_lookup_sched *sched, const bt_table *table, unsigned int num_slots);
+extern void bt_sched_submit_64(bt_lookup_sched *sched, uint64_t hash, bt_lookup_callback callback, void *user_data);
+extern void bt_sched_submit_128(bt_lookup_sched *sched, uint128_t hash, bt_lookup_callback callback, void *user_data);
+extern void bt_sched_submit_192(bt_lookup_sched *sched, uint192_t hash, bt_lookup_callback callback, void *user_data);
+extern void bt_sched_drain(bt_lookup_sched *sched);
+extern void bt_sched_free(bt_lookup_sched *sched);
+
+extern void bt_bloom_free(bt_bloom_filter **filter_ptr);
+extern void bt_stash_free(bt_stash **stash_ptr);
+
+/*
+ * Saves a built table, with its Bloom filter and stash if any, so that it can be loaded
+ * without a rebuild. The file is in native byte order. bt_table_load() allocates
+ * the tables, release them with bt_table_free(). Both return 0 on success.
+ */
+extern int bt_table_save(const bt_table *table, const char *filename);
+extern int bt_table_load(bt_table *table, const char *filename);
+extern void bt_table_free(bt_table *table);
+
+/*
+ * Hex hash lists as read by demo.c: whitespace separated hex, 8 digits per 32
+ * bit word, least significant word first, normally one hash per line; 2, 4 and
+ * 5 words (160 bits) for 64, 128 and 192 bit hashes, htype / 32 for packed hash
+ * types. Parsing gives exactly the hashes of demo.c's former fscanf() loaders
+ * for any input.
+ *
+ * bt_hex_load() maps a hash list file and parses it in parallel. bt_hex_parse()
+ * parses buf in parallel. Both allocate *keys_ptr, an array of uint64_t,
+ * uint128_t, uint192_t or packed keys as per htype, and return the number of
+ * hashes. bt_hex_format() writes one hash as a line and returns its length, at
+ * most BT_MAX_HASH_BITS / 4 + 1 characters; 192 bit hashes wider than 160 bits
+ * get 6 words.
+ */
+extern unsigned int bt_hex_load(int htype, const char *filename, void **keys_ptr, unsigned int verbosity);
+extern unsigned int bt_hex_parse(int htype, const char *buf, size_t len, void **keys_ptr);
+extern unsigned int bt_hex_format(int htype, const void *hash, char *out);
+
+/*
+ * Binary key lists: a BT_KEY_FILE_HEADER_SIZE byte header holding the hash type
+ * and key count, followed by the keys as raw little endian uint64_t, uint128_t,
+ * uint192_t or packed keys, htype / 8 bytes each. bt_keys_map() maps such a file privately, so kf.keys can be
+ * passed to create_perfect_hash_table() as the array of loaded hashes without
+ * a parse step; the builder's in place changes never reach the file. Returns
+ * 0 on success, non zero if the file is missing or not a key list.
+ *
+ * A bt_key_writer appends keys in chunks to a new file, or to an existing one
+ * of the same type with append set. The key count in the header is updated by
+ * bt_keys_writer_close(). All return 0 on success.
+ */
+#define BT_KEY_FILE_HEADER_SIZE 64
+
+typedef struct {
+	int hash_type;
+	unsigned int num_keys;
+	void *keys;
+	void *map;
+	size_t map_size;
+} bt_key_file;
+
+typedef struct {
+	FILE *fp;
+	int hash_type;
+	uint64_t num_keys;
+} bt_key_writer;
+
+extern int bt_keys_map(bt_key_file *kf, const char *filename);
+extern void bt_keys_unmap(bt_key_file *kf);
+/* Checks a key file header at the start of buf. */
+extern int bt_keys_header(const void *buf, size_t len, int *htype_ptr, uint64_t *num_keys_ptr);
+extern int bt_keys_writer_open(bt_key_writer *w, const char *filename, int htype, int append);
+extern int bt_keys_writer_append(bt_key_writer *w, const void *keys, unsigned int num_keys);
+extern int bt_keys_writer_close(bt_key_writer *w);
+
+/*
+ * Hardware counters around a measured region, read with perf_event_open on
+ * Linux. bt_perf_open() counts the calling thread and the threads it creates
+ * afterwards, so open before the first OpenMP region to include the pool
+ * threads. Counters the kernel or the CPU does not provide stay unavailable
+ * and the others still work; it returns the number of available counters.
+ * bt_perf_stop() stores the counts since bt_perf_start(), scaled up if the
+ * kernel had to multiplex them.
+ */
+enum {
+	BT_PERF_CYCLES,
+	BT_PERF_INSTRUCTIONS,
+	BT_PERF_LLC_MISSES,
+	BT_PERF_DTLB_MISSES,
+	BT_PERF_BRANCH_MISSES,
+	BT_PERF_NUM_COUNTERS
+};
+
+typedef struct {
+	int fd[BT_PERF_NUM_COUNTERS]; // -1 if unavailable.
+	uint64_t value[BT_PERF_NUM_COUNTERS];
+} bt_perf_counters;
+
+extern const char *const bt_perf_names[BT_PERF_NUM_COUNTERS];
+extern int bt_perf_open(bt_perf_counters *pc);
+extern void bt_perf_start(bt_perf_counters *pc);
+extern void bt_perf_stop(bt_perf_counters *pc);
+extern void bt_perf_close(bt_perf_counters *pc);
+
+/*
+ * Lookup telemetry, compiled in when the library is built with -DBT_TELEMETRY
+ * and absent from the lookup paths otherwise. Each thread counts into its own
+ * cache line aligned slot, and times one in sample_period of its lookups with
+ * the time stamp counter (clock_gettime nanoseconds off x86). Bucket k of a
+ * histogram counts samples of [2^k, 2^(k+1)) ticks, bucket 0 includes 0.
+ * Single lookups and batched lookups, including bt_lookup_simd_64() and
+ * bt_probe_array_*(), are counted; a sampled batch records its ticks per key.
+ * The multi-table probe and the scheduler are not instrumented.
+ *
+ * bt_telemetry_configure() returns 1 if telemetry is not compiled in. It is
+ * active by default, sampling one in 1024 lookups. bt_telemetry_snapshot()
+ * sums all slots; it may run concurrently with lookups, which are then
+ * partially included. Threads beyond BT_TELEMETRY_MAX_THREADS are not counted.
+ */
+#define BT_TELEMETRY_BUCKETS 48
+#define BT_TELEMETRY_MAX_THREADS 256
+
+typedef struct {
+	uint64_t lookups, hits; // Single lookups.
+	uint64_t batch_calls, batch_lookups, batch_hits;
+	uint64_t samples, batch_samples;
+	uint64_t latency[BT_TELEMETRY_BUCKETS]; // Ticks per single lookup.
+	uint64_t batch_latency[BT_TELEMETRY_BUCKETS]; // Ticks per key of a batch.
+	unsigned int threads; // Slots in use.
+} bt_telemetry;
+
+extern int bt_telemetry_configure(int active, unsigned int sample_period);
+extern void bt_telemetry_snapshot(bt_telemetry *t);
+extern void bt_telemetry_reset(void);
+/* Upper bound in ticks of the bucket holding the p-th percentile, 0 < p <= 100. */
+extern uint64_t bt_telemetry_percentile(const uint64_t *histogram, double p);
+
+/*
+ * Query traces: the keys an application looks up, with their timing, for
+ * replay against a table offline. bt_qtrace_record() is called next to the
+ * lookups it samples; it keeps one in sample_period of the calls made by
+ * each thread and may be called from several threads. Records hold the
+ * nanoseconds since the previous record as a LEB128 varint followed by the
+ * raw key, after a BT_QTRACE_HEADER_SIZE byte header. bt_qtrace_load() reads
+ * a trace back, also one whose writer did not get to close it. All return 0
+ * on success.
+ */
+#define BT_QTRACE_HEADER_SIZE 64
+
+typedef struct {
+	FILE *fp;
+	int hash_type;
+	unsigned int sample_period;
+	uint64_t num_records;
+	uint64_t last_ns; // Time of the previous record.
+	unsigned char *buf;
+	size_t buf_len;
+	int error;
+	pthread_mutex_t lock;
+} bt_qtrace_writer;
+
+typedef struct {
+	int hash_type;
+	unsigned int sample_period;
+	uint64_t num_records;
+	uint64_t start_time; // Wall clock of bt_qtrace_open() in ns since the epoch.
+	void *keys; // num_records keys of hash_type.
+	uint64_t *time_ns; // Time of each record since the first.
+} bt_qtrace;
+
+extern int bt_qtrace_open(bt_qtrace_writer *w, const char *filename, int htype, unsigned int sample_period);
+extern void bt_qtrace_record(bt_qtrace_writer *w, const void *hash);
+extern int bt_qtrace_close(bt_qtrace_writer *w);
+extern int bt_qtrace_load(bt_qtrace *t, const char *filename);
+extern void bt_qtrace_free(bt_qtrace *t);
+
+/*
+ * A table rebuilt in the background and swapped under running readers. Every
+ * reader thread takes a slot once with bt_live_reader() and brackets its
+ * lookups with bt_live_enter() and bt_live_exit(), which announce the reader
+ * with a store and a fence and take no lock; entering once per batch of
+ * lookups keeps that cost off each lookup. The table returned by
+ * bt_live_enter() stays valid until the matching bt_live_exit().
+ *
+ * bt_live_build_async() builds a table from keys on a background thread and
+ * publishes it atomically. The builder removes duplicates in place, so keys
+ * must stay untouched until bt_live_wait() returns or the next build starts.
+ * A build still running when the next one starts is cancelled. A replaced
+ * table is freed once every reader that may still use it has left. Builds are
+ * serialized across all bt_live instances of a process. bt_live_build_async(),
+ * bt_live_wait() and bt_live_destroy() are called from one controlling thread.
+ */
+#define BT_LIVE_MAX_READERS 256
+
+typedef struct {
+	uint64_t epoch; // 0 outside, else the epoch seen by bt_live_enter().
+	char pad[56];
+} bt_live_slot;
+
+typedef struct {
+	bt_table *current; // NULL until the first table is published.
+	uint64_t epoch;
+	unsigned int num_readers;
+	bt_live_slot *slots; // BT_LIVE_MAX_READERS, cache line aligned.
+	pthread_mutex_t publish_lock;
+	pthread_t builder;
+	int building; // builder is to be joined.
+	int cancel;
+	int status; // 0 if the last build published its table.
+	int hash_type;
+	void *keys;
+	unsigned int num_keys;
+	bt_build_options opts;
+	bt_build_stats stats; // Of the last build.
+} bt_live;
+
+extern int bt_live_init(bt_live *live);
+extern void bt_live_destroy(bt_live *live); // No reader may be inside.
+extern int bt_live_reader(bt_live *live); // Returns a slot, -1 if all are taken.
+extern const bt_table *bt_live_enter(bt_live *live, int reader); // NULL before the first table.
+extern void bt_live_exit(bt_live *live, int reader);
+
+/* Swaps in table, allocated with malloc() and released with bt_table_free() and free(). */
+extern void bt_live_publish(bt_live *live, bt_table *table);
+
+/* opts may be NULL, its stats, cancel and bloom_filter_ptr are replaced. Returns 0 if started. */
+extern int bt_live_build_async(bt_live *live, int htype, void *keys, unsigned int num_keys,
+			       const bt_build_options *opts);
+
+/* Waits for the running build, if any. Returns 0 if it published its table. */
+extern int bt_live_wait(bt_live *live, bt_build_stats *stats);
+
+/*
+ * Inserts and deletes on a built table. A new key whose slot is free is simply
+ * stored there; otherwise its bucket is placed again, with the new key, under
+ * an offset that maps every key of the bucket to a free slot, and the other
+ * keys of that bucket move to new indexes. Deletes clear the slot. Free slots
+ * come from bt_build_options.hash_table_slack: with a fraction e of the Hash
+ * Table free, a bucket of k keys fits under an offset with probability about
+ * e^(k - 1), so keep the slack well above the expected growth. Inserts return
+ * BT_INSERT_FULL once the table has no free slot or no offset fits within
+ * BT_UPDATE_MAX_OFFSETS tries, rebuild the table with all keys then. Keys of
+ * a stashed bucket are inserted into and deleted from the stash.
+ *
+ * bt_update_init() indexes the keys of every bucket, 4 bytes per Offset Table
+ * and Hash Table slot. The table is changed in place, so no lookup may run on
+ * it concurrently; keep a copy for readers, or swap rebuilt tables with
+ * bt_live. New keys are added to the Bloom filter, deleted keys stay in it.
+ * An all zero hash is ignored, as by the builder.
+ */
+#define BT_UPDATE_MAX_BUCKET 32
+#define BT_UPDATE_MAX_OFFSETS (1U << 20)
+
+#define BT_INSERT_OK 0
+#define BT_INSERT_FULL 1
+
+typedef struct {
+	bt_table *table;
+	unsigned int *bucket_head; // First Hash Table slot of every bucket, BT_NOT_FOUND if empty.
+	unsigned int *next_slot; // Next slot of the same bucket, for every Hash Table slot.
+	unsigned int num_keys; // In the Hash Table, not counting the stash.
+	unsigned long long inserts, deletes;
+	unsigned long long moved_buckets; // Buckets placed again by inserts.
+	unsigned long long offsets_tried; // By those placements.
+} bt_update;
+
+extern void bt_update_init(bt_update *u, bt_table *table);
+extern void bt_update_free(bt_update *u);
+
+/* Return BT_INSERT_OK if the hash is in the table afterwards. */
+extern int bt_insert_64(bt_update *u, uint64_t hash);
+extern int bt_insert_128(bt_update *u, uint128_t hash);
+extern int bt_insert_192(bt_update *u, uint192_t hash);
+
+/* Return the Hash Table index cleared, BT_NOT_FOUND if the hash was absent. */
+extern unsigned int bt_delete_64(bt_update *u, uint64_t hash);
+extern unsigned int bt_delete_128(bt_update *u, uint128_t hash);
+extern unsigned int bt_delete_192(bt_update *u, uint192_t hash);
+
+/*
+ * Log structured levels for a high insert rate. New keys go to a mutable hash
+ * set; when it holds memtable_keys keys it is frozen and merged in the
+ * background, together with the newest levels, into a perfect hash table
+ * built with create_perfect_hash_table_opt(). Levels are size tiered: fanout
+ * levels of one tier are merged into one of the next, so every key is rebuilt
+ * about log_fanout(keys / memtable_keys) times and at most fanout - 1 levels
+ * per tier are kept, BT_LSM_MAX_LEVELS in all. Lookups check the
+ * mutable set, the frozen set and then all levels at once with
+ * bt_probe_tables_*(), so a lookup costs about one probe of each set plus one
+ * table lookup.
+ *
+ * Lookups may run on many threads, but not alongside bt_lsm_insert_*(),
+ * bt_lsm_flush() or bt_lsm_destroy(), which install finished merges; guard
+ * them with a readers-writer lock when threads share a bt_lsm. An insert that
+ * fills the mutable set while a merge is still running waits for the merge.
+ */
+#define BT_LSM_MAX_LEVELS 32
+
+typedef struct {
+	void *keys; // Open addressing on the low 64 bits, an all zero key marks a free slot.
+	unsigned int size; // Power of 2.
+	unsigned int count;
+} bt_lsm_set;
+
+typedef struct {
+	int hash_type;
+	unsigned int memtable_keys;
+	unsigned int fanout;
+	bt_lsm_set memtable;
+	bt_lsm_set frozen; // Being merged, empty when no merge is pending.
+	bt_table *levels[BT_LSM_MAX_LEVELS]; // Newest first.
+	unsigned int level_keys[BT_LSM_MAX_LEVELS];
+	unsigned int num_levels;
+	pthread_t merger;
+	int merging; // merger is to be joined.
+	int merge_done;
+	unsigned int merge_levels; // levels[0 .. merge_levels - 1] are merged with frozen.
+	bt_table *merged; // NULL if the merge failed.
+	unsigned int merged_keys;
+	bt_build_options opts;
+	bt_build_stats stats; // Of the last merge.
+	unsigned long long merges, stalls;
+	double stall_seconds; // Inserts waiting for a merge.
+} bt_lsm;
+
+/* opts may be NULL, its stats, cancel and bloom_filter_ptr are replaced. */
+extern void bt_lsm_init(bt_lsm *lsm, int htype, unsigned int memtable_keys, unsigned int fanout,
+			const bt_build_options *opts);
+extern void bt_lsm_destroy(bt_lsm *lsm);
+
+extern void bt_lsm_insert_64(bt_lsm *lsm, uint64_t hash);
+extern void bt_lsm_insert_128(bt_lsm *lsm, uint128_t hash);
+extern void bt_lsm_insert_192(bt_lsm *lsm, uint192_t hash);
+
+/* Merges the mutable set too and waits until no merge is left. */
+extern void bt_lsm_flush(bt_lsm *lsm);
+
+/* Return 1 if the hash was inserted. */
+extern int bt_lsm_lookup_64(const bt_lsm *lsm, uint64_t hash);
+extern int bt_lsm_lookup_128(const bt_lsm *lsm, uint128_t hash);
+extern int bt_lsm_lookup_192(const bt_lsm *lsm, uint192_t hash);
+
+/* Fill in hit_bitmap like bt_lookup_batch_*() and return the number of hits. */
+extern unsigned int bt_lsm_lookup_batch_64(const bt_lsm *lsm, const uint64_t *hashes, unsigned int num_hashes, uint64_t *hit_bitmap);
+extern unsigned int bt_lsm_lookup_batch_128(const bt_lsm *lsm, const uint128_t *hashes, unsigned int num_hashes, uint64_t *hit_bitmap);
+extern unsigned int bt_lsm_lookup_batch_192(const bt_lsm *lsm, const uint192_t *hashes, unsigned int num_hashes, uint64_t *hit_bitmap);
+
+/*
+ * String keys. Every string is hashed with bt_hash_string(), a seeded 128 bit
+ * hash, and the table is built on the low 64 bits or all 128 bits of the
+ * hashes, as hash_type says. A string list is one blob: string i is
+ * blob[offsets[i] .. offsets[i + 1]), offsets holds num_strings + 1 entries.
+ *
+ * Without verification a string that was not inserted is reported present
+ * with a probability of about num_strings / 2^hash_type. With verify set the
+ * strings are copied into a blob in Hash Table slot order (8 bytes per slot
+ * plus the strings) and every hit is compared against its string, so the
+ * lookups are exact; if two strings share a hash the build retries with the
+ * next seed, up to BT_STRING_MAX_SEEDS times.
+ */
+#define BT_STRING_MAX_SEEDS 4
+
+typedef struct {
+	int hash_type; // 64 or 128.
+	uint64_t seed;
+	bt_table *table;
+	char *blob; // NULL without verification.
+	uint64_t *offsets; // hash_table_size + 1 entries, slot i holds blob[offsets[i] .. offsets[i + 1]).
+} bt_string_table;
+
+typedef struct {
+	char *blob;
+	uint64_t *offsets;
+	unsigned int num_strings;
+} bt_string_list;
+
+extern uint128_t bt_hash_string(const void *key, size_t len, uint64_t seed);
+
+/*
+ * opts may be NULL. With verify, stash_buckets is ignored: the strings are kept
+ * by Hash Table slot and a stashed one has none. Returns 0 on success.
+ */
+extern int bt_string_table_build(bt_string_table *st, int htype, const char *blob, const uint64_t *offsets,
+				 unsigned int num_strings, uint64_t seed, int verify, bt_build_options *opts);
+extern void bt_string_table_free(bt_string_table *st);
+
+/* Returns 1 if the string is in the table. */
+extern int bt_string_lookup(const bt_string_table *st, const void *key, size_t len);
+/* Fills in hit_bitmap like bt_lookup_batch_*() and returns the number of hits. */
+extern unsigned int bt_string_lookup_batch(const bt_string_table *st, const char *blob, const uint64_t *offsets,
+					   unsigned int num_strings, uint64_t *hit_bitmap);
+
+/*
+ * Reads a file of one string per line, without the line ends ("\n" or
+ * "\r\n"), into a string list. Returns 0 on success.
+ */
+extern int bt_string_list_load(bt_string_list *list, const char *filename);
+extern void bt_string_list_free(bt_string_list *list);
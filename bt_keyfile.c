@@ -0,0 +1,157 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+/*
+ * Binary key lists: a BT_KEY_FILE_HEADER_SIZE byte header followed by the
+ * keys as little endian 64 bit words, LO64 before HI64 and LO, MI, HI for the
+ * wider types, which is the memory layout of the key arrays on the little
+ * endian hosts this code targets. The header size keeps the keys 64 byte
+ * aligned in a mapping.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bt_hash_types.h"
+
+#define KEY_FILE_MAGIC "BTKEYS01"
+
+typedef struct {
+	char magic[8];
+	uint32_t hash_type;
+	uint32_t header_size;
+	uint64_t num_keys;
+	unsigned char reserved[BT_KEY_FILE_HEADER_SIZE - 24];
+} key_file_header;
+
+static size_t key_size(int htype)
+{
+	return htype / 8;
+}
+
+int bt_keys_header(const void *buf, size_t len, int *htype_ptr, uint64_t *num_keys_ptr)
+{
+	const key_file_header *header = buf;
+
+	if (len < sizeof(key_file_header) || memcmp(header -> magic, KEY_FILE_MAGIC, 8) ||
+	    header -> header_size != BT_KEY_FILE_HEADER_SIZE ||
+	    !BT_VALID_HASH_TYPE(header -> hash_type))
+		return 1;
+
+	*htype_ptr = header -> hash_type;
+	*num_keys_ptr = header -> num_keys;
+	return 0;
+}
+
+int bt_keys_map(bt_key_file *kf, const char *filename)
+{
+	key_file_header header;
+	struct stat st;
+	uint64_t num_keys;
+	int fd;
+
+	kf -> map = kf -> keys = NULL;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return 1;
+	if (fstat(fd, &st) || read(fd, &header, sizeof(header)) != sizeof(header) ||
+	    bt_keys_header(&header, sizeof(header), &kf -> hash_type, &num_keys) ||
+	    num_keys > (st.st_size - BT_KEY_FILE_HEADER_SIZE) / key_size(kf -> hash_type) ||
+	    num_keys > 0xffffffff) {
+		close(fd);
+		return 1;
+	}
+
+	kf -> map_size = st.st_size;
+	kf -> map = mmap(NULL, kf -> map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (kf -> map == MAP_FAILED) {
+		kf -> map = NULL;
+		return 1;
+	}
+
+	kf -> num_keys = (unsigned int)num_keys;
+	kf -> keys = (char *)kf -> map + BT_KEY_FILE_HEADER_SIZE;
+	madvise(kf -> map, kf -> map_size, MADV_WILLNEED);
+
+	return 0;
+}
+
+void bt_keys_unmap(bt_key_file *kf)
+{
+	munmap(kf -> map, kf -> map_size);
+	kf -> map = kf -> keys = NULL;
+	kf -> num_keys = 0;
+}
+
+static int write_header(bt_key_writer *w)
+{
+	key_file_header header;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, KEY_FILE_MAGIC, 8);
+	header.hash_type = w -> hash_type;
+	header.header_size = BT_KEY_FILE_HEADER_SIZE;
+	header.num_keys = w -> num_keys;
+
+	return fseeko(w -> fp, 0, SEEK_SET) || fwrite(&header, sizeof(header), 1, w -> fp) != 1;
+}
+
+int bt_keys_writer_open(bt_key_writer *w, const char *filename, int htype, int append)
+{
+	key_file_header header;
+	int file_htype;
+	uint64_t num_keys;
+
+	w -> hash_type = htype;
+	w -> num_keys = 0;
+
+	if (append && (w -> fp = fopen(filename, "r+b"))) {
+		if (fread(&header, sizeof(header), 1, w -> fp) != 1 ||
+		    bt_keys_header(&header, sizeof(header), &file_htype, &num_keys) || file_htype != htype) {
+			fclose(w -> fp);
+			return 1;
+		}
+		w -> num_keys = num_keys;
+		if (fseeko(w -> fp, BT_KEY_FILE_HEADER_SIZE + num_keys * key_size(htype), SEEK_SET)) {
+			fclose(w -> fp);
+			return 1;
+		}
+		return 0;
+	}
+
+	w -> fp = fopen(filename, "w+b");
+	if (w -> fp == NULL)
+		return 1;
+	if (write_header(w)) {
+		fclose(w -> fp);
+		return 1;
+	}
+	return 0;
+}
+
+int bt_keys_writer_append(bt_key_writer *w, const void *keys, unsigned int num_keys)
+{
+	if (fwrite(keys, key_size(w -> hash_type), num_keys, w -> fp) != num_keys)
+		return 1;
+	w -> num_keys += num_keys;
+	return 0;
+}
+
+int bt_keys_writer_close(bt_key_writer *w)
+{
+	int ret = write_header(w);
+
+	if (fclose(w -> fp))
+		ret = 1;
+	w -> fp = NULL;
+	return ret;
+}
@@ -0,0 +1,160 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+/*
+ * Epoch based reclamation. A reader stores the current epoch in its slot,
+ * fences, then loads the table pointer. The publisher exchanges the pointer,
+ * advances the epoch and waits until every slot is either empty or holds the
+ * new epoch: a reader announced before the exchange is waited for, and one
+ * announced after it loads the new table, so the old table can be freed.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bt_hash_types.h"
+
+#define GRACE_POLL_NS 50000
+
+int bt_live_init(bt_live *live)
+{
+	memset(live, 0, sizeof(bt_live));
+	if (bt_memalign_alloc((void **)&live -> slots, 64, BT_LIVE_MAX_READERS * sizeof(bt_live_slot)))
+		return 1;
+	memset(live -> slots, 0, BT_LIVE_MAX_READERS * sizeof(bt_live_slot));
+	if (pthread_mutex_init(&live -> publish_lock, NULL)) {
+		bt_free((void **)&live -> slots);
+		return 1;
+	}
+	live -> epoch = 1;
+	live -> status = 1;
+	return 0;
+}
+
+int bt_live_reader(bt_live *live)
+{
+	unsigned int slot = __atomic_fetch_add(&live -> num_readers, 1, __ATOMIC_ACQ_REL);
+
+	return slot < BT_LIVE_MAX_READERS ? (int)slot : -1;
+}
+
+const bt_table *bt_live_enter(bt_live *live, int reader)
+{
+	__atomic_store_n(&live -> slots[reader].epoch, __atomic_load_n(&live -> epoch, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return __atomic_load_n(&live -> current, __ATOMIC_ACQUIRE);
+}
+
+void bt_live_exit(bt_live *live, int reader)
+{
+	__atomic_store_n(&live -> slots[reader].epoch, 0, __ATOMIC_RELEASE);
+}
+
+/* Waits until no reader can still hold a table replaced before the call. */
+static void synchronize(bt_live *live)
+{
+	uint64_t epoch = __atomic_add_fetch(&live -> epoch, 1, __ATOMIC_SEQ_CST);
+	unsigned int i, n = __atomic_load_n(&live -> num_readers, __ATOMIC_SEQ_CST);
+
+	if (n > BT_LIVE_MAX_READERS)
+		n = BT_LIVE_MAX_READERS;
+	for (i = 0; i < n; i++) {
+		uint64_t seen;
+
+		while ((seen = __atomic_load_n(&live -> slots[i].epoch, __ATOMIC_SEQ_CST)) && seen < epoch) {
+			struct timespec ts = {0, GRACE_POLL_NS};
+			nanosleep(&ts, NULL);
+		}
+	}
+}
+
+static void free_table(bt_table *table)
+{
+	bt_table_free(table);
+	bt_free((void **)&table);
+}
+
+void bt_live_publish(bt_live *live, bt_table *table)
+{
+	bt_table *old;
+
+	pthread_mutex_lock(&live -> publish_lock);
+	old = __atomic_exchange_n(&live -> current, table, __ATOMIC_SEQ_CST);
+	if (old)
+		synchronize(live);
+	pthread_mutex_unlock(&live -> publish_lock);
+
+	if (old)
+		free_table(old);
+}
+
+static void *build_thread(void *arg)
+{
+	bt_live *live = arg;
+	bt_table *table = bt_build_table(live -> hash_type, live -> keys, live -> num_keys, &live -> opts);
+
+	if (!table)
+		return NULL;
+	if (__atomic_load_n(&live -> cancel, __ATOMIC_RELAXED)) {
+		free_table(table);
+		return NULL;
+	}
+	bt_live_publish(live, table);
+	live -> status = 0;
+
+	return NULL;
+}
+
+int bt_live_build_async(bt_live *live, int htype, void *keys, unsigned int num_keys,
+			const bt_build_options *opts)
+{
+	if (live -> building) {
+		__atomic_store_n(&live -> cancel, 1, __ATOMIC_RELAXED);
+		bt_live_wait(live, NULL);
+	}
+
+	live -> cancel = 0;
+	live -> status = 1;
+	live -> hash_type = htype;
+	live -> keys = keys;
+	live -> num_keys = num_keys;
+	if (opts)
+		live -> opts = *opts;
+	else
+		memset(&live -> opts, 0, sizeof(bt_build_options));
+	live -> opts.stats = &live -> stats;
+	live -> opts.cancel = &live -> cancel;
+	memset(&live -> stats, 0, sizeof(bt_build_stats));
+
+	if (pthread_create(&live -> builder, NULL, build_thread, live))
+		return 1;
+	live -> building = 1;
+	return 0;
+}
+
+int bt_live_wait(bt_live *live, bt_build_stats *stats)
+{
+	if (live -> building) {
+		pthread_join(live -> builder, NULL);
+		live -> building = 0;
+	}
+	if (stats)
+		*stats = live -> stats;
+	return live -> status;
+}
+
+void bt_live_destroy(bt_live *live)
+{
+	if (live -> building) {
+		__atomic_store_n(&live -> cancel, 1, __ATOMIC_RELAXED);
+		bt_live_wait(live, NULL);
+	}
+	if (live -> current)
+		free_table(live -> current);
+	live -> current = NULL;
+	bt_free((void **)&live -> slots);
+	pthread_mutex_destroy(&live -> publish_lock);
+}
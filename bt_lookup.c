@@ -0,0 +1,161 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include "bt_hash_types.h"
+#include "bt_bloom.h"
+#include "bt_lookup.h"
+#include "bt_telemetry.h"
+
+static void fastmod_init(uint64_t *M, unsigned int N)
+{
+	unsigned __int128 m = ~(unsigned __int128)0 / N + 1;
+
+	M[0] = (uint64_t)m;
+	M[1] = (uint64_t)(m >> 64);
+}
+
+void bt_table_init(bt_table *table, int htype, unsigned int *hash_table,
+		   OFFSET_TABLE_WORD *offset_table, unsigned int offset_table_size,
+		   unsigned int hash_table_size)
+{
+	table -> hash_type = htype;
+	table -> hash_table = hash_table;
+	table -> offset_table = offset_table;
+	table -> offset_table_size = offset_table_size;
+	table -> hash_table_size = hash_table_size;
+	table -> bloom_filter = NULL;
+	table -> stash = NULL;
+	table -> premix = 0;
+
+	table -> shift64_ht_sz = (((1ULL << 63) % hash_table_size) * 2) % hash_table_size;
+	table -> shift64_ot_sz = (((1ULL << 63) % offset_table_size) * 2) % offset_table_size;
+	table -> shift128_ht_sz = (table -> shift64_ht_sz * table -> shift64_ht_sz) % hash_table_size;
+	table -> shift128_ot_sz = (table -> shift64_ot_sz * table -> shift64_ot_sz) % offset_table_size;
+
+	fastmod_init(table -> fastmod_ot, offset_table_size);
+	fastmod_init(table -> fastmod_ht, hash_table_size);
+}
+
+/*
+ * Lookups and batched lookups are identical for all hash types except for the
+ * helpers in bt_lookup.h, so they are generated from a single definition.
+ * HASH_T is what the helpers take, the public functions take hashes as ARG_T
+ * and arrays of ELEM_T, and key_##W() turns those into a HASH_T. ADDR makes
+ * a single ARG_T an array: & for 64, 128 and 192 bit hashes, nothing for
+ * packed ones, which are already passed as an array of words.
+ *
+ * The batched lookup works on chunks of BATCH_CHUNK hashes. With a Bloom
+ * filter, the chunk is first screened with the filter blocks prefetched
+ * BLOOM_DISTANCE hashes ahead, and only the positions that pass are probed.
+ * Probing then handles BATCH_GROUP positions per step: Offset Table entries
+ * are prefetched first, then the offsets are read and Hash Table entries
+ * prefetched, finally the entries are compared. Screening before probing
+ * keeps every probe group full, so a low hit rate does not starve the
+ * prefetcher of independent accesses.
+ */
+#define BATCH_CHUNK 256
+#define BATCH_GROUP 16
+#define BLOOM_DISTANCE 16
+
+#define DEFINE_LOOKUP(W, HASH_T, ARG_T, ELEM_T, ADDR)					\
+static inline unsigned int lookup_##W(const bt_table *table, HASH_T hash)		\
+{											\
+	unsigned int idx, offset;							\
+											\
+	if (is_zero_##W(hash))								\
+		return BT_NOT_FOUND;							\
+	if (table -> bloom_filter &&							\
+	    !bloom_query(table -> bloom_filter, bloom_digest_##W(hash)))		\
+		return BT_NOT_FOUND;							\
+											\
+	offset = (unsigned int)table -> offset_table[ot_idx_##W(table, hash)];	\
+	if (offset == BT_STASH_OFFSET)							\
+		return stash_idx_##W(table, hash);					\
+	idx = ht_idx_##W(table, hash, offset);						\
+	if (match_##W(table, idx, hash))						\
+		return idx;								\
+	return BT_NOT_FOUND;								\
+}											\
+											\
+unsigned int bt_lookup_##W(const bt_table *table, ARG_T hash)				\
+{											\
+	unsigned int idx;								\
+	TELEMETRY_DECLARE								\
+											\
+	TELEMETRY_BEGIN();								\
+	idx = lookup_##W(table, key_##W(table, ADDR hash, 0));			\
+	TELEMETRY_END(idx != BT_NOT_FOUND);						\
+	return idx;									\
+}											\
+											\
+unsigned int bt_lookup_batch_##W(const bt_table *table, const ELEM_T *hashes,		\
+				 unsigned int num_hashes, uint64_t *hit_bitmap)		\
+{											\
+	unsigned int pos[BATCH_CHUNK], idx[BATCH_GROUP], offset[BATCH_GROUP];		\
+	uint64_t digest[BATCH_CHUNK];							\
+	unsigned int base, i, j, n, num_pos, hits = 0;					\
+	const bt_bloom_filter *filter = table -> bloom_filter;				\
+	TELEMETRY_DECLARE								\
+											\
+	TELEMETRY_BEGIN_BATCH(num_hashes);						\
+	for (i = 0; i < (num_hashes + 63) / 64; i++)					\
+		hit_bitmap[i] = 0;							\
+											\
+	for (base = 0; base < num_hashes; base += BATCH_CHUNK) {			\
+		n = num_hashes - base < BATCH_CHUNK ? num_hashes - base : BATCH_CHUNK;	\
+		num_pos = 0;								\
+											\
+		if (filter) {								\
+			for (i = 0; i < n + BLOOM_DISTANCE; i++) {			\
+				if (i < n) {						\
+					digest[i] = bloom_digest_##W(key_##W(table, hashes, base + i)); \
+					PREFETCH(bloom_block(filter, digest[i]));	\
+				}							\
+				if (i >= BLOOM_DISTANCE) {				\
+					j = i - BLOOM_DISTANCE;				\
+					pos[num_pos] = base + j;			\
+					num_pos += bloom_query(filter, digest[j]);	\
+				}							\
+			}								\
+		}									\
+		else									\
+			for (i = 0; i < n; i++)						\
+				pos[num_pos++] = base + i;				\
+											\
+		for (j = 0; j < num_pos; j += BATCH_GROUP) {				\
+			unsigned int m = num_pos - j < BATCH_GROUP ? num_pos - j : BATCH_GROUP; \
+			const unsigned int *p = pos + j;				\
+											\
+			for (i = 0; i < m; i++) {					\
+				idx[i] = ot_idx_##W(table, key_##W(table, hashes, p[i])); \
+				PREFETCH(&table -> offset_table[idx[i]]);		\
+			}								\
+			for (i = 0; i < m; i++) {					\
+				offset[i] = (unsigned int)table -> offset_table[idx[i]]; \
+				idx[i] = ht_idx_##W(table, key_##W(table, hashes, p[i]), offset[i]); \
+				prefetch_ht_##W(table, idx[i]);				\
+			}								\
+			for (i = 0; i < m; i++)						\
+				if (!is_zero_##W(key_##W(table, hashes, p[i])) &&	\
+				    (offset[i] == BT_STASH_OFFSET ?			\
+				     stash_idx_##W(table, key_##W(table, hashes, p[i])) != BT_NOT_FOUND : \
+				     match_##W(table, idx[i], key_##W(table, hashes, p[i])))) { \
+					hit_bitmap[p[i] / 64] |= 1ULL << (p[i] % 64);	\
+					hits++;						\
+				}							\
+		}									\
+	}										\
+											\
+	TELEMETRY_END_BATCH(num_hashes, hits);						\
+	return hits;									\
+}
+
+DEFINE_LOOKUP(64, uint64_t, uint64_t, uint64_t, &)
+DEFINE_LOOKUP(128, uint128_t, uint128_t, uint128_t, &)
+DEFINE_LOOKUP(192, uint192_t, uint192_t, uint192_t, &)
+DEFINE_LOOKUP(n, packed_key, const unsigned int *, unsigned int, )
@@ -0,0 +1,345 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+/*
+ * Steps of a lookup for each hash type, shared by the lookup paths. Local
+ * versions of the modulo and add helpers are kept here, so that the compiler
+ * can inline them into the lookup loops.
+ */
+
+#define PREFETCH(addr) __builtin_prefetch((const void *)(addr), 0, 0)
+
+/*
+ * Lemire's fastmod: with M = 2^128 / N + 1 precomputed, a % N is the high part
+ * of (M * a mod 2^128) * N, exact for every 64 bit a. Replaces a division by
+ * three multiplications.
+ */
+static inline unsigned int mod64(uint64_t a, unsigned int N, const uint64_t *M)
+{
+	unsigned __int128 lowbits = (((unsigned __int128)M[1] << 64) | M[0]) * a;
+	unsigned __int128 bottom = ((lowbits & 0xffffffffffffffffULL) * N) >> 64;
+	unsigned __int128 top = (lowbits >> 64) * N;
+
+	return (unsigned int)((bottom + top) >> 64);
+}
+
+static inline unsigned int mod128(uint128_t a, unsigned int N, const uint64_t *M, uint64_t shift64)
+{
+	uint64_t p;
+	p = (uint64_t)mod64(a.HI64, N, M) * shift64;
+	p += mod64(a.LO64, N, M);
+	return mod64(p, N, M);
+}
+
+static inline unsigned int mod192(uint192_t a, unsigned int N, const uint64_t *M, uint64_t shift64, uint64_t shift128)
+{
+	uint64_t p;
+	p = (uint64_t)mod64(a.HI, N, M) * shift128;
+	p += (uint64_t)mod64(a.MI, N, M) * shift64;
+	p += mod64(a.LO, N, M);
+	return mod64(p, N, M);
+}
+
+static inline uint128_t add128(uint128_t a, unsigned int b)
+{
+	uint128_t result;
+	result.LO64 = a.LO64 + b;
+	result.HI64 = a.HI64 + (result.LO64 < a.LO64);
+	return result;
+}
+
+static inline uint192_t add192(uint192_t a, unsigned int b)
+{
+	uint192_t result;
+	result.LO = a.LO + b;
+	result.MI = a.MI + (result.LO < a.LO);
+	result.HI = a.HI + (result.MI < a.MI);
+	return result;
+}
+
+/* The mixers of bt_premix_keys(), inverted in bt_premix.c. */
+static inline uint64_t premix64(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+static inline unsigned int premix32(unsigned int x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	return x ^ (x >> 16);
+}
+
+/* Pairs of words are mixed as the 64 bit word they make, least significant first. */
+static inline void premix_words(unsigned int *w, unsigned int words)
+{
+	unsigned int i;
+
+	for (i = 0; i + 1 < words; i += 2) {
+		uint64_t x = premix64(w[i] | (uint64_t)w[i + 1] << 32);
+
+		w[i] = (unsigned int)x;
+		w[i + 1] = (unsigned int)(x >> 32);
+	}
+	if (i < words)
+		w[i] = premix32(w[i]);
+}
+
+static inline uint64_t mix_64(const bt_table *t, uint64_t hash)
+{
+	return t -> premix ? premix64(hash) : hash;
+}
+
+static inline uint128_t mix_128(const bt_table *t, uint128_t hash)
+{
+	if (t -> premix) {
+		hash.LO64 = premix64(hash.LO64);
+		hash.HI64 = premix64(hash.HI64);
+	}
+	return hash;
+}
+
+static inline uint192_t mix_192(const bt_table *t, uint192_t hash)
+{
+	if (t -> premix) {
+		hash.LO = premix64(hash.LO);
+		hash.MI = premix64(hash.MI);
+		hash.HI = premix64(hash.HI);
+	}
+	return hash;
+}
+
+static inline unsigned int ot_idx_64(const bt_table *t, uint64_t hash)
+{
+	return mod64(hash, t -> offset_table_size, t -> fastmod_ot);
+}
+
+static inline unsigned int ht_idx_64(const bt_table *t, uint64_t hash, unsigned int offset)
+{
+	return mod64(hash + offset, t -> hash_table_size, t -> fastmod_ht);
+}
+
+static inline void prefetch_ht_64(const bt_table *t, unsigned int idx)
+{
+	PREFETCH(&t -> hash_table[idx]);
+	PREFETCH(&t -> hash_table[idx + t -> hash_table_size]);
+}
+
+static inline int match_64(const bt_table *t, unsigned int idx, uint64_t hash)
+{
+	const unsigned int *ht = t -> hash_table;
+	unsigned int sz = t -> hash_table_size;
+
+	return ht[idx] == (unsigned int)(hash & 0xffffffff) &&
+	       ht[idx + sz] == (unsigned int)(hash >> 32);
+}
+
+static inline int is_zero_64(uint64_t hash)
+{
+	return !hash;
+}
+
+static inline unsigned int ot_idx_128(const bt_table *t, uint128_t hash)
+{
+	return mod128(hash, t -> offset_table_size, t -> fastmod_ot, t -> shift64_ot_sz);
+}
+
+static inline unsigned int ht_idx_128(const bt_table *t, uint128_t hash, unsigned int offset)
+{
+	return mod128(add128(hash, offset), t -> hash_table_size, t -> fastmod_ht, t -> shift64_ht_sz);
+}
+
+static inline void prefetch_ht_128(const bt_table *t, unsigned int idx)
+{
+	unsigned int sz = t -> hash_table_size;
+
+	PREFETCH(&t -> hash_table[idx]);
+	PREFETCH(&t -> hash_table[idx + sz]);
+	PREFETCH(&t -> hash_table[idx + 2 * sz]);
+	PREFETCH(&t -> hash_table[idx + 3 * sz]);
+}
+
+static inline int match_128(const bt_table *t, unsigned int idx, uint128_t hash)
+{
+	const unsigned int *ht = t -> hash_table;
+	unsigned int sz = t -> hash_table_size;
+
+	return ht[idx] == (unsigned int)(hash.LO64 & 0xffffffff) &&
+	       ht[idx + sz] == (unsigned int)(hash.LO64 >> 32) &&
+	       ht[idx + 2 * sz] == (unsigned int)(hash.HI64 & 0xffffffff) &&
+	       ht[idx + 3 * sz] == (unsigned int)(hash.HI64 >> 32);
+}
+
+static inline int is_zero_128(uint128_t hash)
+{
+	return !(hash.LO64 | hash.HI64);
+}
+
+static inline unsigned int ot_idx_192(const bt_table *t, uint192_t hash)
+{
+	return mod192(hash, t -> offset_table_size, t -> fastmod_ot, t -> shift64_ot_sz, t -> shift128_ot_sz);
+}
+
+static inline unsigned int ht_idx_192(const bt_table *t, uint192_t hash, unsigned int offset)
+{
+	return mod192(add192(hash, offset), t -> hash_table_size, t -> fastmod_ht, t -> shift64_ht_sz, t -> shift128_ht_sz);
+}
+
+static inline void prefetch_ht_192(const bt_table *t, unsigned int idx)
+{
+	unsigned int sz = t -> hash_table_size;
+
+	PREFETCH(&t -> hash_table[idx]);
+	PREFETCH(&t -> hash_table[idx + sz]);
+	PREFETCH(&t -> hash_table[idx + 2 * sz]);
+	PREFETCH(&t -> hash_table[idx + 3 * sz]);
+	PREFETCH(&t -> hash_table[idx + 4 * sz]);
+	PREFETCH(&t -> hash_table[idx + 5 * sz]);
+}
+
+static inline int match_192(const bt_table *t, unsigned int idx, uint192_t hash)
+{
+	const unsigned int *ht = t -> hash_table;
+	unsigned int sz = t -> hash_table_size;
+
+	return ht[idx] == (unsigned int)(hash.LO & 0xffffffff) &&
+	       ht[idx + sz] == (unsigned int)(hash.LO >> 32) &&
+	       ht[idx + 2 * sz] == (unsigned int)(hash.MI & 0xffffffff) &&
+	       ht[idx + 3 * sz] == (unsigned int)(hash.MI >> 32) &&
+	       ht[idx + 4 * sz] == (unsigned int)(hash.HI & 0xffffffff) &&
+	       ht[idx + 5 * sz] == (unsigned int)(hash.HI >> 32);
+}
+
+static inline int is_zero_192(uint192_t hash)
+{
+	return !(hash.LO | hash.MI | hash.HI);
+}
+
+/*
+ * Keys of the stashed buckets, only searched when the Offset Table entry is
+ * BT_STASH_OFFSET. Returns hash_table_size + the position of the key in the
+ * stash, or BT_NOT_FOUND.
+ */
+static inline unsigned int stash_idx(const bt_table *t, const void *key)
+{
+	unsigned int i = t -> stash ? bt_stash_find(t -> stash, key, t -> hash_type / 8) : BT_NOT_FOUND;
+
+	return i == BT_NOT_FOUND ? i : t -> hash_table_size + i;
+}
+
+static inline unsigned int stash_idx_64(const bt_table *t, uint64_t hash)
+{
+	return stash_idx(t, &hash);
+}
+
+static inline unsigned int stash_idx_128(const bt_table *t, uint128_t hash)
+{
+	return stash_idx(t, &hash);
+}
+
+static inline unsigned int stash_idx_192(const bt_table *t, uint192_t hash)
+{
+	return stash_idx(t, &hash);
+}
+
+static inline uint64_t key_64(const bt_table *t, const uint64_t *hashes, unsigned int i)
+{
+	return mix_64(t, hashes[i]);
+}
+
+static inline uint128_t key_128(const bt_table *t, const uint128_t *hashes, unsigned int i)
+{
+	return mix_128(t, hashes[i]);
+}
+
+static inline uint192_t key_192(const bt_table *t, const uint192_t *hashes, unsigned int i)
+{
+	return mix_192(t, hashes[i]);
+}
+
+/* Packed hash types, a key is passed as a copy of its words and their number. */
+typedef struct {
+	unsigned int w[BT_MAX_HASH_BITS / 32];
+	unsigned int words;
+} packed_key;
+
+static inline packed_key key_n(const bt_table *t, const unsigned int *hashes, unsigned int i)
+{
+	const unsigned int *w = hashes + (size_t)i * BT_HASH_WORDS(t -> hash_type);
+	packed_key k;
+
+	k.words = BT_HASH_WORDS(t -> hash_type);
+	for (i = 0; i < k.words; i++)
+		k.w[i] = w[i];
+	if (t -> premix)
+		premix_words(k.w, k.words);
+	return k;
+}
+
+static inline unsigned int modn(packed_key a, unsigned int N, const uint64_t *M)
+{
+	uint64_t p = 0;
+	unsigned int i = a.words;
+
+	while (i--)
+		p = mod64((p << 32) | a.w[i], N, M);
+	return (unsigned int)p;
+}
+
+static inline unsigned int stash_idx_n(const bt_table *t, packed_key hash)
+{
+	return stash_idx(t, hash.w);
+}
+
+static inline uint64_t bloom_digest_n(packed_key hash)
+{
+	return bloom_digest_words(hash.w, hash.words);
+}
+
+static inline unsigned int ot_idx_n(const bt_table *t, packed_key hash)
+{
+	return modn(hash, t -> offset_table_size, t -> fastmod_ot);
+}
+
+static inline unsigned int ht_idx_n(const bt_table *t, packed_key hash, unsigned int offset)
+{
+	return mod64((uint64_t)modn(hash, t -> hash_table_size, t -> fastmod_ht) + offset,
+		     t -> hash_table_size, t -> fastmod_ht);
+}
+
+static inline void prefetch_ht_n(const bt_table *t, unsigned int idx)
+{
+	unsigned int i;
+
+	for (i = 0; i < BT_HASH_WORDS(t -> hash_type); i++)
+		PREFETCH(&t -> hash_table[idx + (size_t)i * t -> hash_table_size]);
+}
+
+static inline int match_n(const bt_table *t, unsigned int idx, packed_key hash)
+{
+	unsigned int i;
+
+	for (i = 0; i < hash.words; i++)
+		if (t -> hash_table[idx + (size_t)i * t -> hash_table_size] != hash.w[i])
+			return 0;
+	return 1;
+}
+
+static inline int is_zero_n(packed_key hash)
+{
+	unsigned int i;
+
+	for (i = 0; i < hash.words; i++)
+		if (hash.w[i])
+			return 0;
+	return 1;
+}
@@ -0,0 +1,277 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+/*
+ * AVX2/AVX-512 bulk lookup for 64 bit hashes. Kernels are compiled with target
+ * attributes and selected at runtime, so the rest of the library does not need
+ * to be built with -mavx2.
+ *
+ * Neither instruction set has a 64 bit integer division, so hash % N is
+ * computed in double precision. The hash is split into four 16 bit pieces:
+ *	x = sum(piece[i] * (2^(16 * i) % N)) < 4 * 2^16 * 2^31 = 2^49,
+ * x is congruent to hash mod N and, being below 2^53, is exact as a double.
+ * q = floor(x * (1 / N)) is then off by at most one, and x - q * N is exact
+ * too, so a single correction step gives the remainder.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <immintrin.h>
+#include "bt_hash_types.h"
+#include "bt_telemetry.h"
+
+#define SIMD_CHUNK 64
+
+#define PREFETCH(addr) __builtin_prefetch((const void *)(addr), 0, 0)
+
+typedef struct {
+	uint64_t shift16[4]; // 2^(16 * i) % N
+	double N;
+	double inv_N;
+} simd_modulus;
+
+static void init_modulus(simd_modulus *m, unsigned int N)
+{
+	unsigned int i;
+
+	m -> shift16[0] = 1 % N;
+	for (i = 1; i < 4; i++)
+		m -> shift16[i] = (m -> shift16[i - 1] << 16) % N;
+	m -> N = (double)N;
+	m -> inv_N = 1.0 / (double)N;
+}
+
+__attribute__((target("avx2")))
+static __m128i mod_avx2(__m256i a, const simd_modulus *m)
+{
+	const __m256i lo16 = _mm256_set1_epi64x(0xffff);
+	const __m256i magic = _mm256_set1_epi64x(0x4330000000000000ULL); // 2^52
+	__m256i x;
+	__m256d xd, q, r, N = _mm256_set1_pd(m -> N);
+
+	x = _mm256_mul_epu32(_mm256_and_si256(a, lo16), _mm256_set1_epi64x(m -> shift16[0]));
+	x = _mm256_add_epi64(x, _mm256_mul_epu32(_mm256_and_si256(_mm256_srli_epi64(a, 16), lo16), _mm256_set1_epi64x(m -> shift16[1])));
+	x = _mm256_add_epi64(x, _mm256_mul_epu32(_mm256_and_si256(_mm256_srli_epi64(a, 32), lo16), _mm256_set1_epi64x(m -> shift16[2])));
+	x = _mm256_add_epi64(x, _mm256_mul_epu32(_mm256_srli_epi64(a, 48), _mm256_set1_epi64x(m -> shift16[3])));
+
+	xd = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(x, magic)), _mm256_castsi256_pd(magic));
+	q = _mm256_floor_pd(_mm256_mul_pd(xd, _mm256_set1_pd(m -> inv_N)));
+	r = _mm256_sub_pd(xd, _mm256_mul_pd(q, N));
+	r = _mm256_add_pd(r, _mm256_and_pd(_mm256_cmp_pd(r, _mm256_setzero_pd(), _CMP_LT_OQ), N));
+	r = _mm256_sub_pd(r, _mm256_and_pd(_mm256_cmp_pd(r, N, _CMP_GE_OQ), N));
+
+	return _mm256_cvttpd_epi32(r);
+}
+
+/* Lanes past the end read as zero, which never matches. */
+__attribute__((target("avx2")))
+static __m256i load_avx2(const uint64_t *h, unsigned int left)
+{
+	if (left >= 4)
+		return _mm256_loadu_si256((const __m256i *)h);
+	return _mm256_maskload_epi64((const long long *)h,
+		_mm256_cmpgt_epi64(_mm256_set1_epi64x(left), _mm256_setr_epi64x(0, 1, 2, 3)));
+}
+
+/* Four hashes at a time, the low and high halves are compared separately. */
+__attribute__((target("avx2")))
+static unsigned int lookup_avx2(const bt_table *t, const uint64_t *hashes, unsigned int num_hashes, uint64_t *hit_bitmap)
+{
+	const __m256i lo32 = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+	const __m256i hi32 = _mm256_setr_epi32(1, 3, 5, 7, 1, 3, 5, 7);
+	const int *ot = (const int *)t -> offset_table;
+	const int *ht_lo = (const int *)t -> hash_table;
+	const int *ht_hi = (const int *)t -> hash_table + t -> hash_table_size;
+	unsigned int idx[SIMD_CHUNK] __attribute__((aligned(32)));
+	unsigned int base, i, n, hits = 0;
+	simd_modulus mod_ot, mod_ht;
+
+	init_modulus(&mod_ot, t -> offset_table_size);
+	init_modulus(&mod_ht, t -> hash_table_size);
+
+	for (base = 0; base < num_hashes; base += SIMD_CHUNK) {
+		const uint64_t *h = hashes + base;
+		uint64_t word = 0;
+		unsigned int left = num_hashes - base;
+
+		n = left < SIMD_CHUNK ? left : SIMD_CHUNK;
+		n = (n + 3) & ~3U;
+
+		for (i = 0; i < n; i += 4) {
+			__m256i a = load_avx2(h + i, left - i);
+			_mm_store_si128((__m128i *)(idx + i), mod_avx2(a, &mod_ot));
+		}
+		for (i = 0; i < n; i++)
+			PREFETCH(ot + idx[i]);
+
+		for (i = 0; i < n; i += 4) {
+			__m256i a = load_avx2(h + i, left - i);
+			__m128i offset = _mm_i32gather_epi32(ot, _mm_load_si128((const __m128i *)(idx + i)), 4);
+			a = _mm256_add_epi64(a, _mm256_cvtepu32_epi64(offset));
+			_mm_store_si128((__m128i *)(idx + i), mod_avx2(a, &mod_ht));
+		}
+		for (i = 0; i < n; i++) {
+			PREFETCH(ht_lo + idx[i]);
+			PREFETCH(ht_hi + idx[i]);
+		}
+
+		for (i = 0; i < n; i += 4) {
+			__m256i a = load_avx2(h + i, left - i);
+			__m128i vidx = _mm_load_si128((const __m128i *)(idx + i));
+			__m128i a_lo = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(a, lo32));
+			__m128i a_hi = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(a, hi32));
+			__m128i eq = _mm_and_si128(_mm_cmpeq_epi32(_mm_i32gather_epi32(ht_lo, vidx, 4), a_lo),
+						   _mm_cmpeq_epi32(_mm_i32gather_epi32(ht_hi, vidx, 4), a_hi));
+			unsigned int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+
+			mask &= ~_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(a, _mm256_setzero_si256())));
+			word |= (uint64_t)mask << i;
+		}
+
+		hit_bitmap[base / SIMD_CHUNK] = word;
+		hits += __builtin_popcountll(word);
+	}
+
+	return hits;
+}
+
+__attribute__((target("avx512f,avx2")))
+static __m256i mod_avx512(__m512i a, const simd_modulus *m)
+{
+	const __m512i lo16 = _mm512_set1_epi64(0xffff);
+	const __m512i magic = _mm512_set1_epi64(0x4330000000000000ULL); // 2^52
+	__m512i x;
+	__m512d xd, q, r, N = _mm512_set1_pd(m -> N);
+
+	x = _mm512_mul_epu32(_mm512_and_si512(a, lo16), _mm512_set1_epi64(m -> shift16[0]));
+	x = _mm512_add_epi64(x, _mm512_mul_epu32(_mm512_and_si512(_mm512_srli_epi64(a, 16), lo16), _mm512_set1_epi64(m -> shift16[1])));
+	x = _mm512_add_epi64(x, _mm512_mul_epu32(_mm512_and_si512(_mm512_srli_epi64(a, 32), lo16), _mm512_set1_epi64(m -> shift16[2])));
+	x = _mm512_add_epi64(x, _mm512_mul_epu32(_mm512_srli_epi64(a, 48), _mm512_set1_epi64(m -> shift16[3])));
+
+	xd = _mm512_sub_pd(_mm512_castsi512_pd(_mm512_or_si512(x, magic)), _mm512_castsi512_pd(magic));
+	q = _mm512_roundscale_pd(_mm512_mul_pd(xd, _mm512_set1_pd(m -> inv_N)), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+	r = _mm512_fnmadd_pd(q, N, xd);
+	r = _mm512_mask_add_pd(r, _mm512_cmp_pd_mask(r, _mm512_setzero_pd(), _CMP_LT_OQ), r, N);
+	r = _mm512_mask_sub_pd(r, _mm512_cmp_pd_mask(r, N, _CMP_GE_OQ), r, N);
+
+	return _mm512_cvttpd_epi32(r);
+}
+
+/* Eight hashes at a time. */
+__attribute__((target("avx512f,avx2")))
+static unsigned int lookup_avx512(const bt_table *t, const uint64_t *hashes, unsigned int num_hashes, uint64_t *hit_bitmap)
+{
+	const int *ot = (const int *)t -> offset_table;
+	const int *ht_lo = (const int *)t -> hash_table;
+	const int *ht_hi = (const int *)t -> hash_table + t -> hash_table_size;
+	unsigned int idx[SIMD_CHUNK] __attribute__((aligned(64)));
+	unsigned int base, i, n, hits = 0;
+	simd_modulus mod_ot, mod_ht;
+
+	init_modulus(&mod_ot, t -> offset_table_size);
+	init_modulus(&mod_ht, t -> hash_table_size);
+
+	for (base = 0; base < num_hashes; base += SIMD_CHUNK) {
+		const uint64_t *h = hashes + base;
+		uint64_t word = 0;
+		unsigned int left = num_hashes - base;
+
+		n = left < SIMD_CHUNK ? left : SIMD_CHUNK;
+		n = (n + 7) & ~7U;
+
+		for (i = 0; i < n; i += 8) {
+			__mmask8 valid = left - i >= 8 ? 0xff : (__mmask8)((1U << (left - i)) - 1);
+			__m512i a = _mm512_maskz_loadu_epi64(valid, h + i);
+			_mm256_store_si256((__m256i *)(idx + i), mod_avx512(a, &mod_ot));
+		}
+		for (i = 0; i < n; i++)
+			PREFETCH(ot + idx[i]);
+
+		for (i = 0; i < n; i += 8) {
+			__mmask8 valid = left - i >= 8 ? 0xff : (__mmask8)((1U << (left - i)) - 1);
+			__m512i a = _mm512_maskz_loadu_epi64(valid, h + i);
+			__m256i offset = _mm256_i32gather_epi32(ot, _mm256_load_si256((const __m256i *)(idx + i)), 4);
+			a = _mm512_add_epi64(a, _mm512_cvtepu32_epi64(offset));
+			_mm256_store_si256((__m256i *)(idx + i), mod_avx512(a, &mod_ht));
+		}
+		for (i = 0; i < n; i++) {
+			PREFETCH(ht_lo + idx[i]);
+			PREFETCH(ht_hi + idx[i]);
+		}
+
+		for (i = 0; i < n; i += 8) {
+			__mmask8 valid = left - i >= 8 ? 0xff : (__mmask8)((1U << (left - i)) - 1);
+			__m512i a = _mm512_maskz_loadu_epi64(valid, h + i);
+			__m256i vidx = _mm256_load_si256((const __m256i *)(idx + i));
+			__m256i a_lo = _mm512_cvtepi64_epi32(a);
+			__m256i a_hi = _mm512_cvtepi64_epi32(_mm512_srli_epi64(a, 32));
+			__m256i eq = _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_i32gather_epi32(ht_lo, vidx, 4), a_lo),
+						      _mm256_cmpeq_epi32(_mm256_i32gather_epi32(ht_hi, vidx, 4), a_hi));
+			unsigned int mask = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+
+			mask &= ~_mm512_cmpeq_epi64_mask(a, _mm512_setzero_si512());
+			word |= (uint64_t)mask << i;
+		}
+
+		hit_bitmap[base / SIMD_CHUNK] = word;
+		hits += __builtin_popcountll(word);
+	}
+
+	return hits;
+}
+
+static unsigned int lookup_scalar(const bt_table *t, const uint64_t *hashes, unsigned int num_hashes, uint64_t *hit_bitmap)
+{
+	return bt_lookup_batch_64(t, hashes, num_hashes, hit_bitmap);
+}
+
+/* Picked once, by whichever thread looks up first. */
+static unsigned int (*lookup_kernel)(const bt_table *, const uint64_t *, unsigned int, uint64_t *);
+static const char *kernel_name;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void pick_kernel(void)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2")) {
+		lookup_kernel = lookup_avx512;
+		kernel_name = "avx512";
+	}
+	else if (__builtin_cpu_supports("avx2")) {
+		lookup_kernel = lookup_avx2;
+		kernel_name = "avx2";
+	}
+	else {
+		lookup_kernel = lookup_scalar;
+		kernel_name = "scalar";
+	}
+}
+
+const char *bt_lookup_simd_kernel(void)
+{
+	pthread_once(&kernel_once, pick_kernel);
+	return kernel_name;
+}
+
+unsigned int bt_lookup_simd_64(const bt_table *table, const uint64_t *hashes, unsigned int num_hashes, uint64_t *hit_bitmap)
+{
+	unsigned int hits;
+	TELEMETRY_DECLARE
+
+	/* The kernels do not consult the Bloom filter or the stash, nor mix keys. */
+	if (table -> bloom_filter || table -> stash || table -> premix)
+		return bt_lookup_batch_64(table, hashes, num_hashes, hit_bitmap);
+
+	pthread_once(&kernel_once, pick_kernel);
+	/* Counted by bt_lookup_batch_64(). */
+	if (lookup_kernel == lookup_scalar)
+		return lookup_scalar(table, hashes, num_hashes, hit_bitmap);
+
+	TELEMETRY_BEGIN_BATCH(num_hashes);
+	hits = lookup_kernel(table, hashes, num_hashes, hit_bitmap);
+	TELEMETRY_END_BATCH(num_hashes, hits);
+	return hits;
+}
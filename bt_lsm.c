@@ -0,0 +1,344 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+/*
+ * Leveled merges. The merger thread reads the frozen set and the level tables
+ * it merges, which nothing changes until the merge is installed, and builds the
+ * new level with bt_build_table(). Installing a merge, the only change to the
+ * levels, happens on the inserting thread, so lookups never see a table freed.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "bt_hash_types.h"
+
+#define LOOKUP_CHUNK 256
+
+static const unsigned int zero_key[6];
+
+static unsigned int key_bytes(const bt_lsm *lsm)
+{
+	return lsm -> hash_type / 8;
+}
+
+static void set_init(bt_lsm_set *s, unsigned int size, unsigned int kb)
+{
+	s -> size = size;
+	s -> count = 0;
+	if (bt_calloc(&s -> keys, size, kb))
+		bt_error("Failed to allocate memory: set keys.");
+}
+
+static void set_free(bt_lsm_set *s)
+{
+	bt_free(&s -> keys);
+	s -> size = s -> count = 0;
+}
+
+static unsigned int set_slot(const bt_lsm_set *s, const void *key)
+{
+	uint64_t lo;
+
+	memcpy(&lo, key, sizeof(uint64_t));
+	return (unsigned int)((lo * 0x9e3779b97f4a7c15ULL) >> 32) & (s -> size - 1);
+}
+
+static int set_find(const bt_lsm_set *s, const void *key, unsigned int kb)
+{
+	unsigned int i;
+
+	if (!s -> count)
+		return 0;
+	for (i = set_slot(s, key); memcmp((char *)s -> keys + (size_t)i * kb, zero_key, kb); i = (i + 1) & (s -> size - 1))
+		if (!memcmp((char *)s -> keys + (size_t)i * kb, key, kb))
+			return 1;
+	return 0;
+}
+
+static void set_add(bt_lsm_set *s, const void *key, unsigned int kb)
+{
+	unsigned int i;
+
+	if (2 * (s -> count + 1) > s -> size) {
+		bt_lsm_set grown;
+
+		set_init(&grown, 2 * s -> size, kb);
+		for (i = 0; i < s -> size; i++)
+			if (memcmp((char *)s -> keys + (size_t)i * kb, zero_key, kb))
+				set_add(&grown, (char *)s -> keys + (size_t)i * kb, kb);
+		set_free(s);
+		*s = grown;
+	}
+
+	for (i = set_slot(s, key); memcmp((char *)s -> keys + (size_t)i * kb, zero_key, kb); i = (i + 1) & (s -> size - 1))
+		if (!memcmp((char *)s -> keys + (size_t)i * kb, key, kb))
+			return;
+	memcpy((char *)s -> keys + (size_t)i * kb, key, kb);
+	s -> count++;
+}
+
+void bt_lsm_init(bt_lsm *lsm, int htype, unsigned int memtable_keys, unsigned int fanout,
+		 const bt_build_options *opts)
+{
+	unsigned int size = 16;
+
+	if (htype != 64 && htype != 128 && htype != 192)
+		bt_error("Levels take 64, 128 or 192 bit keys only.");
+
+	memset(lsm, 0, sizeof(bt_lsm));
+	lsm -> hash_type = htype;
+	lsm -> memtable_keys = memtable_keys ? memtable_keys : 1;
+	lsm -> fanout = fanout > 1 ? fanout : 2;
+	if (opts)
+		lsm -> opts = *opts;
+	lsm -> opts.stats = &lsm -> stats;
+	lsm -> opts.cancel = NULL;
+
+	while (size < 2 * lsm -> memtable_keys && size < (1U << 31))
+		size <<= 1;
+	set_init(&lsm -> memtable, size, key_bytes(lsm));
+}
+
+/*
+ * Word i of a key is hash_table[idx + i * hash_table_size], least significant
+ * first. The stashed keys follow those of the Hash Table.
+ */
+static void *table_keys(const bt_table *t, void *out)
+{
+	unsigned int words = t -> hash_type / 32, w[BT_MAX_HASH_BITS / 32], idx, i;
+	char *p = out;
+
+	for (idx = 0; idx < t -> hash_table_size; idx++) {
+		unsigned int any = 0;
+
+		for (i = 0; i < words; i++)
+			any |= w[i] = t -> hash_table[idx + i * t -> hash_table_size];
+		if (!any)
+			continue;
+		memcpy(p, w, words * sizeof(unsigned int));
+		p += words * sizeof(unsigned int);
+	}
+	if (t -> stash) {
+		memcpy(p, t -> stash -> keys, (size_t)t -> stash -> num_keys * words * sizeof(unsigned int));
+		p += (size_t)t -> stash -> num_keys * words * sizeof(unsigned int);
+	}
+	return p;
+}
+
+static void *merge_thread(void *arg)
+{
+	bt_lsm *lsm = arg;
+	unsigned int kb = key_bytes(lsm), num_keys = lsm -> frozen.count, i;
+	char *keys, *p;
+
+	for (i = 0; i < lsm -> merge_levels; i++)
+		num_keys += lsm -> level_keys[i];
+	if (bt_malloc((void **)&keys, (size_t)num_keys * kb))
+		bt_error("Failed to allocate memory: keys.");
+
+	p = keys;
+	for (i = 0; i < lsm -> frozen.size; i++)
+		if (memcmp((char *)lsm -> frozen.keys + (size_t)i * kb, zero_key, kb)) {
+			memcpy(p, (char *)lsm -> frozen.keys + (size_t)i * kb, kb);
+			p += kb;
+		}
+	for (i = 0; i < lsm -> merge_levels; i++) {
+		char *level = p;
+
+		p = table_keys(lsm -> levels[i], p);
+		/* The build mixes the keys again. */
+		if (lsm -> levels[i] -> premix)
+			bt_unmix_keys(lsm -> hash_type, level, (p - level) / kb);
+	}
+
+	lsm -> merged = bt_build_table(lsm -> hash_type, keys, (p - keys) / kb, &lsm -> opts);
+	lsm -> merged_keys = lsm -> stats.unique_keys;
+	bt_free((void **)&keys);
+
+	__atomic_store_n(&lsm -> merge_done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static void free_level(bt_table *table)
+{
+	bt_table_free(table);
+	bt_free((void **)&table);
+}
+
+static void finish_merge(bt_lsm *lsm)
+{
+	unsigned int i;
+
+	pthread_join(lsm -> merger, NULL);
+	lsm -> merging = 0;
+	lsm -> merge_done = 0;
+	if (!lsm -> merged) {
+		bt_warn("Merge failed, keeping the frozen keys.");
+		return;
+	}
+
+	for (i = 0; i < lsm -> merge_levels; i++)
+		free_level(lsm -> levels[i]);
+	memmove(&lsm -> levels[1], &lsm -> levels[lsm -> merge_levels],
+		(lsm -> num_levels - lsm -> merge_levels) * sizeof(bt_table *));
+	memmove(&lsm -> level_keys[1], &lsm -> level_keys[lsm -> merge_levels],
+		(lsm -> num_levels - lsm -> merge_levels) * sizeof(unsigned int));
+	lsm -> num_levels += 1 - lsm -> merge_levels;
+	lsm -> levels[0] = lsm -> merged;
+	lsm -> level_keys[0] = lsm -> merged_keys;
+	lsm -> merged = NULL;
+	set_free(&lsm -> frozen);
+	lsm -> merges++;
+}
+
+/* Tier t holds less than memtable_keys * fanout^(t + 1) keys. */
+static unsigned int tier(const bt_lsm *lsm, unsigned long long keys)
+{
+	unsigned long long cap = (unsigned long long)lsm -> memtable_keys * lsm -> fanout;
+	unsigned int t = 0;
+
+	while (keys >= cap) {
+		cap *= lsm -> fanout;
+		t++;
+	}
+	return t;
+}
+
+/*
+ * Freezes the mutable set unless a failed merge left keys frozen, and picks the
+ * levels to merge with it: as long as the newest levels hold fanout - 1 levels
+ * of the merged keys' tier or below, they are merged in and the tier goes up.
+ */
+static void start_merge(bt_lsm *lsm)
+{
+	unsigned long long merged;
+	unsigned int i, n;
+
+	if (!lsm -> frozen.count) {
+		if (!lsm -> memtable.count)
+			return;
+		lsm -> frozen = lsm -> memtable;
+		set_init(&lsm -> memtable, lsm -> frozen.size, key_bytes(lsm));
+	}
+
+	merged = lsm -> frozen.count;
+	i = 0;
+	for (;;) {
+		unsigned int t = tier(lsm, merged);
+
+		for (n = 0; i + n < lsm -> num_levels && tier(lsm, lsm -> level_keys[i + n]) <= t; n++);
+		if (n + 1 < lsm -> fanout)
+			break;
+		for (; n; n--)
+			merged += lsm -> level_keys[i++];
+	}
+	while (lsm -> num_levels - i >= BT_LSM_MAX_LEVELS)
+		merged += lsm -> level_keys[i++];
+	lsm -> merge_levels = i;
+
+	lsm -> merge_done = 0;
+	if (pthread_create(&lsm -> merger, NULL, merge_thread, lsm))
+		bt_error("Failed to start the merger thread.");
+	lsm -> merging = 1;
+}
+
+static void insert(bt_lsm *lsm, const void *key)
+{
+	unsigned int kb = key_bytes(lsm);
+
+	if (lsm -> merging && __atomic_load_n(&lsm -> merge_done, __ATOMIC_ACQUIRE))
+		finish_merge(lsm);
+	if (!memcmp(key, zero_key, kb))
+		return;
+
+	set_add(&lsm -> memtable, key, kb);
+	if (lsm -> memtable.count < lsm -> memtable_keys)
+		return;
+
+	if (lsm -> merging) {
+		double start = bt_monotonic_seconds();
+
+		finish_merge(lsm);
+		lsm -> stalls++;
+		lsm -> stall_seconds += bt_monotonic_seconds() - start;
+	}
+	start_merge(lsm);
+}
+
+void bt_lsm_flush(bt_lsm *lsm)
+{
+	if (lsm -> merging)
+		finish_merge(lsm);
+	while (lsm -> frozen.count || lsm -> memtable.count) {
+		start_merge(lsm);
+		finish_merge(lsm);
+		if (lsm -> frozen.count)
+			break;
+	}
+}
+
+void bt_lsm_destroy(bt_lsm *lsm)
+{
+	unsigned int i;
+
+	if (lsm -> merging)
+		finish_merge(lsm);
+	for (i = 0; i < lsm -> num_levels; i++)
+		free_level(lsm -> levels[i]);
+	lsm -> num_levels = 0;
+	set_free(&lsm -> memtable);
+	set_free(&lsm -> frozen);
+}
+
+static int in_sets(const bt_lsm *lsm, const void *key)
+{
+	unsigned int kb = key_bytes(lsm);
+
+	return set_find(&lsm -> memtable, key, kb) || set_find(&lsm -> frozen, key, kb);
+}
+
+#define DEFINE_LSM(W, HASH_T)								\
+void bt_lsm_insert_##W(bt_lsm *lsm, HASH_T hash)					\
+{											\
+	insert(lsm, &hash);								\
+}											\
+											\
+int bt_lsm_lookup_##W(const bt_lsm *lsm, HASH_T hash)					\
+{											\
+	if (in_sets(lsm, &hash))							\
+		return 1;								\
+	return lsm -> num_levels &&							\
+	       bt_probe_tables_##W((const bt_table *const *)lsm -> levels, lsm -> num_levels, hash) != 0; \
+}											\
+											\
+unsigned int bt_lsm_lookup_batch_##W(const bt_lsm *lsm, const HASH_T *hashes,		\
+				     unsigned int num_hashes, uint64_t *hit_bitmap)	\
+{											\
+	uint64_t masks[LOOKUP_CHUNK];							\
+	unsigned int base, i, n, hits = 0;						\
+											\
+	for (i = 0; i < (num_hashes + 63) / 64; i++)					\
+		hit_bitmap[i] = 0;							\
+											\
+	for (base = 0; base < num_hashes; base += LOOKUP_CHUNK) {			\
+		n = num_hashes - base < LOOKUP_CHUNK ? num_hashes - base : LOOKUP_CHUNK;	\
+		if (lsm -> num_levels)							\
+			bt_probe_tables_batch_##W((const bt_table *const *)lsm -> levels, \
+				lsm -> num_levels, hashes + base, n, masks);		\
+		else									\
+			memset(masks, 0, n * sizeof(uint64_t));				\
+		for (i = 0; i < n; i++)							\
+			if (masks[i] || in_sets(lsm, &hashes[base + i])) {		\
+				hit_bitmap[(base + i) / 64] |= 1ULL << ((base + i) % 64); \
+				hits++;							\
+			}								\
+	}										\
+	return hits;									\
+}
+
+DEFINE_LSM(64, uint64_t)
+DEFINE_LSM(128, uint128_t)
+DEFINE_LSM(192, uint192_t)
@@ -0,0 +1,119 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+/*
+ * Probing one hash against many tables. Every (hash, table) pair is an
+ * independent lookup, so instead of running them one after another, each stage
+ * of the lookup is issued for all pairs before the next stage starts. The
+ * modulo constants come precomputed with each bt_table.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include "bt_hash_types.h"
+#include "bt_bloom.h"
+#include "bt_lookup.h"
+
+/* Number of (hash, table) pairs kept in flight by the batched probe. */
+#define PROBE_INFLIGHT 64
+
+/* live[] of a pair whose bucket is stashed, searched in the stash instead. */
+#define STASHED 2
+
+/*
+ * Probes num_hashes hashes against num_tables tables, where
+ * num_hashes * num_tables <= PROBE_INFLIGHT. Pair p refers to hash p / num_tables
+ * and table p % num_tables.
+ */
+#define DEFINE_PROBE(W, HASH_T)								\
+static void probe_group_##W(const bt_table *const *tables, unsigned int num_tables,	\
+			    const HASH_T *hashes, unsigned int num_hashes,		\
+			    uint64_t *masks)						\
+{											\
+	unsigned int idx[PROBE_INFLIGHT];						\
+	uint64_t digest[PROBE_INFLIGHT];						\
+	HASH_T key[PROBE_INFLIGHT];							\
+	unsigned char live[PROBE_INFLIGHT];						\
+	unsigned int i, j, p, offset;							\
+											\
+	/* Tables built with premix each take the hash mixed. */			\
+	for (p = 0, i = 0; i < num_hashes; i++) {					\
+		masks[i] = 0;								\
+		for (j = 0; j < num_tables; j++, p++) {					\
+			key[p] = mix_##W(tables[j], hashes[i]);				\
+			live[p] = !is_zero_##W(hashes[i]);				\
+			if (tables[j] -> bloom_filter) {				\
+				digest[p] = bloom_digest_##W(key[p]);			\
+				PREFETCH(bloom_block(tables[j] -> bloom_filter, digest[p])); \
+			}								\
+		}									\
+	}										\
+											\
+	for (p = 0, i = 0; i < num_hashes; i++)						\
+		for (j = 0; j < num_tables; j++, p++) {					\
+			const bt_table *t = tables[j];					\
+			if (t -> bloom_filter && !bloom_query(t -> bloom_filter, digest[p])) \
+				live[p] = 0;						\
+			if (!live[p])							\
+				continue;						\
+			idx[p] = ot_idx_##W(t, key[p]);					\
+			PREFETCH(&t -> offset_table[idx[p]]);				\
+		}									\
+											\
+	for (p = 0, i = 0; i < num_hashes; i++)						\
+		for (j = 0; j < num_tables; j++, p++) {					\
+			const bt_table *t = tables[j];					\
+			if (!live[p])							\
+				continue;						\
+			offset = (unsigned int)t -> offset_table[idx[p]];		\
+			if (offset == BT_STASH_OFFSET) {				\
+				live[p] = STASHED;					\
+				continue;						\
+			}								\
+			idx[p] = ht_idx_##W(t, key[p], offset);				\
+			prefetch_ht_##W(t, idx[p]);					\
+		}									\
+											\
+	for (p = 0, i = 0; i < num_hashes; i++)						\
+		for (j = 0; j < num_tables; j++, p++)					\
+			if (live[p] == STASHED ? stash_idx_##W(tables[j], key[p]) != BT_NOT_FOUND : \
+			    live[p] && match_##W(tables[j], idx[p], key[p]))		\
+				masks[i] |= 1ULL << j;					\
+}											\
+											\
+uint64_t bt_probe_tables_##W(const bt_table *const *tables, unsigned int num_tables, HASH_T hash) \
+{											\
+	uint64_t mask;									\
+											\
+	if (num_tables > BT_MAX_PROBE_TABLES)						\
+		num_tables = BT_MAX_PROBE_TABLES;					\
+	probe_group_##W(tables, num_tables, &hash, 1, &mask);				\
+	return mask;									\
+}											\
+											\
+void bt_probe_tables_batch_##W(const bt_table *const *tables, unsigned int num_tables,	\
+			       const HASH_T *hashes, unsigned int num_hashes,		\
+			       uint64_t *masks)						\
+{											\
+	unsigned int i, group;								\
+											\
+	if (num_tables > BT_MAX_PROBE_TABLES)						\
+		num_tables = BT_MAX_PROBE_TABLES;					\
+	if (!num_tables) {								\
+		for (i = 0; i < num_hashes; i++)					\
+			masks[i] = 0;							\
+		return;									\
+	}										\
+											\
+	group = PROBE_INFLIGHT / num_tables;						\
+	for (i = 0; i < num_hashes; i += group)						\
+		probe_group_##W(tables, num_tables, hashes + i,				\
+				num_hashes - i < group ? num_hashes - i : group, masks + i); \
+}
+
+DEFINE_PROBE(64, uint64_t)
+DEFINE_PROBE(128, uint128_t)
+DEFINE_PROBE(192, uint192_t)
@@ -0,0 +1,129 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#if __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#include "bt_hash_types.h"
+
+const char *const bt_perf_names[BT_PERF_NUM_COUNTERS] = {
+	"cycles", "instructions", "llc_misses", "dtlb_misses", "branch_misses"
+};
+
+#if __linux__
+static int open_counter(unsigned int type, uint64_t config)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+int bt_perf_open(bt_perf_counters *pc)
+{
+	int i, num_open = 0;
+
+	pc -> fd[BT_PERF_CYCLES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	pc -> fd[BT_PERF_INSTRUCTIONS] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	// The generic cache miss event is the last level cache on x86.
+	pc -> fd[BT_PERF_LLC_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	pc -> fd[BT_PERF_DTLB_MISSES] = open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+						     (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	pc -> fd[BT_PERF_BRANCH_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+
+	for (i = 0; i < BT_PERF_NUM_COUNTERS; i++) {
+		pc -> value[i] = 0;
+		if (pc -> fd[i] < 0)
+			pc -> fd[i] = -1;
+		else
+			num_open++;
+	}
+
+	return num_open;
+}
+
+void bt_perf_start(bt_perf_counters *pc)
+{
+	int i;
+
+	for (i = 0; i < BT_PERF_NUM_COUNTERS; i++)
+		if (pc -> fd[i] >= 0) {
+			ioctl(pc -> fd[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(pc -> fd[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+}
+
+void bt_perf_stop(bt_perf_counters *pc)
+{
+	uint64_t data[3]; // value, time enabled, time running
+	int i;
+
+	for (i = 0; i < BT_PERF_NUM_COUNTERS; i++) {
+		pc -> value[i] = 0;
+		if (pc -> fd[i] < 0)
+			continue;
+		ioctl(pc -> fd[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(pc -> fd[i], data, sizeof(data)) != sizeof(data))
+			continue;
+		if (data[2] && data[2] < data[1])
+			pc -> value[i] = (uint64_t)((long double)data[0] * data[1] / data[2]);
+		else
+			pc -> value[i] = data[0];
+	}
+}
+
+void bt_perf_close(bt_perf_counters *pc)
+{
+	int i;
+
+	for (i = 0; i < BT_PERF_NUM_COUNTERS; i++) {
+		if (pc -> fd[i] >= 0)
+			close(pc -> fd[i]);
+		pc -> fd[i] = -1;
+	}
+}
+
+#else
+
+int bt_perf_open(bt_perf_counters *pc)
+{
+	int i;
+
+	for (i = 0; i < BT_PERF_NUM_COUNTERS; i++) {
+		pc -> fd[i] = -1;
+		pc -> value[i] = 0;
+	}
+	return 0;
+}
+
+void bt_perf_start(bt_perf_counters *pc)
+{
+}
+
+void bt_perf_stop(bt_perf_counters *pc)
+{
+}
+
+void bt_perf_close(bt_perf_counters *pc)
+{
+}
+
+#endif
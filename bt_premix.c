@@ -0,0 +1,89 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+/*
+ * Key mixing for tables built with premix. Every step of the mixers in
+ * bt_lookup.h is invertible: x ^= x >> s is undone by xoring in x >> s,
+ * x >> 2s, ... and a multiplication by an odd constant by one with its
+ * inverse modulo 2^64 or 2^32.
+ */
+
+#include <stdlib.h>
+#include "bt_hash_types.h"
+#include "bt_bloom.h"
+#include "bt_lookup.h"
+
+static inline uint64_t unmix64(uint64_t x)
+{
+	x ^= (x >> 31) ^ (x >> 62);
+	x *= 0x319642b2d24d8ec3ULL;
+	x ^= (x >> 27) ^ (x >> 54);
+	x *= 0x96de1b173f119089ULL;
+	return x ^ (x >> 30) ^ (x >> 60);
+}
+
+static inline unsigned int unmix32(unsigned int x)
+{
+	x ^= x >> 16;
+	x *= 0x43021123;
+	x ^= (x >> 15) ^ (x >> 30);
+	x *= 0x1d69e2a5;
+	return x ^ (x >> 16);
+}
+
+static void unmix_words(unsigned int *w, unsigned int words)
+{
+	unsigned int i;
+
+	for (i = 0; i + 1 < words; i += 2) {
+		uint64_t x = unmix64(w[i] | (uint64_t)w[i + 1] << 32);
+
+		w[i] = (unsigned int)x;
+		w[i + 1] = (unsigned int)(x >> 32);
+	}
+	if (i < words)
+		w[i] = unmix32(w[i]);
+}
+
+/* 64, 128 and 192 bit keys are arrays of 64 bit words, each mixed on its own. */
+static void mix_keys(int htype, void *keys, unsigned int num_keys, int inverse)
+{
+	size_t i, n;
+
+	if (htype == 64 || htype == 128 || htype == 192) {
+		uint64_t *w = keys;
+
+		n = (size_t)num_keys * (htype / 64);
+#if _OPENMP
+#pragma omp parallel for
+#endif
+		for (i = 0; i < n; i++)
+			w[i] = inverse ? unmix64(w[i]) : premix64(w[i]);
+	}
+	else if (BT_VALID_HASH_TYPE(htype)) {
+		unsigned int words = BT_HASH_WORDS(htype);
+
+#if _OPENMP
+#pragma omp parallel for
+#endif
+		for (i = 0; i < num_keys; i++) {
+			if (inverse)
+				unmix_words((unsigned int *)keys + i * words, words);
+			else
+				premix_words((unsigned int *)keys + i * words, words);
+		}
+	}
+}
+
+void bt_premix_keys(int htype, void *keys, unsigned int num_keys)
+{
+	mix_keys(htype, keys, num_keys, 0);
+}
+
+void bt_unmix_keys(int htype, void *keys, unsigned int num_keys)
+{
+	mix_keys(htype, keys, num_keys, 1);
+}
@@ -0,0 +1,215 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+/*
+ * Parallel bulk probes. Each thread owns a contiguous, 64 hash aligned range of
+ * the input and therefore whole words of the hit bitmap, so no locking is
+ * needed. Match positions are produced in a second pass: threads publish their
+ * hit counts, a prefix sum gives every thread its output offset, and each
+ * thread compacts its own bitmap words into positions.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <immintrin.h>
+#if _OPENMP
+#include <omp.h>
+#endif
+#include "bt_hash_types.h"
+
+/* Number of bitmap words handed to the batched lookup per call. */
+#define PROBE_BLOCK_WORDS 1024
+
+static unsigned int *compact_scalar(const uint64_t *words, unsigned int num_words, unsigned int base, unsigned int *out, unsigned int *out_end)
+{
+	unsigned int i;
+
+	(void)out_end;
+	for (i = 0; i < num_words; i++) {
+		uint64_t w = words[i];
+		while (w) {
+			*out++ = base + i * 64 + __builtin_ctzll(w);
+			w &= w - 1;
+		}
+	}
+	return out;
+}
+
+__attribute__((target("avx512f")))
+static unsigned int *compact_avx512(const uint64_t *words, unsigned int num_words, unsigned int base, unsigned int *out, unsigned int *out_end)
+{
+	const __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	unsigned int i, k;
+
+	(void)out_end;
+	for (i = 0; i < num_words; i++) {
+		uint64_t w = words[i];
+		if (!w)
+			continue;
+		for (k = 0; k < 4; k++) {
+			__mmask16 m = (__mmask16)(w >> (16 * k));
+			__m512i pos = _mm512_add_epi32(lane, _mm512_set1_epi32(base + i * 64 + 16 * k));
+			_mm512_mask_compressstoreu_epi32(out, m, pos);
+			out += __builtin_popcount(m);
+		}
+	}
+	return out;
+}
+
+/* Lane permutation for every byte of the bitmap, the set lanes first. */
+static unsigned int compact_lut[256][8] __attribute__((aligned(32)));
+
+static void init_compact_lut(void)
+{
+	unsigned int m, j, n;
+
+	for (m = 0; m < 256; m++) {
+		for (j = 0, n = 0; j < 8; j++)
+			if (m >> j & 1)
+				compact_lut[m][n++] = j;
+		while (n < 8)
+			compact_lut[m][n++] = 0;
+	}
+}
+
+/*
+ * Always stores eight lanes, so it falls back to the scalar loop when fewer
+ * than eight slots are left before out_end.
+ */
+__attribute__((target("avx2")))
+static unsigned int *compact_avx2(const uint64_t *words, unsigned int num_words, unsigned int base, unsigned int *out, unsigned int *out_end)
+{
+	const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	unsigned int i, k;
+
+	for (i = 0; i < num_words; i++) {
+		uint64_t w = words[i];
+		if (!w)
+			continue;
+		if (out_end - out < 64)
+			return compact_scalar(words + i, num_words - i, base + i * 64, out, out_end);
+		for (k = 0; k < 8; k++) {
+			unsigned int m = (unsigned int)(w >> (8 * k)) & 0xff;
+			__m256i pos = _mm256_add_epi32(lane, _mm256_set1_epi32(base + i * 64 + 8 * k));
+			pos = _mm256_permutevar8x32_epi32(pos, _mm256_load_si256((const __m256i *)compact_lut[m]));
+			_mm256_storeu_si256((__m256i *)out, pos);
+			out += __builtin_popcount(m);
+		}
+	}
+	return out;
+}
+
+/* Picked once, by whichever thread compacts first, as is the lookup kernel. */
+static unsigned int *(*compact)(const uint64_t *, unsigned int, unsigned int, unsigned int *, unsigned int *);
+static pthread_once_t compact_once = PTHREAD_ONCE_INIT;
+
+static void init_compact(void)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		compact = compact_avx512;
+	else if (__builtin_cpu_supports("avx2")) {
+		init_compact_lut();
+		compact = compact_avx2;
+	}
+	else
+		compact = compact_scalar;
+}
+
+static unsigned int lookup_64(const bt_table *table, const void *hashes, unsigned int first, unsigned int num, uint64_t *bitmap)
+{
+	return bt_lookup_simd_64(table, (const uint64_t *)hashes + first, num, bitmap);
+}
+
+static unsigned int lookup_128(const bt_table *table, const void *hashes, unsigned int first, unsigned int num, uint64_t *bitmap)
+{
+	return bt_lookup_batch_128(table, (const uint128_t *)hashes + first, num, bitmap);
+}
+
+static unsigned int lookup_192(const bt_table *table, const void *hashes, unsigned int first, unsigned int num, uint64_t *bitmap)
+{
+	return bt_lookup_batch_192(table, (const uint192_t *)hashes + first, num, bitmap);
+}
+
+static unsigned int probe_array(const bt_table *table, const void *hashes, unsigned int num_hashes,
+				uint64_t *hit_bitmap, unsigned int *matches,
+				unsigned int (*lookup)(const bt_table *, const void *, unsigned int, unsigned int, uint64_t *))
+{
+	unsigned int num_words = (num_hashes + 63) / 64;
+	unsigned int *thread_hits = NULL, team_size = 1, total, t;
+	uint64_t *bitmap = hit_bitmap;
+
+	if (!bitmap && bt_malloc((void **)&bitmap, num_words * sizeof(uint64_t)))
+		bt_error("Failed to allocate memory: bitmap.");
+
+	if (matches)
+		pthread_once(&compact_once, init_compact);
+
+#if _OPENMP
+#pragma omp parallel
+#endif
+	{
+		unsigned int tid = 0, num_threads = 1, w, w_begin, w_end, t, hits = 0;
+#if _OPENMP
+		tid = omp_get_thread_num();
+		num_threads = omp_get_num_threads();
+#pragma omp single
+#endif
+		{
+			team_size = num_threads;
+			if (bt_calloc((void **)&thread_hits, num_threads + 1, sizeof(unsigned int)))
+				bt_error("Failed to allocate memory: thread_hits.");
+		}
+
+		w_begin = (unsigned long long)num_words * tid / num_threads;
+		w_end = (unsigned long long)num_words * (tid + 1) / num_threads;
+
+		for (w = w_begin; w < w_end; w += PROBE_BLOCK_WORDS) {
+			unsigned int first = w * 64;
+			unsigned int last = (w + PROBE_BLOCK_WORDS < w_end ? w + PROBE_BLOCK_WORDS : w_end) * 64;
+			if (last > num_hashes)
+				last = num_hashes;
+			hits += lookup(table, hashes, first, last - first, bitmap + w);
+		}
+		thread_hits[tid + 1] = hits;
+
+		if (matches) {
+#if _OPENMP
+#pragma omp barrier
+#endif
+			for (t = 0; t < tid; t++)
+				hits += thread_hits[t + 1];
+			/* hits is now the end of this thread's output range. */
+			compact(bitmap + w_begin, w_end - w_begin, w_begin * 64,
+				matches + hits - thread_hits[tid + 1], matches + hits);
+		}
+	}
+
+	total = 0;
+	for (t = 1; t <= team_size; t++)
+		total += thread_hits[t];
+
+	bt_free((void **)&thread_hits);
+	if (!hit_bitmap)
+		bt_free((void **)&bitmap);
+
+	return total;
+}
+
+unsigned int bt_probe_array_64(const bt_table *table, const uint64_t *hashes, unsigned int num_hashes, uint64_t *hit_bitmap, unsigned int *matches)
+{
+	return probe_array(table, hashes, num_hashes, hit_bitmap, matches, lookup_64);
+}
+
+unsigned int bt_probe_array_128(const bt_table *table, const uint128_t *hashes, unsigned int num_hashes, uint64_t *hit_bitmap, unsigned int *matches)
+{
+	return probe_array(table, hashes, num_hashes, hit_bitmap, matches, lookup_128);
+}
+
+unsigned int bt_probe_array_192(const bt_table *table, const uint192_t *hashes, unsigned int num_hashes, uint64_t *hit_bitmap, unsigned int *matches)
+{
+	return probe_array(table, hashes, num_hashes, hit_bitmap, matches, lookup_192);
+}
@@ -0,0 +1,209 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "bt_hash_types.h"
+
+#define QTRACE_MAGIC "BTQTRC01"
+#define QTRACE_BUFFER_SIZE (1 << 16)
+#define MAX_RECORD_SIZE (10 + sizeof(uint192_t))
+
+typedef struct {
+	char magic[8];
+	uint32_t hash_type;
+	uint32_t header_size;
+	uint64_t num_records;
+	uint64_t start_time;
+	uint32_t sample_period;
+	unsigned char reserved[BT_QTRACE_HEADER_SIZE - 36];
+} qtrace_header;
+
+/* Calls by this thread, for sampling without a shared counter. */
+static __thread uint64_t calls;
+
+static size_t key_size(int htype)
+{
+	return htype == 64 ? sizeof(uint64_t) : (htype == 128 ? sizeof(uint128_t) : sizeof(uint192_t));
+}
+
+static uint64_t clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int write_header(bt_qtrace_writer *w, uint64_t start_time)
+{
+	qtrace_header header;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, QTRACE_MAGIC, 8);
+	header.hash_type = w -> hash_type;
+	header.header_size = BT_QTRACE_HEADER_SIZE;
+	header.num_records = w -> num_records;
+	header.start_time = start_time;
+	header.sample_period = w -> sample_period;
+
+	return fseeko(w -> fp, 0, SEEK_SET) || fwrite(&header, sizeof(header), 1, w -> fp) != 1;
+}
+
+static void flush(bt_qtrace_writer *w)
+{
+	if (w -> buf_len && fwrite(w -> buf, 1, w -> buf_len, w -> fp) != w -> buf_len)
+		w -> error = 1;
+	w -> buf_len = 0;
+}
+
+int bt_qtrace_open(bt_qtrace_writer *w, const char *filename, int htype, unsigned int sample_period)
+{
+	w -> hash_type = htype;
+	w -> sample_period = sample_period ? sample_period : 1;
+	w -> num_records = 0;
+	w -> last_ns = 0;
+	w -> buf_len = 0;
+	w -> error = 0;
+
+	if (bt_malloc((void **)&w -> buf, QTRACE_BUFFER_SIZE))
+		bt_error("Failed to allocate memory: trace buffer.");
+	w -> fp = fopen(filename, "w+b");
+	if (w -> fp == NULL || write_header(w, clock_ns(CLOCK_REALTIME))) {
+		if (w -> fp)
+			fclose(w -> fp);
+		bt_free((void **)&w -> buf);
+		return 1;
+	}
+	pthread_mutex_init(&w -> lock, NULL);
+
+	return 0;
+}
+
+void bt_qtrace_record(bt_qtrace_writer *w, const void *hash)
+{
+	uint64_t now, delta;
+	unsigned char *p;
+
+	if (calls++ % w -> sample_period)
+		return;
+
+	pthread_mutex_lock(&w -> lock);
+	/* Taken under the lock, so that records are in time order. */
+	now = clock_ns(CLOCK_MONOTONIC);
+	delta = w -> num_records ? now - w -> last_ns : 0;
+	w -> last_ns = now;
+
+	p = w -> buf + w -> buf_len;
+	while (delta >= 0x80) {
+		*p++ = (unsigned char)delta | 0x80;
+		delta >>= 7;
+	}
+	*p++ = (unsigned char)delta;
+	memcpy(p, hash, key_size(w -> hash_type));
+	w -> buf_len = p + key_size(w -> hash_type) - w -> buf;
+	w -> num_records++;
+
+	if (w -> buf_len > QTRACE_BUFFER_SIZE - MAX_RECORD_SIZE)
+		flush(w);
+	pthread_mutex_unlock(&w -> lock);
+}
+
+int bt_qtrace_close(bt_qtrace_writer *w)
+{
+	qtrace_header header;
+	int ret;
+
+	flush(w);
+	/* Keep the start time written by bt_qtrace_open(). */
+	ret = w -> error || fseeko(w -> fp, 0, SEEK_SET) || fread(&header, sizeof(header), 1, w -> fp) != 1 ||
+	      write_header(w, header.start_time);
+	if (fclose(w -> fp))
+		ret = 1;
+	w -> fp = NULL;
+	bt_free((void **)&w -> buf);
+	pthread_mutex_destroy(&w -> lock);
+
+	return ret;
+}
+
+int bt_qtrace_load(bt_qtrace *t, const char *filename)
+{
+	qtrace_header header;
+	unsigned char *data = NULL, *p, *end;
+	uint64_t capacity, n = 0, time = 0;
+	size_t len, ksize;
+	long long size;
+	FILE *fp;
+
+	t -> keys = NULL;
+	t -> time_ns = NULL;
+
+	fp = fopen(filename, "rb");
+	if (fp == NULL)
+		return 1;
+	if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, QTRACE_MAGIC, 8) ||
+	    header.header_size != BT_QTRACE_HEADER_SIZE ||
+	    (header.hash_type != 64 && header.hash_type != 128 && header.hash_type != 192) ||
+	    fseeko(fp, 0, SEEK_END) || (size = ftello(fp)) < BT_QTRACE_HEADER_SIZE ||
+	    fseeko(fp, BT_QTRACE_HEADER_SIZE, SEEK_SET)) {
+		fclose(fp);
+		return 1;
+	}
+
+	len = size - BT_QTRACE_HEADER_SIZE;
+	ksize = key_size(header.hash_type);
+	/* Every record takes at least 1 + ksize bytes. */
+	capacity = len / (1 + ksize);
+	if (bt_malloc((void **)&data, len + 1) ||
+	    bt_malloc((void **)&t -> keys, capacity * ksize + 1) ||
+	    bt_malloc((void **)&t -> time_ns, capacity * sizeof(uint64_t) + 1))
+		bt_error("Failed to allocate memory: trace.");
+	if (fread(data, 1, len, fp) != len) {
+		fclose(fp);
+		bt_free((void **)&data);
+		bt_qtrace_free(t);
+		return 1;
+	}
+	fclose(fp);
+
+	/* A trace cut short ends at the last whole record. */
+	p = data;
+	end = data + len;
+	while (p < end) {
+		uint64_t delta = 0;
+		unsigned int shift = 0;
+
+		while (p < end && (*p & 0x80) && shift < 63) {
+			delta |= (uint64_t)(*p++ & 0x7f) << shift;
+			shift += 7;
+		}
+		if (p == end || (size_t)(end - p) < 1 + ksize)
+			break;
+		delta |= (uint64_t)*p++ << shift;
+		time += delta;
+		t -> time_ns[n] = time;
+		memcpy((char *)t -> keys + n * ksize, p, ksize);
+		p += ksize;
+		n++;
+	}
+	bt_free((void **)&data);
+
+	t -> hash_type = header.hash_type;
+	t -> sample_period = header.sample_period;
+	t -> start_time = header.start_time;
+	t -> num_records = n;
+
+	return 0;
+}
+
+void bt_qtrace_free(bt_qtrace *t)
+{
+	bt_free((void **)&t -> keys);
+	bt_free((void **)&t -> time_ns);
+	t -> num_records = 0;
+}
@@ -0,0 +1,172 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+/*
+ * Asynchronous memory access chaining (AMAC): every lookup is a small state
+ * machine whose states correspond to the memory accesses of a lookup. Each
+ * state transition issues a prefetch and yields, the scheduler then moves on to
+ * the next slot, so that num_slots independent accesses overlap.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include "bt_hash_types.h"
+#include "bt_bloom.h"
+#include "bt_lookup.h"
+
+#define TASK_FREE	0
+#define TASK_BLOOM	1 // Bloom filter block prefetched.
+#define TASK_OFFSET	2 // Offset Table entry prefetched.
+#define TASK_HASH	3 // Hash Table entries prefetched.
+
+void bt_sched_init(bt_lookup_sched *sched, const bt_table *table, unsigned int num_slots)
+{
+	unsigned int i;
+
+	if (table -> hash_type != 64 && table -> hash_type != 128 && table -> hash_type != 192)
+		bt_error("The scheduler takes 64, 128 or 192 bit tables only.");
+	if (!num_slots)
+		num_slots = 1;
+
+	if (bt_malloc((void **)&sched -> tasks, num_slots * sizeof(bt_lookup_task)))
+		bt_error("Failed to allocate memory: sched -> tasks.");
+
+	for (i = 0; i < num_slots; i++)
+		sched -> tasks[i].stage = TASK_FREE;
+
+	sched -> table = table;
+	sched -> num_slots = num_slots;
+	sched -> next = 0;
+	sched -> in_flight = 0;
+}
+
+void bt_sched_free(bt_lookup_sched *sched)
+{
+	bt_free((void **)&sched -> tasks);
+	sched -> num_slots = 0;
+}
+
+static void complete(bt_lookup_sched *sched, bt_lookup_task *task, unsigned int result)
+{
+	task -> stage = TASK_FREE;
+	sched -> in_flight--;
+	task -> callback(task -> user_data, result);
+}
+
+/* Runs a lookup up to its next memory access. */
+#define DEFINE_STEP(W, FIELD)								\
+static void step_##W(bt_lookup_sched *sched, bt_lookup_task *task)			\
+{											\
+	const bt_table *table = sched -> table;						\
+	unsigned int offset;								\
+											\
+	switch (task -> stage) {							\
+	case TASK_BLOOM:								\
+		if (!bloom_query(table -> bloom_filter, task -> digest)) {		\
+			complete(sched, task, BT_NOT_FOUND);				\
+			break;								\
+		}									\
+		task -> idx = ot_idx_##W(table, task -> hash.FIELD);			\
+		PREFETCH(&table -> offset_table[task -> idx]);				\
+		task -> stage = TASK_OFFSET;						\
+		break;									\
+	case TASK_OFFSET:								\
+		offset = (unsigned int)table -> offset_table[task -> idx];		\
+		if (offset == BT_STASH_OFFSET) {					\
+			complete(sched, task, stash_idx_##W(table, task -> hash.FIELD)); \
+			break;								\
+		}									\
+		task -> idx = ht_idx_##W(table, task -> hash.FIELD, offset);		\
+		prefetch_ht_##W(table, task -> idx);					\
+		task -> stage = TASK_HASH;						\
+		break;									\
+	case TASK_HASH:									\
+		complete(sched, task, match_##W(table, task -> idx, task -> hash.FIELD) ? \
+			 task -> idx : BT_NOT_FOUND);					\
+		break;									\
+	}										\
+}
+
+DEFINE_STEP(64, h64)
+DEFINE_STEP(128, h128)
+DEFINE_STEP(192, h192)
+
+static void step(bt_lookup_sched *sched, bt_lookup_task *task)
+{
+	if (sched -> table -> hash_type == 64)
+		step_64(sched, task);
+	else if (sched -> table -> hash_type == 128)
+		step_128(sched, task);
+	else if (sched -> table -> hash_type == 192)
+		step_192(sched, task);
+}
+
+/*
+ * Advances the slots in round robin order until one is free. A slot is revisited
+ * only after all the others had their turn, which gives its prefetch time to
+ * complete.
+ */
+static bt_lookup_task *acquire_slot(bt_lookup_sched *sched)
+{
+	bt_lookup_task *task;
+
+	while (1) {
+		task = &sched -> tasks[sched -> next];
+		if (++sched -> next == sched -> num_slots)
+			sched -> next = 0;
+		if (task -> stage != TASK_FREE)
+			step(sched, task);
+		if (task -> stage == TASK_FREE)
+			break;
+	}
+
+	sched -> in_flight++;
+	return task;
+}
+
+#define DEFINE_SUBMIT(W, HASH_T, FIELD)							\
+void bt_sched_submit_##W(bt_lookup_sched *sched, HASH_T hash,				\
+			 bt_lookup_callback callback, void *user_data)			\
+{											\
+	const bt_table *table = sched -> table;						\
+	bt_lookup_task *task;								\
+											\
+	if (is_zero_##W(hash)) {							\
+		callback(user_data, BT_NOT_FOUND);					\
+		return;									\
+	}										\
+											\
+	task = acquire_slot(sched);							\
+	task -> hash.FIELD = hash = mix_##W(table, hash);			\
+	task -> callback = callback;							\
+	task -> user_data = user_data;							\
+											\
+	if (table -> bloom_filter) {							\
+		task -> digest = bloom_digest_##W(hash);				\
+		PREFETCH(bloom_block(table -> bloom_filter, task -> digest));		\
+		task -> stage = TASK_BLOOM;						\
+	}										\
+	else {										\
+		task -> idx = ot_idx_##W(table, hash);					\
+		PREFETCH(&table -> offset_table[task -> idx]);				\
+		task -> stage = TASK_OFFSET;						\
+	}										\
+}
+
+DEFINE_SUBMIT(64, uint64_t, h64)
+DEFINE_SUBMIT(128, uint128_t, h128)
+DEFINE_SUBMIT(192, uint192_t, h192)
+
+void bt_sched_drain(bt_lookup_sched *sched)
+{
+	while (sched -> in_flight) {
+		bt_lookup_task *task = &sched -> tasks[sched -> next];
+		if (++sched -> next == sched -> num_slots)
+			sched -> next = 0;
+		if (task -> stage != TASK_FREE)
+			step(sched, task);
+	}
+}
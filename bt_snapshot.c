@@ -0,0 +1,134 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "bt_hash_types.h"
+
+/*
+ * Snapshot layout, native byte order: the header, the Offset Table, the Hash
+ * Table (hash_type / 32 words per slot), the Bloom filter blocks, if any, and
+ * the stash keys, if any.
+ */
+#define SNAPSHOT_MAGIC "BTTABLE3"
+
+typedef struct {
+	char magic[8];
+	unsigned int hash_type;
+	unsigned int offset_table_size;
+	unsigned int hash_table_size;
+	unsigned int bloom_blocks;
+	unsigned int stash_keys;
+	unsigned int premix;
+} snapshot_header;
+
+int bt_table_save(const bt_table *table, const char *filename)
+{
+	snapshot_header header;
+	size_t ht_words = (size_t)table -> hash_table_size * (table -> hash_type / 32);
+	FILE *fp;
+	int ret = 0;
+
+	memcpy(header.magic, SNAPSHOT_MAGIC, 8);
+	header.hash_type = table -> hash_type;
+	header.offset_table_size = table -> offset_table_size;
+	header.hash_table_size = table -> hash_table_size;
+	header.bloom_blocks = table -> bloom_filter ? table -> bloom_filter -> num_blocks : 0;
+	header.stash_keys = table -> stash ? table -> stash -> num_keys : 0;
+	header.premix = table -> premix;
+
+	fp = fopen(filename, "wb");
+	if (fp == NULL)
+		return 1;
+
+	if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+	    fwrite(table -> offset_table, sizeof(OFFSET_TABLE_WORD), table -> offset_table_size, fp) != table -> offset_table_size ||
+	    fwrite(table -> hash_table, sizeof(unsigned int), ht_words, fp) != ht_words)
+		ret = 1;
+	else if (header.bloom_blocks &&
+		 fwrite(table -> bloom_filter -> blocks, 8 * sizeof(unsigned int), header.bloom_blocks, fp) != header.bloom_blocks)
+		ret = 1;
+	else if (header.stash_keys &&
+		 fwrite(table -> stash -> keys, table -> hash_type / 8, header.stash_keys, fp) != header.stash_keys)
+		ret = 1;
+
+	if (fclose(fp))
+		ret = 1;
+
+	return ret;
+}
+
+int bt_table_load(bt_table *table, const char *filename)
+{
+	snapshot_header header;
+	OFFSET_TABLE_WORD *offset_table = NULL;
+	unsigned int *hash_table = NULL;
+	bt_bloom_filter *filter = NULL;
+	bt_stash *stash = NULL;
+	size_t ht_words;
+	FILE *fp;
+
+	fp = fopen(filename, "rb");
+	if (fp == NULL)
+		return 1;
+
+	if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, SNAPSHOT_MAGIC, 8) ||
+	    !BT_VALID_HASH_TYPE(header.hash_type) ||
+	    !header.offset_table_size || !header.hash_table_size) {
+		fclose(fp);
+		return 1;
+	}
+	ht_words = (size_t)header.hash_table_size * (header.hash_type / 32);
+
+	if (bt_malloc((void **)&offset_table, header.offset_table_size * sizeof(OFFSET_TABLE_WORD)))
+		bt_error("Failed to allocate memory: offset_table.");
+	if (bt_memalign_alloc((void **)&hash_table, 16, ht_words * sizeof(unsigned int)))
+		bt_error("Couldn't allocate hash_table.");
+	if (header.bloom_blocks) {
+		if (bt_malloc((void **)&filter, sizeof(bt_bloom_filter)))
+			bt_error("Failed to allocate memory: filter.");
+		filter -> num_blocks = header.bloom_blocks;
+		if (bt_memalign_alloc((void **)&filter -> blocks, 64, (size_t)header.bloom_blocks * 8 * sizeof(unsigned int)))
+			bt_error("Couldn't allocate Bloom filter.");
+	}
+	if (header.stash_keys) {
+		if (bt_malloc((void **)&stash, sizeof(bt_stash)))
+			bt_error("Failed to allocate memory: stash.");
+		stash -> num_keys = header.stash_keys;
+		if (bt_malloc(&stash -> keys, (size_t)header.stash_keys * (header.hash_type / 8)))
+			bt_error("Failed to allocate memory: stash -> keys.");
+	}
+
+	if (fread(offset_table, sizeof(OFFSET_TABLE_WORD), header.offset_table_size, fp) != header.offset_table_size ||
+	    fread(hash_table, sizeof(unsigned int), ht_words, fp) != ht_words ||
+	    (filter && fread(filter -> blocks, 8 * sizeof(unsigned int), filter -> num_blocks, fp) != filter -> num_blocks) ||
+	    (stash && fread(stash -> keys, header.hash_type / 8, stash -> num_keys, fp) != stash -> num_keys)) {
+		fclose(fp);
+		bt_free((void **)&offset_table);
+		bt_free((void **)&hash_table);
+		bt_bloom_free(&filter);
+		bt_stash_free(&stash);
+		return 1;
+	}
+	fclose(fp);
+
+	bt_table_init(table, header.hash_type, hash_table, offset_table,
+		      header.offset_table_size, header.hash_table_size);
+	table -> bloom_filter = filter;
+	table -> stash = stash;
+	table -> premix = header.premix;
+
+	return 0;
+}
+
+void bt_table_free(bt_table *table)
+{
+	bt_free((void **)&table -> hash_table);
+	bt_free((void **)&table -> offset_table);
+	bt_bloom_free(&table -> bloom_filter);
+	bt_stash_free(&table -> stash);
+}
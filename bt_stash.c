@@ -0,0 +1,93 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+/*
+ * Stash of the keys whose buckets found no offset. It holds a few keys at
+ * most, kept sorted so that a lookup is a binary search, and a key is added
+ * by moving the larger ones up.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "bt_hash_types.h"
+
+#define KEY(s, i) ((unsigned char *)(s) -> keys + (size_t)(i) * key_bytes)
+
+/* Position of the first key not below key. */
+static unsigned int lower_bound(const bt_stash *stash, const void *key, unsigned int key_bytes)
+{
+	unsigned int lo = 0, hi = stash -> num_keys;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (memcmp(KEY(stash, mid), key, key_bytes) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+unsigned int bt_stash_find(const bt_stash *stash, const void *key, unsigned int key_bytes)
+{
+	unsigned int i = lower_bound(stash, key, key_bytes);
+
+	if (i < stash -> num_keys && !memcmp(KEY(stash, i), key, key_bytes))
+		return i;
+	return BT_NOT_FOUND;
+}
+
+/* Returns 1 if the key was already there. */
+int bt_stash_insert(bt_stash *stash, const void *key, unsigned int key_bytes)
+{
+	unsigned int i = lower_bound(stash, key, key_bytes);
+	void *keys;
+
+	if (i < stash -> num_keys && !memcmp(KEY(stash, i), key, key_bytes))
+		return 1;
+
+	keys = realloc(stash -> keys, ((size_t)stash -> num_keys + 1) * key_bytes);
+	if (keys == NULL)
+		bt_error("Failed to allocate memory: stash -> keys.");
+	stash -> keys = keys;
+	memmove(KEY(stash, i + 1), KEY(stash, i), (size_t)(stash -> num_keys - i) * key_bytes);
+	memcpy(KEY(stash, i), key, key_bytes);
+	stash -> num_keys++;
+	return 0;
+}
+
+/* Returns the position the key had, BT_NOT_FOUND if it was not there. */
+unsigned int bt_stash_remove(bt_stash *stash, const void *key, unsigned int key_bytes)
+{
+	unsigned int i = bt_stash_find(stash, key, key_bytes);
+
+	if (i == BT_NOT_FOUND)
+		return i;
+	stash -> num_keys--;
+	memmove(KEY(stash, i), KEY(stash, i + 1), (size_t)(stash -> num_keys - i) * key_bytes);
+	return i;
+}
+
+bt_stash *bt_stash_build(const void *keys, unsigned int num_keys, unsigned int key_bytes)
+{
+	bt_stash *stash;
+	unsigned int i;
+
+	if (bt_calloc((void **)&stash, 1, sizeof(bt_stash)))
+		bt_error("Failed to allocate memory: stash.");
+	for (i = 0; i < num_keys; i++)
+		bt_stash_insert(stash, (const unsigned char *)keys + (size_t)i * key_bytes, key_bytes);
+	return stash;
+}
+
+void bt_stash_free(bt_stash **stash_ptr)
+{
+	if (!*stash_ptr)
+		return;
+	bt_free((void **)&(*stash_ptr) -> keys);
+	bt_free((void **)stash_ptr);
+}
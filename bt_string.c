@@ -0,0 +1,351 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+/*
+ * String keys on top of 64 or 128 bit tables of their hashes. The hash keeps
+ * two 64 bit lanes, each folding 16 bytes per step with a 64x64->128 bit
+ * multiply (the mum step of wyhash), and reads the last 1 to 16 bytes as two
+ * possibly overlapping words, so no byte is read twice within a step and no
+ * byte outside the string is read.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "bt_hash_types.h"
+
+#define K0 0xa0761d6478bd642fULL
+#define K1 0xe7037ed1a0b428dbULL
+#define K2 0x8ebc6af09c88c6e3ULL
+#define K3 0x589965cc75374cc3ULL
+
+#define LOOKUP_CHUNK 256
+
+static inline uint64_t mum(uint64_t a, uint64_t b)
+{
+	unsigned __int128 r = (unsigned __int128)a * b;
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t read64(const unsigned char *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t read32(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+uint128_t bt_hash_string(const void *key, size_t len, uint64_t seed)
+{
+	const unsigned char *p = key;
+	uint64_t h1 = seed ^ K0, h2 = mum(seed ^ K1, K2), a, b;
+	size_t n = len;
+	uint128_t h;
+
+	for (; n > 16; n -= 16, p += 16) {
+		a = read64(p);
+		b = read64(p + 8);
+		h1 = mum(a ^ K1, b ^ h1);
+		h2 = mum(b ^ K2, a ^ h2);
+	}
+
+	if (n >= 8) {
+		a = read64(p);
+		b = read64(p + n - 8);
+	}
+	else if (n >= 4) {
+		a = read32(p);
+		b = read32(p + n - 4);
+	}
+	else if (n) {
+		a = ((uint64_t)p[0] << 16) | ((uint64_t)p[n >> 1] << 8) | p[n - 1];
+		b = 0;
+	}
+	else
+		a = b = 0;
+
+	h1 = mum(a ^ K1, b ^ h1 ^ len);
+	h2 = mum(b ^ K2, a ^ h2 ^ len);
+	h.LO64 = mum(h1 ^ K3, h2 ^ K0);
+	h.HI64 = mum(h2 ^ K3, h1 ^ K1);
+	return h;
+}
+
+/* An all zero key marks an empty slot, such hashes are moved to 1. */
+static inline uint64_t digest_64(const bt_string_table *st, const void *key, size_t len)
+{
+	uint64_t d = bt_hash_string(key, len, st -> seed).LO64;
+	return d ? d : 1;
+}
+
+static inline uint128_t digest_128(const bt_string_table *st, const void *key, size_t len)
+{
+	uint128_t d = bt_hash_string(key, len, st -> seed);
+	if (!(d.LO64 | d.HI64))
+		d.LO64 = 1;
+	return d;
+}
+
+/* Hash Table slot of the string, or BT_NOT_FOUND. */
+static unsigned int find(const bt_string_table *st, const void *key, size_t len)
+{
+	if (st -> hash_type == 64)
+		return bt_lookup_64(st -> table, digest_64(st, key, len));
+	return bt_lookup_128(st -> table, digest_128(st, key, len));
+}
+
+static int same_string(const bt_string_table *st, unsigned int idx, const void *key, size_t len)
+{
+	return st -> offsets[idx + 1] - st -> offsets[idx] == len &&
+	       !memcmp(st -> blob + st -> offsets[idx], key, len);
+}
+
+static void hash_strings(const bt_string_table *st, const char *blob, const uint64_t *offsets,
+			 unsigned int num_strings, void *keys)
+{
+	unsigned int i;
+
+#if _OPENMP
+#pragma omp parallel for
+#endif
+	for (i = 0; i < num_strings; i++) {
+		const char *s = blob + offsets[i];
+		size_t len = offsets[i + 1] - offsets[i];
+
+		if (st -> hash_type == 64)
+			((uint64_t *)keys)[i] = digest_64(st, s, len);
+		else
+			((uint128_t *)keys)[i] = digest_128(st, s, len);
+	}
+}
+
+/*
+ * Copies the strings into st -> blob in slot order. Returns 1, with nothing
+ * allocated, if two different strings share a slot.
+ */
+static int copy_strings(bt_string_table *st, const char *blob, const uint64_t *offsets, unsigned int num_strings)
+{
+	unsigned int size = st -> table -> hash_table_size, *slot, *first, i;
+	uint64_t total = 0;
+	int collision = 0;
+
+	if (bt_malloc((void **)&slot, (size_t)num_strings * sizeof(unsigned int)))
+		bt_error("Failed to allocate memory: slot.");
+	if (bt_malloc((void **)&first, (size_t)size * sizeof(unsigned int)))
+		bt_error("Failed to allocate memory: first.");
+	if (bt_calloc((void **)&st -> offsets, (size_t)size + 1, sizeof(uint64_t)))
+		bt_error("Failed to allocate memory: offsets.");
+	memset(first, 0xff, (size_t)size * sizeof(unsigned int));
+
+#if _OPENMP
+#pragma omp parallel for
+#endif
+	for (i = 0; i < num_strings; i++)
+		slot[i] = find(st, blob + offsets[i], offsets[i + 1] - offsets[i]);
+
+	for (i = 0; i < num_strings && !collision; i++) {
+		unsigned int f = first[slot[i]];
+		uint64_t len = offsets[i + 1] - offsets[i];
+
+		if (f == 0xffffffff) {
+			first[slot[i]] = i;
+			st -> offsets[slot[i]] = len;
+		}
+		else
+			collision = offsets[f + 1] - offsets[f] != len || memcmp(blob + offsets[f], blob + offsets[i], len);
+	}
+	bt_free((void **)&slot);
+
+	if (collision) {
+		bt_free((void **)&first);
+		bt_free((void **)&st -> offsets);
+		return 1;
+	}
+
+	for (i = 0; i <= size; i++) {
+		uint64_t len = st -> offsets[i];
+		st -> offsets[i] = total;
+		total += len;
+	}
+	if (bt_malloc((void **)&st -> blob, total ? total : 1))
+		bt_error("Failed to allocate memory: blob.");
+	for (i = 0; i < size; i++)
+		if (first[i] != 0xffffffff)
+			memcpy(st -> blob + st -> offsets[i], blob + offsets[first[i]], st -> offsets[i + 1] - st -> offsets[i]);
+
+	bt_free((void **)&first);
+	return 0;
+}
+
+static void free_table(bt_string_table *st)
+{
+	bt_table_free(st -> table);
+	bt_free((void **)&st -> table);
+}
+
+int bt_string_table_build(bt_string_table *st, int htype, const char *blob, const uint64_t *offsets,
+			  unsigned int num_strings, uint64_t seed, int verify, bt_build_options *opts)
+{
+	bt_build_options local;
+	unsigned int attempt;
+	void *keys;
+
+	memset(st, 0, sizeof(bt_string_table));
+	st -> hash_type = htype == 64 ? 64 : 128;
+	if (opts)
+		local = *opts;
+	else
+		memset(&local, 0, sizeof(local));
+	/* copy_strings() keeps the strings by Hash Table slot, stashed keys have none. */
+	if (verify)
+		local.stash_buckets = 0;
+	opts = &local;
+
+	if (bt_malloc(&keys, (size_t)num_strings * (st -> hash_type / 8)))
+		bt_error("Failed to allocate memory: keys.");
+
+	for (attempt = 0; attempt < BT_STRING_MAX_SEEDS; attempt++) {
+		st -> seed = seed + attempt;
+		hash_strings(st, blob, offsets, num_strings, keys);
+		st -> table = bt_build_table(st -> hash_type, keys, num_strings, opts);
+		if (!st -> table)
+			break;
+		if (!verify || !copy_strings(st, blob, offsets, num_strings))
+			break;
+
+		fprintf(stderr, "Two strings share a hash, retrying with the next seed.\n");
+		free_table(st);
+	}
+
+	bt_free(&keys);
+	return st -> table == NULL;
+}
+
+void bt_string_table_free(bt_string_table *st)
+{
+	if (st -> table)
+		free_table(st);
+	bt_free((void **)&st -> blob);
+	bt_free((void **)&st -> offsets);
+}
+
+int bt_string_lookup(const bt_string_table *st, const void *key, size_t len)
+{
+	unsigned int idx = find(st, key, len);
+
+	return idx != BT_NOT_FOUND && (!st -> blob || same_string(st, idx, key, len));
+}
+
+unsigned int bt_string_lookup_batch(const bt_string_table *st, const char *blob, const uint64_t *offsets,
+				    unsigned int num_strings, uint64_t *hit_bitmap)
+{
+	union {
+		uint64_t h64[LOOKUP_CHUNK];
+		uint128_t h128[LOOKUP_CHUNK];
+	} keys;
+	uint64_t chunk_hits[LOOKUP_CHUNK / 64];
+	unsigned int base, i, n, hits = 0;
+
+	for (i = 0; i < (num_strings + 63) / 64; i++)
+		hit_bitmap[i] = 0;
+
+	for (base = 0; base < num_strings; base += LOOKUP_CHUNK) {
+		n = num_strings - base < LOOKUP_CHUNK ? num_strings - base : LOOKUP_CHUNK;
+		for (i = 0; i < n; i++) {
+			const char *s = blob + offsets[base + i];
+			size_t len = offsets[base + i + 1] - offsets[base + i];
+
+			if (st -> hash_type == 64)
+				keys.h64[i] = digest_64(st, s, len);
+			else
+				keys.h128[i] = digest_128(st, s, len);
+		}
+
+		if (st -> hash_type == 64)
+			bt_lookup_batch_64(st -> table, keys.h64, n, chunk_hits);
+		else
+			bt_lookup_batch_128(st -> table, keys.h128, n, chunk_hits);
+
+		for (i = 0; i < n; i++) {
+			if (!(chunk_hits[i / 64] >> (i % 64) & 1))
+				continue;
+			if (st -> blob) {
+				unsigned int idx = st -> hash_type == 64 ? bt_lookup_64(st -> table, keys.h64[i]) :
+					bt_lookup_128(st -> table, keys.h128[i]);
+
+				if (!same_string(st, idx, blob + offsets[base + i], offsets[base + i + 1] - offsets[base + i]))
+					continue;
+			}
+			hit_bitmap[(base + i) / 64] |= 1ULL << ((base + i) % 64);
+			hits++;
+		}
+	}
+	return hits;
+}
+
+int bt_string_list_load(bt_string_list *list, const char *filename)
+{
+	FILE *fp = fopen(filename, "rb");
+	char *end, *line, *out, *eol;
+	unsigned int num = 0;
+	long size;
+
+	memset(list, 0, sizeof(bt_string_list));
+	if (fp == NULL)
+		return 1;
+	if (fseek(fp, 0, SEEK_END) || (size = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET)) {
+		fclose(fp);
+		return 1;
+	}
+	if (bt_malloc((void **)&list -> blob, size + 1))
+		bt_error("Failed to allocate memory: blob.");
+	if (fread(list -> blob, 1, size, fp) != (size_t)size) {
+		fclose(fp);
+		bt_free((void **)&list -> blob);
+		return 1;
+	}
+	fclose(fp);
+
+	end = list -> blob + size;
+	for (line = list -> blob; line < end && (eol = memchr(line, '\n', end - line)); line = eol + 1)
+		num++;
+	if (line < end)
+		num++;
+	if (bt_malloc((void **)&list -> offsets, ((size_t)num + 1) * sizeof(uint64_t)))
+		bt_error("Failed to allocate memory: offsets.");
+
+	/* Drops the line ends by moving every line down over them. */
+	out = list -> blob;
+	for (line = list -> blob; line < end; line = eol + 1) {
+		size_t len;
+
+		eol = memchr(line, '\n', end - line);
+		if (!eol)
+			eol = end;
+		len = eol - line;
+		if (len && line[len - 1] == '\r')
+			len--;
+		list -> offsets[list -> num_strings++] = out - list -> blob;
+		memmove(out, line, len);
+		out += len;
+	}
+	list -> offsets[list -> num_strings] = out - list -> blob;
+
+	return 0;
+}
+
+void bt_string_list_free(bt_string_list *list)
+{
+	bt_free((void **)&list -> blob);
+	bt_free((void **)&list -> offsets);
+	list -> num_strings = 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "bt_hash_types.h"
+#include "bt_telemetry.h"
+
+#if BT_TELEMETRY
+
+int bt_telemetry_active = 1;
+uint64_t bt_telemetry_mask = 1023;
+__thread bt_telemetry_slot *bt_telemetry_tls;
+
+static bt_telemetry_slot slots[BT_TELEMETRY_MAX_THREADS];
+static unsigned int num_slots;
+
+bt_telemetry_slot *bt_telemetry_claim(void)
+{
+	unsigned int i = __atomic_fetch_add(&num_slots, 1, __ATOMIC_RELAXED);
+
+	if (i >= BT_TELEMETRY_MAX_THREADS)
+		return NULL;
+	bt_telemetry_tls = &slots[i];
+	return bt_telemetry_tls;
+}
+
+/* Never 0, which marks a call that is not sampled. */
+uint64_t bt_telemetry_ticks(void)
+{
+	return TELEMETRY_TICKS() | 1;
+}
+
+static unsigned int bucket(uint64_t ticks)
+{
+	unsigned int k = 63 - __builtin_clzll(ticks | 1);
+	return k < BT_TELEMETRY_BUCKETS ? k : BT_TELEMETRY_BUCKETS - 1;
+}
+
+void bt_telemetry_sample(bt_telemetry_slot *slot, uint64_t start)
+{
+	slot -> t.samples++;
+	slot -> t.latency[bucket(TELEMETRY_TICKS() - start)]++;
+}
+
+void bt_telemetry_sample_batch(bt_telemetry_slot *slot, uint64_t start, unsigned int num)
+{
+	slot -> t.batch_samples++;
+	slot -> t.batch_latency[bucket((TELEMETRY_TICKS() - start) / num)]++;
+}
+
+/* The period is rounded up to a power of 2, 0 stops sampling. */
+int bt_telemetry_configure(int active, unsigned int sample_period)
+{
+	uint64_t period = 1;
+
+	while (period < sample_period)
+		period <<= 1;
+	bt_telemetry_mask = sample_period ? period - 1 : ~0ULL;
+	bt_telemetry_active = active;
+	return 0;
+}
+
+void bt_telemetry_snapshot(bt_telemetry *t)
+{
+	unsigned int i, k, n = __atomic_load_n(&num_slots, __ATOMIC_RELAXED);
+
+	memset(t, 0, sizeof(bt_telemetry));
+	n = n < BT_TELEMETRY_MAX_THREADS ? n : BT_TELEMETRY_MAX_THREADS;
+	for (i = 0; i < n; i++) {
+		const bt_telemetry *s = &slots[i].t;
+
+		t -> lookups += s -> lookups;
+		t -> hits += s -> hits;
+		t -> batch_calls += s -> batch_calls;
+		t -> batch_lookups += s -> batch_lookups;
+		t -> batch_hits += s -> batch_hits;
+		t -> samples += s -> samples;
+		t -> batch_samples += s -> batch_samples;
+		for (k = 0; k < BT_TELEMETRY_BUCKETS; k++) {
+			t -> latency[k] += s -> latency[k];
+			t -> batch_latency[k] += s -> batch_latency[k];
+		}
+	}
+	t -> threads = n;
+}
+
+/* Counts of threads running lookups meanwhile may survive in part. */
+void bt_telemetry_reset(void)
+{
+	unsigned int i, n = __atomic_load_n(&num_slots, __ATOMIC_RELAXED);
+
+	n = n < BT_TELEMETRY_MAX_THREADS ? n : BT_TELEMETRY_MAX_THREADS;
+	for (i = 0; i < n; i++)
+		memset(&slots[i].t, 0, sizeof(bt_telemetry));
+}
+
+#else
+
+/* Suppress unused variable warning. */
+#define UNUSED(x) (void)(x)
+
+int bt_telemetry_configure(int active, unsigned int sample_period)
+{
+	UNUSED(active);
+	UNUSED(sample_period);
+	return 1;
+}
+
+void bt_telemetry_snapshot(bt_telemetry *t)
+{
+	memset(t, 0, sizeof(bt_telemetry));
+}
+
+void bt_telemetry_reset(void)
+{
+}
+
+#endif
+
+uint64_t bt_telemetry_percentile(const uint64_t *histogram, double p)
+{
+	uint64_t total = 0, count = 0;
+	unsigned int k;
+
+	for (k = 0; k < BT_TELEMETRY_BUCKETS; k++)
+		total += histogram[k];
+	if (!total)
+		return 0;
+
+	for (k = 0; k < BT_TELEMETRY_BUCKETS - 1; k++) {
+		count += histogram[k];
+		if (count >= total * (p / 100.0))
+			break;
+	}
+	return (2ULL << k) - 1;
+}
@@ -0,0 +1,109 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+/*
+ * Telemetry hooks of the lookup paths, see bt_telemetry_configure(). With
+ * BT_TELEMETRY undefined all of them expand to nothing.
+ */
+
+#if BT_TELEMETRY
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TELEMETRY_TICKS() __rdtsc()
+#else
+#include <time.h>
+static inline uint64_t telemetry_ticks(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#define TELEMETRY_TICKS() telemetry_ticks()
+#endif
+
+/* The counters updated on every call share the first cache line. */
+typedef struct {
+	bt_telemetry t;
+} __attribute__((aligned(64))) bt_telemetry_slot;
+
+extern int bt_telemetry_active;
+extern uint64_t bt_telemetry_mask; // Sample period - 1, a power of 2.
+extern __thread bt_telemetry_slot *bt_telemetry_tls;
+extern bt_telemetry_slot *bt_telemetry_claim(void);
+extern uint64_t bt_telemetry_ticks(void);
+extern void bt_telemetry_sample(bt_telemetry_slot *slot, uint64_t start);
+extern void bt_telemetry_sample_batch(bt_telemetry_slot *slot, uint64_t start, unsigned int num);
+
+static inline bt_telemetry_slot *telemetry_slot(void)
+{
+	if (!__builtin_expect(bt_telemetry_active, 1))
+		return NULL;
+	if (__builtin_expect(bt_telemetry_tls != NULL, 1))
+		return bt_telemetry_tls;
+	return bt_telemetry_claim();
+}
+
+/*
+ * Counts a call and returns its start tick if sampled, else 0. The lookup
+ * count itself picks the samples, which saves a countdown per call. Sampling
+ * is out of line to keep the lookups small.
+ */
+static inline uint64_t telemetry_begin(bt_telemetry_slot *slot)
+{
+	if (!slot || __builtin_expect(slot -> t.lookups++ & bt_telemetry_mask, 1))
+		return 0;
+	return bt_telemetry_ticks();
+}
+
+/* A batch is sampled when its keys cross a multiple of the sample period. */
+static inline uint64_t telemetry_begin_batch(bt_telemetry_slot *slot, unsigned int num)
+{
+	uint64_t n;
+
+	if (!slot)
+		return 0;
+	n = slot -> t.batch_lookups;
+	slot -> t.batch_lookups = n + num;
+	slot -> t.batch_calls++;
+	if ((n & ~bt_telemetry_mask) == ((n + num) & ~bt_telemetry_mask) || !num)
+		return 0;
+	return bt_telemetry_ticks();
+}
+
+static inline void telemetry_end(bt_telemetry_slot *slot, uint64_t start, unsigned int hit)
+{
+	if (!slot)
+		return;
+	slot -> t.hits += hit;
+	if (__builtin_expect(start != 0, 0))
+		bt_telemetry_sample(slot, start);
+}
+
+static inline void telemetry_end_batch(bt_telemetry_slot *slot, uint64_t start, unsigned int num, unsigned int hits)
+{
+	if (!slot)
+		return;
+	slot -> t.batch_hits += hits;
+	if (start)
+		bt_telemetry_sample_batch(slot, start, num);
+}
+
+#define TELEMETRY_DECLARE bt_telemetry_slot *telemetry_slot_ptr; uint64_t telemetry_start;
+#define TELEMETRY_BEGIN() do { telemetry_slot_ptr = telemetry_slot(); telemetry_start = telemetry_begin(telemetry_slot_ptr); } while (0)
+#define TELEMETRY_BEGIN_BATCH(num) do { telemetry_slot_ptr = telemetry_slot(); telemetry_start = telemetry_begin_batch(telemetry_slot_ptr, num); } while (0)
+#define TELEMETRY_END(hit) telemetry_end(telemetry_slot_ptr, telemetry_start, hit)
+#define TELEMETRY_END_BATCH(num, hits) telemetry_end_batch(telemetry_slot_ptr, telemetry_start, num, hits)
+
+#else
+
+#define TELEMETRY_DECLARE
+#define TELEMETRY_BEGIN() do {} while (0)
+#define TELEMETRY_BEGIN_BATCH(num) do {} while (0)
+#define TELEMETRY_END(hit) do {} while (0)
+#define TELEMETRY_END_BATCH(num, hits) do {} while (0)
+
+#endif
@@ -0,0 +1,29 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+/*
+ * Static tracepoints of provider "bt" in the table builder, for bpftrace or
+ * perf probe, e.g. bpftrace -e 'usdt:./demo.out:bt:retry { printf("%d\n", arg0); }'.
+ * A disabled probe is a single nop. Without <sys/sdt.h> (systemtap-sdt-dev),
+ * or with BT_NO_USDT defined, they compile to nothing.
+ */
+
+#if defined(__has_include) && !defined(BT_NO_USDT)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define BT_USDT 1
+#endif
+#endif
+
+#if BT_USDT
+#define BT_TRACE2(name, a, b) DTRACE_PROBE2(bt, name, a, b)
+#define BT_TRACE3(name, a, b, c) DTRACE_PROBE3(bt, name, a, b, c)
+#define BT_TRACE4(name, a, b, c, d) DTRACE_PROBE4(bt, name, a, b, c, d)
+#else
+#define BT_TRACE2(name, a, b) do {} while (0)
+#define BT_TRACE3(name, a, b, c) do {} while (0)
+#define BT_TRACE4(name, a, b, c, d) do {} while (0)
+#endif
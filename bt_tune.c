@@ -0,0 +1,214 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+/*
+ * Placement model. Buckets are placed largest first, so a bucket of k hashes
+ * meets a Hash Table filled to the fraction f left by the larger ones and an
+ * offset fits with probability (1 - f)^k. Integrating 1 / (1 - f)^k over each
+ * bucket size gives the expected offsets tried, and the chance that none of
+ * the limit offsets create_tables() scans fits, together with the chance that
+ * two hashes of a bucket share a Hash Table slot, gives the failure probability.
+ * Costs per key, Offset Table slot, key of a larger bucket and offset tried
+ * were measured on a single thread with 64 bit hashes.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "bt_hash_types.h"
+
+#define TUNE_SAMPLE_SIZE 32768
+#define TUNE_MAX_BUCKET 64
+#define TUNE_NUM_LOADS 19 // Keys per Offset Table slot, 1.5 to 6.0.
+#define TUNE_LOAD_STEP 0.25
+#define TUNE_KEY_COST 5e-9
+#define TUNE_SLOT_COST 55e-9
+#define TUNE_HEAVY_KEY_COST 110e-9
+#define TUNE_TRY_COST 1.5e-9
+
+static const double hash_table_multipliers[] = { 1.001097317, 1.005, 1.01, 1.02, 1.05, 1.1 };
+#define TUNE_NUM_HT (sizeof(hash_table_multipliers) / sizeof(hash_table_multipliers[0]))
+
+/* x^k by squaring, k may be as large as a table size. */
+static double power(double x, unsigned long long k)
+{
+	double r = 1.0;
+
+	while (k) {
+		if (k & 1)
+			r *= x;
+		x *= x;
+		k >>= 1;
+	}
+	return r;
+}
+
+/*
+ * Buckets of a sample of num_sample hashes in an Offset Table of sample_ot_sz
+ * slots, scaled by scale. buckets[k] counts slots holding k hashes.
+ */
+static void sample_buckets(int htype, const void *hashes, unsigned int num_hashes, unsigned int num_sample,
+			   unsigned int sample_ot_sz, double scale, unsigned int *counts, double *buckets)
+{
+	uint64_t shift64 = (((1ULL << 63) % sample_ot_sz) * 2) % sample_ot_sz;
+	uint64_t shift128 = (shift64 * shift64) % sample_ot_sz;
+	unsigned int i;
+
+	memset(counts, 0, sample_ot_sz * sizeof(unsigned int));
+	for (i = 0; i < num_sample; i++) {
+		unsigned int idx = (unsigned int)((uint64_t)i * num_hashes / num_sample);
+
+		if (htype == 64)
+			idx = modulo64_31b(((const uint64_t *)hashes)[idx], sample_ot_sz);
+		else if (htype == 128)
+			idx = modulo128_31b(((const uint128_t *)hashes)[idx], sample_ot_sz, shift64);
+		else if (htype == 192)
+			idx = modulo192_31b(((const uint192_t *)hashes)[idx], sample_ot_sz, shift64, shift128);
+		else
+			idx = modulo_n_31b((const unsigned int *)hashes + (size_t)idx * BT_HASH_WORDS(htype),
+					   BT_HASH_WORDS(htype), sample_ot_sz);
+		counts[idx]++;
+	}
+
+	memset(buckets, 0, TUNE_MAX_BUCKET * sizeof(double));
+	for (i = 0; i < sample_ot_sz; i++)
+		buckets[counts[i] < TUNE_MAX_BUCKET ? counts[i] : TUNE_MAX_BUCKET - 1] += scale;
+}
+
+/* Expected offsets tried and the probability that an attempt succeeds. */
+static void predict(const double *buckets, unsigned int ht_sz, double *tries, double *heavy_keys, double *success)
+{
+	double m = ht_sz, f0 = 0;
+	unsigned long long limit = 0xffffffffULL % ht_sz + 1;
+	unsigned int k;
+
+	*tries = *heavy_keys = 0;
+	*success = 1;
+	for (k = TUNE_MAX_BUCKET - 1; k > 1; k--) {
+		double f1, empty;
+		unsigned long long j;
+
+		if (buckets[k] <= 0)
+			continue;
+		*heavy_keys += k * buckets[k];
+		f1 = f0 + k * buckets[k] / m;
+		if (f1 >= 1) {
+			*success = 0;
+			return;
+		}
+		*tries += m / k / (k - 1) * (1 / power(1 - f1, k - 1) - 1 / power(1 - f0, k - 1));
+		/* Two hashes of a bucket on the same Hash Table slot never fit. */
+		*success *= power(1 - 1 / m, (unsigned long long)(buckets[k] * k * (k - 1) / 2));
+
+		/* The last buckets of a size see the fullest table, stop once a bucket is safe. */
+		for (j = 0; j < (unsigned long long)buckets[k]; j++) {
+			double fail;
+
+			empty = 1 - f1 + (j + 1) * k / m;
+			fail = power(1 - power(empty, k), limit);
+			if (fail < 1e-15)
+				break;
+			*success *= 1 - fail;
+			if (*success < 1e-9)
+				return;
+		}
+		f0 = f1;
+	}
+}
+
+static unsigned int dupe_remove_size(unsigned int num_hashes, bt_tune_target target)
+{
+	unsigned int size = 128, want = target == BT_TUNE_SMALLEST ? num_hashes / 2 : num_hashes;
+
+	while (size < want && size < (1U << 30))
+		size <<= 1;
+	return size;
+}
+
+int bt_tune_parameters(int htype, const void *hashes, unsigned int num_hashes,
+		       bt_tune_target target, unsigned long long memory_budget_in_bytes,
+		       bt_tune_result *result)
+{
+	unsigned int *counts, num_sample, l, h, key_bytes = htype / 8;
+	double buckets[TUNE_MAX_BUCKET], width = 1.0 + ((double)key_bytes - 8) / 32.0, best_time = 0;
+	bt_tune_result candidate[TUNE_NUM_LOADS][TUNE_NUM_HT], *best = NULL, *smallest = NULL;
+	int fits = 0;
+
+	memset(result, 0, sizeof(bt_tune_result));
+	result -> multiplier_ot = 4.0 / 3.25;
+	result -> multiplier_ht = hash_table_multipliers[0];
+	result -> inc_ot = 0.05;
+	result -> inc_ht = 0.005;
+	result -> dupe_remove_ht_sz = dupe_remove_size(num_hashes, target);
+	if (!num_hashes)
+		return 0;
+
+	num_sample = num_hashes < TUNE_SAMPLE_SIZE ? num_hashes : TUNE_SAMPLE_SIZE;
+	if (bt_malloc((void **)&counts, (num_sample / 1.5 + 11) * sizeof(unsigned int)))
+		bt_error("Failed to allocate memory: counts.");
+
+	for (l = 0; l < TUNE_NUM_LOADS; l++) {
+		double load = 1.5 + l * TUNE_LOAD_STEP;
+		double multiplier_ot = 4.0 / load;
+		double easier = load > 1.5 ? load - TUNE_LOAD_STEP : load;
+		unsigned int ot_sz = (unsigned int)((double)num_hashes / 4.0 * multiplier_ot + 10.0);
+		unsigned int sample_ot_sz = (unsigned int)((double)ot_sz * num_sample / num_hashes + 0.5);
+
+		if (!sample_ot_sz)
+			sample_ot_sz = 1;
+		sample_buckets(htype, hashes, num_hashes, num_sample, sample_ot_sz,
+			       (double)ot_sz / sample_ot_sz, counts, buckets);
+
+		for (h = 0; h < TUNE_NUM_HT; h++) {
+			bt_tune_result *c = &candidate[l][h];
+			unsigned int ht_sz = (unsigned int)((double)num_hashes * hash_table_multipliers[h]) | 1;
+			double heavy_keys, success;
+
+			predict(buckets, ht_sz, &c -> offsets_tried, &heavy_keys, &success);
+
+			c -> multiplier_ot = multiplier_ot;
+			c -> multiplier_ht = hash_table_multipliers[h];
+			/* A failed attempt moves on to the next easier grid point. */
+			c -> inc_ot = 4.0 / easier - 4.0 / (easier + TUNE_LOAD_STEP);
+			c -> inc_ht = h + 1 < TUNE_NUM_HT ? hash_table_multipliers[h + 1] - hash_table_multipliers[h] : 0.05;
+			c -> dupe_remove_ht_sz = result -> dupe_remove_ht_sz;
+			c -> table_bytes = (unsigned long long)ot_sz * sizeof(OFFSET_TABLE_WORD) + (unsigned long long)ht_sz * key_bytes;
+			c -> failure_probability = 1 - success;
+			c -> seconds = (TUNE_KEY_COST * num_hashes + TUNE_SLOT_COST * ot_sz + TUNE_HEAVY_KEY_COST * heavy_keys +
+					TUNE_TRY_COST * c -> offsets_tried) *
+				       width / (success > 1e-3 ? success : 1e-3);
+
+			if (!smallest || c -> table_bytes < smallest -> table_bytes)
+				smallest = c;
+			if (memory_budget_in_bytes && c -> table_bytes > memory_budget_in_bytes)
+				continue;
+			if (!best || c -> seconds < best -> seconds)
+				best = c;
+		}
+	}
+	bt_free((void **)&counts);
+
+	if (best) {
+		fits = 1;
+		best_time = best -> seconds;
+		if (target == BT_TUNE_SMALLEST)
+			for (l = 0; l < TUNE_NUM_LOADS; l++)
+				for (h = 0; h < TUNE_NUM_HT; h++) {
+					bt_tune_result *c = &candidate[l][h];
+
+					if ((memory_budget_in_bytes && c -> table_bytes > memory_budget_in_bytes) ||
+					    c -> seconds > BT_TUNE_SMALLEST_SLOWDOWN * best_time)
+						continue;
+					if (c -> table_bytes < best -> table_bytes ||
+					    (c -> table_bytes == best -> table_bytes && c -> seconds < best -> seconds))
+						best = c;
+				}
+	}
+	else
+		best = smallest;
+
+	*result = *best;
+	return !fits;
+}
@@ -0,0 +1,372 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+/*
+ * Inserts and deletes without a rebuild. Every bucket keeps a list of its Hash
+ * Table slots, so that a bucket can be placed again when a new key's slot is
+ * taken. A new offset is searched the way create_tables() places singletons:
+ * the first key is put on a free slot, found by walking the Hash Table from
+ * the new key's slot, and the offset that maps it there is kept if the other
+ * keys land on free and distinct slots too.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "bt_hash_types.h"
+#include "bt_bloom.h"
+#include "bt_lookup.h"
+
+#define MAX_WORDS 6
+
+/* Steps that depend on the hash type, keys are passed by address. */
+typedef struct {
+	unsigned int words; // 32 bit words per key.
+	unsigned int (*ot_idx)(const bt_table *t, const void *key);
+	unsigned int (*ht_idx)(const bt_table *t, const void *key, unsigned int offset);
+	uint64_t (*digest)(const void *key);
+} key_ops;
+
+#define DEFINE_KEY_OPS(W, HASH_T)							\
+static unsigned int ot_idx_key_##W(const bt_table *t, const void *key)			\
+{											\
+	return ot_idx_##W(t, *(const HASH_T *)key);					\
+}											\
+											\
+static unsigned int ht_idx_key_##W(const bt_table *t, const void *key, unsigned int offset) \
+{											\
+	return ht_idx_##W(t, *(const HASH_T *)key, offset);				\
+}											\
+											\
+static uint64_t digest_key_##W(const void *key)					\
+{											\
+	return bloom_digest_##W(*(const HASH_T *)key);					\
+}											\
+											\
+static const key_ops ops_##W = { W / 32, ot_idx_key_##W, ht_idx_key_##W, digest_key_##W };
+
+DEFINE_KEY_OPS(64, uint64_t)
+DEFINE_KEY_OPS(128, uint128_t)
+DEFINE_KEY_OPS(192, uint192_t)
+
+/* Packed hash types are not supported, their slots hold a different number of words. */
+static const key_ops *get_ops(const bt_table *t)
+{
+	if (t -> hash_type == 64)
+		return &ops_64;
+	if (t -> hash_type == 128)
+		return &ops_128;
+	if (t -> hash_type != 192)
+		bt_error("Updates take 64, 128 or 192 bit tables only.");
+	return &ops_192;
+}
+
+/*
+ * Word i of the key in slot idx is hash_table[idx + i * hash_table_size], least
+ * significant first, the layout of the uint64_t, uint128_t and uint192_t keys
+ * on little endian machines.
+ */
+static void load_key(const bt_table *t, unsigned int words, unsigned int idx, void *key)
+{
+	unsigned int w[MAX_WORDS], i;
+
+	for (i = 0; i < words; i++)
+		w[i] = t -> hash_table[idx + i * t -> hash_table_size];
+	memcpy(key, w, words * sizeof(unsigned int));
+}
+
+static void store_key(bt_table *t, unsigned int words, unsigned int idx, const void *key)
+{
+	unsigned int w[MAX_WORDS], i;
+
+	memcpy(w, key, words * sizeof(unsigned int));
+	for (i = 0; i < words; i++)
+		t -> hash_table[idx + i * t -> hash_table_size] = w[i];
+}
+
+static void clear_slot(bt_table *t, unsigned int words, unsigned int idx)
+{
+	unsigned int i;
+
+	for (i = 0; i < words; i++)
+		t -> hash_table[idx + i * t -> hash_table_size] = 0;
+}
+
+static int empty_slot(const bt_table *t, unsigned int words, unsigned int idx)
+{
+	unsigned int i, any = 0;
+
+	for (i = 0; i < words; i++)
+		any |= t -> hash_table[idx + i * t -> hash_table_size];
+	return !any;
+}
+
+static int match_key(const bt_table *t, unsigned int words, unsigned int idx, const void *key)
+{
+	unsigned int w[MAX_WORDS], i;
+
+	memcpy(w, key, words * sizeof(unsigned int));
+	for (i = 0; i < words; i++)
+		if (t -> hash_table[idx + i * t -> hash_table_size] != w[i])
+			return 0;
+	return 1;
+}
+
+static int zero_key(unsigned int words, const void *key)
+{
+	unsigned int w[MAX_WORDS], i, any = 0;
+
+	memcpy(w, key, words * sizeof(unsigned int));
+	for (i = 0; i < words; i++)
+		any |= w[i];
+	return !any;
+}
+
+void bt_update_init(bt_update *u, bt_table *table)
+{
+	const key_ops *ops = get_ops(table);
+	unsigned int i;
+	uint192_t key;
+
+	memset(u, 0, sizeof(bt_update));
+	u -> table = table;
+	if (bt_malloc((void **)&u -> bucket_head, table -> offset_table_size * sizeof(unsigned int)))
+		bt_error("Failed to allocate memory: bucket_head.");
+	if (bt_malloc((void **)&u -> next_slot, table -> hash_table_size * sizeof(unsigned int)))
+		bt_error("Failed to allocate memory: next_slot.");
+	memset(u -> bucket_head, 0xff, table -> offset_table_size * sizeof(unsigned int));
+
+	for (i = 0; i < table -> hash_table_size; i++) {
+		unsigned int b;
+
+		if (empty_slot(table, ops -> words, i))
+			continue;
+		load_key(table, ops -> words, i, &key);
+		b = ops -> ot_idx(table, &key);
+		u -> next_slot[i] = u -> bucket_head[b];
+		u -> bucket_head[b] = i;
+		u -> num_keys++;
+	}
+}
+
+void bt_update_free(bt_update *u)
+{
+	bt_free((void **)&u -> bucket_head);
+	bt_free((void **)&u -> next_slot);
+}
+
+/*
+ * Places the n keys of bucket b, whose slots are clear, under a new offset.
+ * Returns 0 with their slots in slots[], 1 if no offset was found.
+ */
+static int place_bucket(bt_update *u, const key_ops *ops, unsigned int b, const uint192_t *keys,
+			unsigned int n, unsigned int start, unsigned int *slots)
+{
+	bt_table *t = u -> table;
+	unsigned int sz = t -> hash_table_size, z = ops -> ht_idx(t, &keys[0], 0);
+	unsigned int e = start, scanned, tried = 0, i, j;
+
+	for (scanned = 0; scanned < sz && tried < BT_UPDATE_MAX_OFFSETS; scanned++, e = e + 1 == sz ? 0 : e + 1) {
+		unsigned int offset;
+
+		if (!empty_slot(t, ops -> words, e))
+			continue;
+		offset = sz - z + e;
+		tried++;
+		for (i = 0; i < n; i++) {
+			slots[i] = ops -> ht_idx(t, &keys[i], offset);
+			if (!empty_slot(t, ops -> words, slots[i]))
+				break;
+			for (j = 0; j < i && slots[j] != slots[i]; j++);
+			if (j < i)
+				break;
+		}
+		if (i == n) {
+			t -> offset_table[b] = offset;
+			u -> offsets_tried += tried;
+			return 0;
+		}
+	}
+	u -> offsets_tried += tried;
+	return 1;
+}
+
+/*
+ * Places bucket b again, with key added when not NULL, and stores new_key on
+ * the slot reserve once it is free when not NULL. Returns 0 if the bucket was
+ * placed, 1 with the tables unchanged otherwise.
+ */
+static int move_bucket(bt_update *u, const key_ops *ops, unsigned int b, const void *key,
+		       const void *new_key, unsigned int reserve)
+{
+	bt_table *t = u -> table;
+	unsigned int words = ops -> words, i, n = 0, start = reserve;
+	unsigned int old_slots[BT_UPDATE_MAX_BUCKET], slots[BT_UPDATE_MAX_BUCKET];
+	uint192_t keys[BT_UPDATE_MAX_BUCKET];
+
+	/* The new key goes first, it is placed on the free slots walked. */
+	if (key)
+		memcpy(&keys[n++], key, words * sizeof(unsigned int));
+	for (i = u -> bucket_head[b]; i != BT_NOT_FOUND; i = u -> next_slot[i]) {
+		if (n == BT_UPDATE_MAX_BUCKET)
+			return 1;
+		load_key(t, words, i, &keys[n]);
+		old_slots[n++] = i;
+	}
+	for (i = key ? 1 : 0; i < n; i++)
+		clear_slot(t, words, old_slots[i]);
+	if (new_key)
+		store_key(t, words, reserve, new_key);
+
+	if (place_bucket(u, ops, b, keys, n, start, slots)) {
+		if (new_key)
+			clear_slot(t, words, reserve);
+		for (i = key ? 1 : 0; i < n; i++)
+			store_key(t, words, old_slots[i], &keys[i]);
+		return 1;
+	}
+
+	u -> bucket_head[b] = BT_NOT_FOUND;
+	for (i = 0; i < n; i++) {
+		store_key(t, words, slots[i], &keys[i]);
+		u -> next_slot[slots[i]] = u -> bucket_head[b];
+		u -> bucket_head[b] = slots[i];
+	}
+	u -> moved_buckets++;
+	return 0;
+}
+
+static unsigned int bucket_size(const bt_update *u, unsigned int b)
+{
+	unsigned int i, n = 0;
+
+	for (i = u -> bucket_head[b]; i != BT_NOT_FOUND; i = u -> next_slot[i])
+		n++;
+	return n;
+}
+
+static void added(bt_update *u, const key_ops *ops, const void *key)
+{
+	if (u -> table -> bloom_filter)
+		bt_bloom_insert(u -> table -> bloom_filter, ops -> digest(key));
+	u -> inserts++;
+}
+
+/*
+ * When the new key's slot is taken, either its own bucket moves with it, or
+ * the bucket holding the slot moves elsewhere and frees it. The smaller of the
+ * two is tried first, as a bucket of k keys needs k - 1 more free slots.
+ */
+static int insert(bt_update *u, const void *key)
+{
+	bt_table *t = u -> table;
+	const key_ops *ops = get_ops(t);
+	unsigned int words = ops -> words, b, other, idx;
+	uint192_t occupant;
+
+	if (zero_key(words, key))
+		return BT_INSERT_OK;
+	b = ops -> ot_idx(t, key);
+	if (t -> offset_table[b] == BT_STASH_OFFSET) {
+		if (!bt_stash_insert(t -> stash, key, words * sizeof(unsigned int)))
+			added(u, ops, key);
+		return BT_INSERT_OK;
+	}
+	idx = ops -> ht_idx(t, key, (unsigned int)t -> offset_table[b]);
+	if (match_key(t, words, idx, key))
+		return BT_INSERT_OK;
+	if (u -> num_keys >= t -> hash_table_size)
+		return BT_INSERT_FULL;
+
+	if (empty_slot(t, words, idx)) {
+		store_key(t, words, idx, key);
+		u -> next_slot[idx] = u -> bucket_head[b];
+		u -> bucket_head[b] = idx;
+	}
+	else {
+		load_key(t, words, idx, &occupant);
+		other = ops -> ot_idx(t, &occupant);
+		if (other != b && bucket_size(u, other) <= bucket_size(u, b) &&
+		    !move_bucket(u, ops, other, NULL, key, idx)) {
+			u -> next_slot[idx] = u -> bucket_head[b];
+			u -> bucket_head[b] = idx;
+		}
+		else if (move_bucket(u, ops, b, key, NULL, idx)) {
+			if (other == b || bucket_size(u, other) <= bucket_size(u, b) ||
+			    move_bucket(u, ops, other, NULL, key, idx))
+				return BT_INSERT_FULL;
+			u -> next_slot[idx] = u -> bucket_head[b];
+			u -> bucket_head[b] = idx;
+		}
+	}
+
+	u -> num_keys++;
+	added(u, ops, key);
+	return BT_INSERT_OK;
+}
+
+static unsigned int delete(bt_update *u, const void *key)
+{
+	bt_table *t = u -> table;
+	const key_ops *ops = get_ops(t);
+	unsigned int b, idx, *link;
+
+	if (zero_key(ops -> words, key))
+		return BT_NOT_FOUND;
+	b = ops -> ot_idx(t, key);
+	if (t -> offset_table[b] == BT_STASH_OFFSET) {
+		idx = bt_stash_remove(t -> stash, key, ops -> words * sizeof(unsigned int));
+		if (idx == BT_NOT_FOUND)
+			return idx;
+		u -> deletes++;
+		return t -> hash_table_size + idx;
+	}
+	idx = ops -> ht_idx(t, key, (unsigned int)t -> offset_table[b]);
+	if (!match_key(t, ops -> words, idx, key))
+		return BT_NOT_FOUND;
+
+	clear_slot(t, ops -> words, idx);
+	for (link = &u -> bucket_head[b]; *link != idx; link = &u -> next_slot[*link]);
+	*link = u -> next_slot[idx];
+	u -> num_keys--;
+	u -> deletes++;
+	return idx;
+}
+
+int bt_insert_64(bt_update *u, uint64_t hash)
+{
+	hash = mix_64(u -> table, hash);
+	return insert(u, &hash);
+}
+
+int bt_insert_128(bt_update *u, uint128_t hash)
+{
+	hash = mix_128(u -> table, hash);
+	return insert(u, &hash);
+}
+
+int bt_insert_192(bt_update *u, uint192_t hash)
+{
+	hash = mix_192(u -> table, hash);
+	return insert(u, &hash);
+}
+
+unsigned int bt_delete_64(bt_update *u, uint64_t hash)
+{
+	hash = mix_64(u -> table, hash);
+	return delete(u, &hash);
+}
+
+unsigned int bt_delete_128(bt_update *u, uint128_t hash)
+{
+	hash = mix_128(u -> table, hash);
+	return delete(u, &hash);
+}
+
+unsigned int bt_delete_192(bt_update *u, uint192_t hash)
+{
+	hash = mix_192(u -> table, hash);
+	return delete(u, &hash);
+}
@@ -5,6 +5,7 @@
 static uint64_t *loaded_hashes_64;
 static uint128_t *loaded_hashes_128;
 static uint192_t *loaded_hashes_192;
+static unsigned int *loaded_hashes_n;
 static unsigned int num_loaded_hashes = 0;
 
 static OFFSET_TABLE_WORD *offset_table = NULL;
@@ -13,164 +14,43 @@ static unsigned int hash_table_size = 0;
 
 static unsigned int total_memory_in_bytes = 0;
 
-static void load_hashes_64(char *filename)
-{
-	FILE *fp;
-	char string_a[9], string_b[9];
-	unsigned int iter;
-
-	fprintf(stdout, "Loading Hashes...");
-
-	fp = fopen(filename, "r");
-	if (fp == NULL) {
-		fprintf(stderr, "Error reading file.\n");
-		exit(0);
-	}
-	while (fscanf(fp, "%08s%08s\n", string_a, string_b) == 2) num_loaded_hashes++;
-	fclose(fp);
-
-	fp = fopen(filename, "r");
-	if (fp == NULL) {
-		fprintf(stderr, "Error reading file.\n");
-		exit(0);
-	}
-
-	loaded_hashes_64 = (uint64_t *) calloc(num_loaded_hashes, sizeof(uint64_t));
-	total_memory_in_bytes += (unsigned long long)num_loaded_hashes * sizeof(uint64_t);
-
-	iter = 0;
-
-	while(fscanf(fp, "%08s%08s\n", string_a, string_b) == 2) {
-
-		uint64_t input_hash_64;
-		unsigned int a, b, c, d;
-
-		string_a[8] = string_b[8] = 0;
-
-		a = (unsigned int) strtol(string_a, NULL, 16);
-		b = (unsigned int) strtol(string_b, NULL, 16);
-
-		input_hash_64 = ((uint64_t)b << 32) | (uint64_t)a;
-
-		loaded_hashes_64[iter++] = input_hash_64;
-
-	}
-
-	fprintf(stdout, "Done.\n");
-
-	fprintf(stdout, "Number of loaded hashes(in millions):%Lf\n", (long double)num_loaded_hashes/ ((long double)1000.00 * 1000.00));
-	fprintf(stdout, "Size of Loaded Hashes(in GBs):%Lf\n\n", ((long double)total_memory_in_bytes) / ((long double) 1024 * 1024 * 1024));
+static bt_key_file key_file;
 
-	fclose(fp);
-}
-
-static void load_hashes_128(char *filename)
+/* Takes a binary key file (see keyconv.c) as it is, a hex list otherwise. */
+static void load_hashes(int hash_type, char *filename)
 {
-	FILE *fp;
-	char string_a[9], string_b[9], string_c[9], string_d[9];
-	unsigned int iter;
-
-	fprintf(stdout, "Loading Hashes...");
-
-	fp = fopen(filename, "r");
-	if (fp == NULL) {
-		fprintf(stderr, "Error reading file.\n");
-		exit(0);
-	}
-	while (fscanf(fp, "%08s%08s%08s%08s\n", string_a, string_b, string_c, string_d) == 4) num_loaded_hashes++;
-	fclose(fp);
+	void *keys;
 
-	fp = fopen(filename, "r");
-	if (fp == NULL) {
-		fprintf(stderr, "Error reading file.\n");
-		exit(0);
+	if (!bt_keys_map(&key_file, filename)) {
+		if (key_file.hash_type != hash_type) {
+			fprintf(stderr, "Key file holds %d bit hashes.\n", key_file.hash_type);
+			exit(0);
+		}
+		keys = key_file.keys;
+		num_loaded_hashes = key_file.num_keys;
 	}
+	else
+		num_loaded_hashes = bt_hex_load(hash_type, filename, &keys, 3);
 
-	loaded_hashes_128 = (uint128_t *) calloc(num_loaded_hashes, sizeof(uint128_t));
-	total_memory_in_bytes += (unsigned long long)num_loaded_hashes * sizeof(uint128_t);
-
-	iter = 0;
-
-	while(fscanf(fp, "%08s%08s%08s%08s\n", string_a, string_b, string_c, string_d) == 4) {
-
-		uint128_t input_hash_128;
-		unsigned int a, b, c, d;
-
-		string_a[8] = string_b[8] = string_c[8] = string_d[8] = 0;
-
-		a = (unsigned int) strtol(string_a, NULL, 16);
-		b = (unsigned int) strtol(string_b, NULL, 16);
-		c = (unsigned int) strtol(string_c, NULL, 16);
-		d = (unsigned int) strtol(string_d, NULL, 16);
-
-		input_hash_128.HI64 = ((uint64_t)d << 32) | (uint64_t)c;
-		input_hash_128.LO64 = ((uint64_t)b << 32) | (uint64_t)a;
-
-		loaded_hashes_128[iter++] = input_hash_128;
-
+	if (hash_type == 64) {
+		loaded_hashes_64 = (uint64_t *)keys;
+		total_memory_in_bytes += (unsigned long long)num_loaded_hashes * sizeof(uint64_t);
 	}
-
-	fprintf(stdout, "Done.\n");
-
-	fprintf(stdout, "Number of loaded hashes(in millions):%Lf\n", (long double)num_loaded_hashes/ ((long double)1000.00 * 1000.00));
-	fprintf(stdout, "Size of Loaded Hashes(in GBs):%Lf\n\n", ((long double)total_memory_in_bytes) / ((long double) 1024 * 1024 * 1024));
-
-	fclose(fp);
-}
-
-static void load_hashes_160(char *filename)
-{
-	FILE *fp;
-	char string_a[9], string_b[9], string_c[9], string_d[9], string_e[9];
-	unsigned int iter;
-
-	fprintf(stdout, "Loading Hashes...");
-
-	fp = fopen(filename, "r");
-	if (fp == NULL) {
-		fprintf(stderr, "Error reading file.\n");
-		exit(0);
+	else if (hash_type == 128) {
+		loaded_hashes_128 = (uint128_t *)keys;
+		total_memory_in_bytes += (unsigned long long)num_loaded_hashes * sizeof(uint128_t);
 	}
-	while (fscanf(fp, "%08s%08s%08s%08s%08s\n", string_a, string_b, string_c, string_d, string_e) == 5) num_loaded_hashes++;
-	fclose(fp);
-
-	fp = fopen(filename, "r");
-	if (fp == NULL) {
-		fprintf(stderr, "Error reading file.\n");
-		exit(0);
+	else if (hash_type == 192) {
+		loaded_hashes_192 = (uint192_t *)keys;
+		total_memory_in_bytes += (unsigned long long)num_loaded_hashes * sizeof(uint192_t);
 	}
-
-	loaded_hashes_192 = (uint192_t *) calloc(num_loaded_hashes, sizeof(uint192_t));
-	total_memory_in_bytes += (unsigned long long)num_loaded_hashes * sizeof(uint192_t);
-
-	iter = 0;
-
-	while(fscanf(fp, "%08s%08s%08s%08s%08s\n", string_a, string_b, string_c, string_d, string_e) == 5) {
-
-		uint192_t input_hash_192;
-		unsigned int a, b, c, d, e;
-
-		string_a[8] = string_b[8] = string_c[8] = string_d[8] = string_e[8] = 0;
-
-		a = (unsigned int) strtol(string_a, NULL, 16);
-		b = (unsigned int) strtol(string_b, NULL, 16);
-		c = (unsigned int) strtol(string_c, NULL, 16);
-		d = (unsigned int) strtol(string_d, NULL, 16);
-		e = (unsigned int) strtol(string_e, NULL, 16);
-
-		input_hash_192.HI = (uint64_t)e;
-		input_hash_192.MI = ((uint64_t)d << 32) | (uint64_t)c;
-		input_hash_192.LO = ((uint64_t)b << 32) | (uint64_t)a;
-
-		loaded_hashes_192[iter++] = input_hash_192;
+	else {
+		loaded_hashes_n = (unsigned int *)keys;
+		total_memory_in_bytes += (unsigned long long)num_loaded_hashes * (hash_type / 8);
 	}
 
-	fprintf(stdout, "Done.\n");
-
 	fprintf(stdout, "Number of loaded hashes(in millions):%Lf\n", (long double)num_loaded_hashes/ ((long double)1000.00 * 1000.00));
 	fprintf(stdout, "Size of Loaded Hashes(in GBs):%Lf\n\n", ((long double)total_memory_in_bytes) / ((long double) 1024 * 1024 * 1024));
-
-	fclose(fp);
 }
 
 static unsigned int modulo64_31b(uint64_t a, unsigned int N)
@@ -253,7 +133,7 @@ int main(int argc, char *argv[])
 		/*
 		 * Load 64bit hashes into the array 'loaded_hashes_192'
 		 */
-		load_hashes_64(argv[1]);
+		load_hashes(64, argv[1]);
 
 		/*
 		 * Build the tables.
@@ -296,7 +176,7 @@ int main(int argc, char *argv[])
 		/*
 		 * Load 128bit hashes into the array 'loaded_hashes_192'
 		 */
-		load_hashes_128(argv[1]);
+		load_hashes(128, argv[1]);
 
 		/*
 		 * Build the tables.
@@ -341,7 +221,7 @@ int main(int argc, char *argv[])
 		/*
 		 * Load 160bit hashes into the array 'loaded_hashes_192'
 		 */
-		 load_hashes_160(argv[1]);
+		load_hashes(192, argv[1]);
 
 		/*
 		 * Build the tables.
@@ -382,13 +262,49 @@ int main(int argc, char *argv[])
 			free(offset_table);
 		}
 	}
+	else if (BT_VALID_HASH_TYPE(hash_type)) {
+		bt_table table;
+		// Building tables for packed hashes, hash_type / 32 words each.
+		load_hashes(hash_type, argv[1]);
+
+		/*
+		 * Build the tables.
+		 */
+		if (num_loaded_hashes = create_perfect_hash_table(hash_type, (void *)loaded_hashes_n,
+		       num_loaded_hashes,
+		       &offset_table,
+		       &offset_table_size,
+		       &hash_table_size, 2)) {
+
+			lookup = 3;
+			if (lookup >= num_loaded_hashes) lookup = num_loaded_hashes - 1;
+
+			/*
+			 * Same lookup as above, done by bt_lookup_n().
+			 */
+			bt_table_init(&table, hash_type, hash_table_n, offset_table, offset_table_size, hash_table_size);
+			if (bt_lookup_n(&table, loaded_hashes_n + (size_t)lookup * BT_HASH_WORDS(hash_type)) != BT_NOT_FOUND)
+				fprintf(stdout, "Lookup successful.\n");
+			else
+				fprintf(stderr, "Lookup failed.\n");
+		}
+		else {
+			free(hash_table_n);
+			free(offset_table);
+		}
+	}
 
 	else
 		fprintf(stderr, "Unsupported hash type.\n");
 
-	free(loaded_hashes_64);
-	free(loaded_hashes_128);
-	free(loaded_hashes_192);
+	if (key_file.map)
+		bt_keys_unmap(&key_file);
+	else {
+		free(loaded_hashes_64);
+		free(loaded_hashes_128);
+		free(loaded_hashes_192);
+		free(loaded_hashes_n);
+	}
 
 	return 0;
 }
\ No newline at end of file
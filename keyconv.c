@@ -0,0 +1,101 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+/* Converts hash lists between the hex format demo.c reads and binary key files. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "bt_interface.h"
+
+#define CHUNK_KEYS (1 << 20)
+#define LINE_MAX_LEN (BT_MAX_HASH_BITS / 4 + 1)
+
+static void to_binary(int hash_type, char *hex_file, char *key_file)
+{
+	bt_key_writer w;
+	unsigned int num_keys, i, n;
+	size_t key_size = hash_type / 8;
+	void *keys;
+
+	num_keys = bt_hex_load(hash_type, hex_file, &keys, 0);
+
+	if (bt_keys_writer_open(&w, key_file, hash_type, 0)) {
+		fprintf(stderr, "Error creating key file.\n");
+		exit(0);
+	}
+	for (i = 0; i < num_keys; i += n) {
+		n = num_keys - i < CHUNK_KEYS ? num_keys - i : CHUNK_KEYS;
+		if (bt_keys_writer_append(&w, (char *)keys + (size_t)i * key_size, n)) {
+			fprintf(stderr, "Error writing key file.\n");
+			exit(0);
+		}
+	}
+	if (bt_keys_writer_close(&w)) {
+		fprintf(stderr, "Error writing key file.\n");
+		exit(0);
+	}
+
+	fprintf(stdout, "Converted %u hashes.\n", num_keys);
+	free(keys);
+}
+
+static void to_hex(char *key_file, char *hex_file)
+{
+	bt_key_file kf;
+	FILE *fp;
+	char *buf;
+	size_t len = 0, key_size;
+	unsigned int i;
+
+	if (bt_keys_map(&kf, key_file)) {
+		fprintf(stderr, "Error reading key file.\n");
+		exit(0);
+	}
+	key_size = kf.hash_type / 8;
+
+	fp = fopen(hex_file, "w");
+	buf = (char *) malloc(CHUNK_KEYS * LINE_MAX_LEN);
+	if (fp == NULL || buf == NULL) {
+		fprintf(stderr, "Error creating hex file.\n");
+		exit(0);
+	}
+
+	for (i = 0; i < kf.num_keys; i++) {
+		len += bt_hex_format(kf.hash_type, (char *)kf.keys + (size_t)i * key_size, buf + len);
+		if (len > (CHUNK_KEYS - 1) * LINE_MAX_LEN || i == kf.num_keys - 1) {
+			if (fwrite(buf, 1, len, fp) != len) {
+				fprintf(stderr, "Error writing hex file.\n");
+				exit(0);
+			}
+			len = 0;
+		}
+	}
+
+	fprintf(stdout, "Converted %u %d bit hashes.\n", kf.num_keys, kf.hash_type);
+	fclose(fp);
+	free(buf);
+	bt_keys_unmap(&kf);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc == 5 && !strcmp(argv[1], "to-bin")) {
+		int hash_type = (int) strtol(argv[2], NULL, 10);
+		if (!BT_VALID_HASH_TYPE(hash_type)) {
+			fprintf(stderr, "Unsupported hash type.\n");
+			return 0;
+		}
+		to_binary(hash_type, argv[3], argv[4]);
+	}
+	else if (argc == 4 && !strcmp(argv[1], "to-hex"))
+		to_hex(argv[2], argv[3]);
+	else
+		fprintf(stderr, "Usage: keyconv.out to-bin hash_type hex_file key_file\n"
+				"       keyconv.out to-hex key_file hex_file\n");
+
+	return 0;
+}
@@ -0,0 +1,472 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+/*
+ * Streams a candidate file through a table and writes the candidates found.
+ *
+ * Three stages overlap: a reader thread fills large buffers with whole lines
+ * (or whole binary hashes), the main thread parses each buffer in parallel and
+ * probes it with bt_probe_array_*(), and a writer thread writes the formatted
+ * hits. Buffers cycle between the stages through small queues, so memory use
+ * is fixed and the candidate file may be much larger than RAM. Each buffer is
+ * parsed on its own, so a hex hash split over several lines may be missed if
+ * it straddles two buffers.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "bt_interface.h"
+
+#define NUM_READ_BUFFERS 3
+#define NUM_WRITE_BUFFERS 4
+#define WRITE_BUFFER_SIZE (4 << 20)
+#define QUEUE_SLOTS 8
+
+typedef struct {
+	char *data;
+	size_t len;
+	int last;
+} read_buffer;
+
+typedef struct {
+	char *data;
+	size_t len;
+} write_buffer;
+
+typedef struct {
+	void *items[QUEUE_SLOTS];
+	unsigned int head, count;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+} queue;
+
+static queue free_read, full_read, free_write, full_write;
+
+static int hash_type;
+static size_t hash_size;
+static size_t read_size = 64 << 20;
+static int binary_input;
+static int in_fd;
+static FILE *out_fp;
+
+/* Bytes read ahead of the reader thread, to look for a key file header. */
+static char peek[BT_KEY_FILE_HEADER_SIZE];
+static size_t peek_len;
+
+/* Stage timings in nanoseconds. */
+static double read_ns, parse_ns, probe_ns, format_ns, write_ns;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void queue_init(queue *q)
+{
+	q -> head = q -> count = 0;
+	pthread_mutex_init(&q -> lock, NULL);
+	pthread_cond_init(&q -> changed, NULL);
+}
+
+static void queue_push(queue *q, void *item)
+{
+	pthread_mutex_lock(&q -> lock);
+	while (q -> count == QUEUE_SLOTS)
+		pthread_cond_wait(&q -> changed, &q -> lock);
+	q -> items[(q -> head + q -> count++) % QUEUE_SLOTS] = item;
+	pthread_cond_broadcast(&q -> changed);
+	pthread_mutex_unlock(&q -> lock);
+}
+
+static void *queue_pop(queue *q)
+{
+	void *item;
+
+	pthread_mutex_lock(&q -> lock);
+	while (!q -> count)
+		pthread_cond_wait(&q -> changed, &q -> lock);
+	item = q -> items[q -> head];
+	q -> head = (q -> head + 1) % QUEUE_SLOTS;
+	q -> count--;
+	pthread_cond_broadcast(&q -> changed);
+	pthread_mutex_unlock(&q -> lock);
+
+	return item;
+}
+
+static size_t read_fully(char *buf, size_t size, int *eof)
+{
+	size_t len = 0;
+	ssize_t n;
+
+	while (len < size) {
+		n = read(in_fd, buf + len, size - len);
+		if (n < 0) {
+			fprintf(stderr, "Error reading candidate file.\n");
+			exit(0);
+		}
+		if (!n) {
+			*eof = 1;
+			break;
+		}
+		len += n;
+	}
+	return len;
+}
+
+/*
+ * Fills buffers with whole records. The partial record at the end of a
+ * buffer is carried over to the start of the next one. Pages already read are
+ * dropped from the page cache so that huge files don't evict everything else.
+ */
+static void *reader(void *arg)
+{
+	char *carry;
+	size_t carry_len = 0;
+	off_t file_pos = peek_len, dropped = 0;
+	int eof = 0;
+
+	(void)arg;
+	if (!(carry = (char *) malloc(read_size))) {
+		fprintf(stderr, "Failed to allocate memory: carry.\n");
+		exit(0);
+	}
+	memcpy(carry, peek, peek_len);
+	carry_len = peek_len;
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	while (!eof) {
+		read_buffer *b = queue_pop(&free_read);
+		double start = now_ns();
+		size_t len, split;
+
+		memcpy(b -> data, carry, carry_len);
+		len = read_fully(b -> data + carry_len, read_size - carry_len, &eof);
+		file_pos += len;
+		len += carry_len;
+
+		split = len;
+		if (binary_input)
+			split = len - len % hash_size;
+		else if (!eof) {
+			while (split && b -> data[split - 1] != '\n')
+				split--;
+			if (!split)
+				split = len;
+		}
+		if (eof && split != len)
+			fprintf(stderr, "Ignoring %zu trailing bytes of a partial hash.\n", len - split);
+
+		carry_len = eof ? 0 : len - split;
+		memcpy(carry, b -> data + split, carry_len);
+		b -> len = split;
+		b -> last = eof;
+
+#ifdef POSIX_FADV_DONTNEED
+		posix_fadvise(in_fd, dropped, file_pos - dropped, POSIX_FADV_DONTNEED);
+		dropped = file_pos;
+#endif
+		read_ns += now_ns() - start;
+		queue_push(&full_read, b);
+	}
+
+	free(carry);
+	return NULL;
+}
+
+static void *writer(void *arg)
+{
+	write_buffer *w;
+
+	(void)arg;
+	while ((w = queue_pop(&full_write))) {
+		double start = now_ns();
+		if (fwrite(w -> data, 1, w -> len, out_fp) != w -> len) {
+			fprintf(stderr, "Error writing output.\n");
+			exit(0);
+		}
+		write_ns += now_ns() - start;
+		queue_push(&free_write, w);
+	}
+	fflush(out_fp);
+	return NULL;
+}
+
+static unsigned int probe(const bt_table *table, const void *keys, unsigned int num_keys, unsigned int *matches)
+{
+	if (!num_keys)
+		return 0;
+	if (hash_type == 64)
+		return bt_probe_array_64(table, keys, num_keys, NULL, matches);
+	else if (hash_type == 128)
+		return bt_probe_array_128(table, keys, num_keys, NULL, matches);
+	return bt_probe_array_192(table, keys, num_keys, NULL, matches);
+}
+
+/* Formats the hits, handing write buffers to the writer as they fill up. */
+static write_buffer *format_hits(write_buffer *w, const char *keys, const unsigned int *matches,
+				 unsigned int hits, uint64_t base, int positions)
+{
+	unsigned int i;
+
+	for (i = 0; i < hits; i++) {
+		if (WRITE_BUFFER_SIZE - w -> len < 64) {
+			queue_push(&full_write, w);
+			w = queue_pop(&free_write);
+			w -> len = 0;
+		}
+		if (positions)
+			w -> len += sprintf(w -> data + w -> len, "%llu\n", (unsigned long long)(base + matches[i]));
+		else
+			w -> len += bt_hex_format(hash_type, keys + (size_t)matches[i] * hash_size, w -> data + w -> len);
+	}
+	return w;
+}
+
+static void build_table(bt_table *table, const char *filename, unsigned int bloom_bits, unsigned int verbosity)
+{
+	OFFSET_TABLE_WORD *offset_table = NULL;
+	unsigned int offset_table_size, hash_table_size, num_keys;
+	bt_bloom_filter *filter = NULL;
+	bt_build_options opts = {0};
+	bt_key_file kf;
+	void *keys;
+
+	/* A binary key file is used as mapped, anything else is parsed as hex. */
+	if (!bt_keys_map(&kf, filename)) {
+		if (kf.hash_type != hash_type) {
+			fprintf(stderr, "Key file holds %d bit hashes.\n", kf.hash_type);
+			exit(0);
+		}
+		keys = kf.keys;
+		num_keys = kf.num_keys;
+	}
+	else
+		num_keys = bt_hex_load(hash_type, filename, &keys, verbosity);
+	if (verbosity)
+		fprintf(stderr, "Loaded %u hashes.\n", num_keys);
+
+	opts.bloom_bits_per_key = bloom_bits;
+	opts.bloom_filter_ptr = &filter;
+	opts.tune_target = BT_TUNE_FASTEST;
+
+	if (!create_perfect_hash_table_opt(hash_type, keys, num_keys, &offset_table,
+					   &offset_table_size, &hash_table_size, &opts, verbosity)) {
+		fprintf(stderr, "Failed to build the tables.\n");
+		exit(0);
+	}
+	fflush(stdout);
+	if (kf.map)
+		bt_keys_unmap(&kf);
+	else
+		free(keys);
+
+	bt_table_init(table, hash_type, hash_type == 64 ? hash_table_64 : (hash_type == 128 ? hash_table_128 : hash_table_192),
+		      offset_table, offset_table_size, hash_table_size);
+	table -> bloom_filter = filter;
+	table -> premix = opts.premix;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: probe.out [-b hash_list_file | -l table_file] [-s table_file] [-f bloom_bits]\n"
+			"                 [-r] [-p] [-o output_file] [-m read_buffer_MB] [-t trace_file [-k period]] [-v]\n"
+			"                 hash_type candidate_file\n"
+			"  -b  build the table from a hex hash list\n"
+			"  -l  load a table saved with -s\n"
+			"  -s  save the table\n"
+			"  -f  Bloom filter bits per hash when building\n"
+			"  -r  candidate file is a binary key file, or raw little endian hashes of 8, 16 or 24 bytes\n"
+			"  -p  write the positions of the candidates found instead of the hashes\n"
+			"  -t  record the candidates to a query trace for replay.out, one in period of them with -k\n"
+			"  -v  print per stage timings\n"
+			"Candidate file '-' reads standard input.\n");
+	exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *build_file = NULL, *load_file = NULL, *save_file = NULL, *out_file = NULL, *trace_file = NULL;
+	unsigned int bloom_bits = 0, verbosity = 0, trace_period = 1, *matches, i;
+	bt_qtrace_writer trace;
+	read_buffer read_buffers[NUM_READ_BUFFERS];
+	write_buffer write_buffers[NUM_WRITE_BUFFERS], *w;
+	pthread_t reader_thread, writer_thread;
+	uint64_t num_probes = 0, num_hits = 0, num_bytes = 0;
+	size_t max_keys;
+	int positions = 0, opt, last = 0;
+	bt_table table;
+	double start, elapsed;
+
+	while ((opt = getopt(argc, argv, "b:l:s:f:rpo:m:t:k:v")) != -1) {
+		switch (opt) {
+		case 'b': build_file = optarg; break;
+		case 'l': load_file = optarg; break;
+		case 's': save_file = optarg; break;
+		case 'f': bloom_bits = (unsigned int) strtol(optarg, NULL, 10); break;
+		case 'r': binary_input = 1; break;
+		case 'p': positions = 1; break;
+		case 'o': out_file = optarg; break;
+		case 'm': read_size = (size_t) strtol(optarg, NULL, 10) << 20; break;
+		case 't': trace_file = optarg; break;
+		case 'k': trace_period = (unsigned int) strtol(optarg, NULL, 10); break;
+		case 'v': verbosity = 2; break;
+		default: usage();
+		}
+	}
+	if (argc - optind != 2 || !build_file == !load_file || !read_size)
+		usage();
+
+	hash_type = (int) strtol(argv[optind], NULL, 10);
+	if (hash_type != 64 && hash_type != 128 && hash_type != 192) {
+		fprintf(stderr, "Unsupported hash type.\n");
+		return 0;
+	}
+	hash_size = hash_type == 64 ? sizeof(uint64_t) : (hash_type == 128 ? sizeof(uint128_t) : sizeof(uint192_t));
+
+	/* The builder reports on stdout, keep it quiet when stdout carries the hits. */
+	if (build_file)
+		build_table(&table, build_file, bloom_bits, out_file ? verbosity : 0);
+	else if (bt_table_load(&table, load_file) || table.hash_type != hash_type) {
+		fprintf(stderr, "Error loading table.\n");
+		return 0;
+	}
+	if (save_file && bt_table_save(&table, save_file))
+		fprintf(stderr, "Error saving table.\n");
+
+	if (trace_file && bt_qtrace_open(&trace, trace_file, hash_type, trace_period)) {
+		fprintf(stderr, "Error opening trace file.\n");
+		return 0;
+	}
+
+	in_fd = strcmp(argv[optind + 1], "-") ? open(argv[optind + 1], O_RDONLY) : 0;
+	out_fp = out_file ? fopen(out_file, "w") : stdout;
+	if (in_fd < 0 || out_fp == NULL) {
+		fprintf(stderr, "Error opening file.\n");
+		return 0;
+	}
+
+	/* Binary candidates may be raw hashes or a key file. */
+	if (binary_input) {
+		int eof = 0, file_type;
+		uint64_t num_keys;
+
+		peek_len = read_fully(peek, BT_KEY_FILE_HEADER_SIZE, &eof);
+		if (!bt_keys_header(peek, peek_len, &file_type, &num_keys)) {
+			if (file_type != hash_type) {
+				fprintf(stderr, "Key file holds %d bit hashes.\n", file_type);
+				return 0;
+			}
+			peek_len = 0;
+		}
+	}
+
+	/* A hex word takes at least 2 characters, with 2, 4 or 5 words per hash. */
+	max_keys = binary_input ? read_size / hash_size : read_size / (hash_type == 192 ? 10 : hash_type / 16) + 1;
+	if (!(matches = (unsigned int *) malloc(max_keys * sizeof(unsigned int)))) {
+		fprintf(stderr, "Failed to allocate memory: keys.\n");
+		return 0;
+	}
+
+	queue_init(&free_read);
+	queue_init(&full_read);
+	queue_init(&free_write);
+	queue_init(&full_write);
+	for (i = 0; i < NUM_READ_BUFFERS; i++) {
+		if (posix_memalign((void **)&read_buffers[i].data, 64, read_size)) {
+			fprintf(stderr, "Failed to allocate memory: read buffers.\n");
+			return 0;
+		}
+		queue_push(&free_read, &read_buffers[i]);
+	}
+	for (i = 0; i < NUM_WRITE_BUFFERS; i++) {
+		if (!(write_buffers[i].data = (char *) malloc(WRITE_BUFFER_SIZE))) {
+			fprintf(stderr, "Failed to allocate memory: write buffers.\n");
+			return 0;
+		}
+		queue_push(&free_write, &write_buffers[i]);
+	}
+
+	start = now_ns();
+	pthread_create(&reader_thread, NULL, reader, NULL);
+	pthread_create(&writer_thread, NULL, writer, NULL);
+
+	w = queue_pop(&free_write);
+	w -> len = 0;
+	while (!last) {
+		read_buffer *b = queue_pop(&full_read);
+		char *batch = b -> data;
+		unsigned int num_keys, hits;
+		double t0, t1, t2;
+
+		t0 = now_ns();
+		if (binary_input)
+			num_keys = b -> len / hash_size;
+		else
+			num_keys = bt_hex_parse(hash_type, b -> data, b -> len, (void **)&batch);
+		if (trace_file)
+			for (i = 0; i < num_keys; i++)
+				bt_qtrace_record(&trace, batch + i * hash_size);
+		t1 = now_ns();
+		hits = probe(&table, batch, num_keys, matches);
+		t2 = now_ns();
+		w = format_hits(w, batch, matches, hits, num_probes, positions);
+		format_ns += now_ns() - t2;
+		probe_ns += t2 - t1;
+		parse_ns += t1 - t0;
+
+		num_bytes += b -> len;
+		num_probes += num_keys;
+		num_hits += hits;
+		last = b -> last;
+		queue_push(&free_read, b);
+		if (!binary_input)
+			free(batch);
+
+		if (verbosity)
+			fprintf(stderr, "\r%.2f GB, %llu probes, %llu hits", (double)num_bytes / 1e9,
+				(unsigned long long)num_probes, (unsigned long long)num_hits);
+	}
+	queue_push(&full_write, w);
+	queue_push(&full_write, NULL);
+
+	pthread_join(reader_thread, NULL);
+	pthread_join(writer_thread, NULL);
+	elapsed = now_ns() - start;
+
+	if (verbosity)
+		fprintf(stderr, "\n");
+	fprintf(stderr, "Probed %llu hashes, %llu found, in %.3f s: %.3f GB/s, %.2f M probes/s.\n",
+		(unsigned long long)num_probes, (unsigned long long)num_hits, elapsed / 1e9,
+		(double)num_bytes / elapsed, (double)num_probes * 1e3 / elapsed);
+	if (verbosity)
+		fprintf(stderr, "Stage times(s): read %.3f, parse %.3f, probe %.3f, format %.3f, write %.3f.\n",
+			read_ns / 1e9, parse_ns / 1e9, probe_ns / 1e9, format_ns / 1e9, write_ns / 1e9);
+
+	if (out_fp != stdout)
+		fclose(out_fp);
+	if (trace_file && bt_qtrace_close(&trace))
+		fprintf(stderr, "Error writing trace file.\n");
+	if (in_fd)
+		close(in_fd);
+	for (i = 0; i < NUM_READ_BUFFERS; i++)
+		free(read_buffers[i].data);
+	for (i = 0; i < NUM_WRITE_BUFFERS; i++)
+		free(write_buffers[i].data);
+	free(matches);
+	bt_table_free(&table);
+
+	return 0;
+}
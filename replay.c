@@ -0,0 +1,213 @@
+/*
+ * This software is Copyright (c) 2015 Sayantan Datta <std2048 at gmail dot com>
+ * and it is hereby released to the general public under the following terms:
+ * Redistribution and use in source and binary forms, with or without modification, are permitted.
+ */
+
+/*
+ * Replays a query trace recorded with bt_qtrace_record() against a table
+ * snapshot saved with bt_table_save(), on T OpenMP threads.
+ *
+ * At full speed every thread looks up its share of the trace back to back,
+ * a contiguous slice so that the recorded locality survives, and one lookup
+ * in SAMPLE_PERIOD is timed. At the recorded rate, scaled by -R, thread t
+ * issues records t, t + T, t + 2T, ... each at its recorded time, and every
+ * lookup is timed from that time, so falling behind shows up as latency.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if _OPENMP
+#include <omp.h>
+#endif
+#include "bt_interface.h"
+
+#define SAMPLE_PERIOD 64
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void wait_until(double due)
+{
+	double now;
+
+	while ((now = now_ns()) < due) {
+		/* Sleep through long gaps, spin through short ones. */
+		if (due - now > 200000) {
+			double gap = due - now - 100000;
+			struct timespec ts;
+
+			ts.tv_sec = (time_t)(gap / 1e9);
+			ts.tv_nsec = (long)(gap - ts.tv_sec * 1e9);
+			nanosleep(&ts, NULL);
+		}
+	}
+}
+
+static int lookup(const bt_table *table, const void *keys, uint64_t i)
+{
+	if (table -> hash_type == 64)
+		return bt_lookup_64(table, ((const uint64_t *)keys)[i]) != BT_NOT_FOUND;
+	if (table -> hash_type == 128)
+		return bt_lookup_128(table, ((const uint128_t *)keys)[i]) != BT_NOT_FOUND;
+	return bt_lookup_192(table, ((const uint192_t *)keys)[i]) != BT_NOT_FOUND;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t *sorted, uint64_t n, double p)
+{
+	uint64_t i = (uint64_t)(p / 100 * n);
+	return n ? sorted[i < n ? i : n - 1] : 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: replay.out [-t threads] [-R speed] [-n loops] [-o output_file] table_file trace_file\n"
+			"Replays at full speed, or at the recorded rate times speed with -R (e.g. -R 2 for twice as fast).\n"
+			"-n repeats a full speed replay. Results go to output_file (default stdout) as CSV.\n");
+	exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int loops = 1;
+	int opt, threads = 1;
+	double speed = 0, start, elapsed;
+	const char *out_file = NULL;
+	uint64_t hits = 0, num_lookups, num_latencies = 0, *latencies;
+	bt_table table;
+	bt_qtrace trace;
+	FILE *out_fp;
+
+#if _OPENMP
+	threads = omp_get_max_threads();
+#endif
+	while ((opt = getopt(argc, argv, "t:R:n:o:")) != -1) {
+		switch (opt) {
+		case 't': threads = (int) strtol(optarg, NULL, 10); break;
+		case 'R': speed = strtod(optarg, NULL); break;
+		case 'n': loops = (unsigned int) strtol(optarg, NULL, 10); break;
+		case 'o': out_file = optarg; break;
+		default: usage();
+		}
+	}
+	if (argc - optind != 2 || threads < 1 || speed < 0 || !loops)
+		usage();
+	if (speed)
+		loops = 1;
+
+	if (bt_table_load(&table, argv[optind])) {
+		fprintf(stderr, "Error loading table.\n");
+		return 0;
+	}
+	if (bt_qtrace_load(&trace, argv[optind + 1]) || !trace.num_records) {
+		fprintf(stderr, "Error loading trace.\n");
+		return 0;
+	}
+	if (trace.hash_type != table.hash_type) {
+		fprintf(stderr, "Trace holds %d bit keys, the table %d bit keys.\n", trace.hash_type, table.hash_type);
+		return 0;
+	}
+	fprintf(stderr, "Trace of %llu records, 1 in %u sampled, over %.3f s.\n", (unsigned long long)trace.num_records,
+		trace.sample_period, trace.time_ns[trace.num_records - 1] / 1e9);
+
+	num_lookups = trace.num_records * loops;
+	latencies = (uint64_t *) malloc((speed ? num_lookups : loops * (trace.num_records / SAMPLE_PERIOD + threads)) *
+					sizeof(uint64_t));
+	if (!latencies) {
+		fprintf(stderr, "Failed to allocate memory: latencies.\n");
+		return 0;
+	}
+
+	start = now_ns();
+#if _OPENMP
+#pragma omp parallel num_threads(threads) reduction(+:hits)
+#endif
+	{
+		uint64_t i, n, first, last, local_num = 0, max_local, *local;
+		unsigned int tid = 0, nt = 1, loop;
+
+#if _OPENMP
+		tid = omp_get_thread_num();
+		nt = omp_get_num_threads();
+#endif
+		n = trace.num_records;
+		max_local = speed ? n / nt + 1 : loops * ((n / nt + 1) / SAMPLE_PERIOD + 1);
+		local = (uint64_t *) malloc(max_local * sizeof(uint64_t));
+		if (!local) {
+			fprintf(stderr, "Failed to allocate memory: latencies.\n");
+			exit(0);
+		}
+
+		if (speed) {
+			for (i = tid; i < n; i += nt) {
+				double due = start + trace.time_ns[i] / speed;
+
+				wait_until(due);
+				hits += lookup(&table, trace.keys, i);
+				local[local_num++] = (uint64_t)(now_ns() - due);
+			}
+		}
+		else {
+			first = n * tid / nt;
+			last = n * (tid + 1) / nt;
+			for (loop = 0; loop < loops; loop++)
+				for (i = first; i < last; i++) {
+					if ((i - first) % SAMPLE_PERIOD == 0) {
+						double t0 = now_ns();
+						hits += lookup(&table, trace.keys, i);
+						local[local_num++] = (uint64_t)(now_ns() - t0);
+					}
+					else
+						hits += lookup(&table, trace.keys, i);
+				}
+		}
+
+#if _OPENMP
+#pragma omp critical
+#endif
+		{
+			memcpy(latencies + num_latencies, local, local_num * sizeof(uint64_t));
+			num_latencies += local_num;
+		}
+		free(local);
+	}
+	elapsed = now_ns() - start;
+
+	qsort(latencies, num_latencies, sizeof(uint64_t), compare_u64);
+
+	out_fp = out_file ? fopen(out_file, "w") : stdout;
+	if (out_fp == NULL) {
+		fprintf(stderr, "Error opening output file.\n");
+		return 0;
+	}
+	fprintf(out_fp, "mode,speed,threads,lookups,hits,seconds,mops,latency_samples,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+	fprintf(out_fp, "%s,%.3f,%d,%llu,%llu,%.6f,%.3f,%llu,%llu,%llu,%llu,%llu,%llu\n",
+		speed ? "recorded" : "full", speed, threads, (unsigned long long)num_lookups, (unsigned long long)hits,
+		elapsed / 1e9, num_lookups * 1e3 / elapsed, (unsigned long long)num_latencies,
+		(unsigned long long)percentile(latencies, num_latencies, 50),
+		(unsigned long long)percentile(latencies, num_latencies, 90),
+		(unsigned long long)percentile(latencies, num_latencies, 99),
+		(unsigned long long)percentile(latencies, num_latencies, 99.9),
+		(unsigned long long)(num_latencies ? latencies[num_latencies - 1] : 0));
+	if (out_fp != stdout)
+		fclose(out_fp);
+
+	free(latencies);
+	bt_qtrace_free(&trace);
+	bt_table_free(&table);
+
+	return 0;
+}